@@ -0,0 +1,519 @@
+/* A small command agent for Jepsen nodes. Speaks a framed binary protocol over
+ * stdin/stdout (e.g. a single SSH channel), or, with -l <path>, over
+ * connections to a unix socket. Runs any number of commands concurrently,
+ * streams their output back, delivers signals to them, and reads and writes
+ * files.
+ *
+ * Every frame is a 9-byte header followed by a payload:
+ *
+ *   uint8  type
+ *   uint32 id      (big-endian) the job this frame belongs to
+ *   uint32 length  (big-endian) of the payload
+ *
+ * From the client:
+ *
+ *   EXEC    payload is a command, run with bash -c in a fresh process group
+ *   DATA    stdin for an EXEC job, or contents for a PUT job. An empty payload
+ *           means EOF.
+ *   SIGNAL  payload is a big-endian uint32 signal, sent to the job's process
+ *           group
+ *   PUT     payload is a path to write; followed by DATA frames
+ *   GET     payload is a path to read; contents come back as OUT frames
+ *
+ * From the agent:
+ *
+ *   OUT     stdout (or file contents)
+ *   ERR     stderr
+ *   EXIT    payload is a big-endian int32 exit status; 128 + signal if the
+ *           command was killed. Ends the job.
+ *   FAIL    payload is an error message. Ends the job. */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+enum {
+  EXEC = 1, DATA = 2, SIGNAL = 3, PUT = 4, GET = 5,
+  OUT = 16, ERR = 17, EXIT = 18, FAIL = 19
+};
+
+#define HEADER_SIZE 9
+#define CHUNK_SIZE  65536
+#define MAX_JOBS    256
+
+struct job {
+  int      used;
+  uint8_t  kind;
+  uint32_t id;
+  pid_t    pid;
+  int      in_fd, out_fd, err_fd, file_fd;
+  /* Pending stdin for the child */
+  char    *in_buf;
+  size_t   in_len, in_off, in_cap;
+  int      in_eof;
+  int      exited;
+  int      status;
+};
+
+static struct job jobs[MAX_JOBS];
+static int ctl_in, ctl_out;
+static int sigchld_pipe[2];
+
+/* Control input buffer */
+static char  *rbuf;
+static size_t rbuf_len, rbuf_cap;
+
+static void die(const char *msg) {
+  perror(msg);
+  exit(1);
+}
+
+static void write_all(int fd, const void *buf, size_t len) {
+  const char *p = buf;
+  while (0 < len) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN) {
+        struct pollfd pfd = { fd, POLLOUT, 0 };
+        poll(&pfd, 1, -1);
+        continue;
+      }
+      die("write");
+    }
+    p   += n;
+    len -= n;
+  }
+}
+
+static void put_u32(unsigned char *p, uint32_t x) {
+  p[0] = x >> 24; p[1] = x >> 16; p[2] = x >> 8; p[3] = x;
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+  return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+         ((uint32_t) p[2] << 8)  |  (uint32_t) p[3];
+}
+
+static void send_frame(uint8_t type, uint32_t id, const void *buf,
+                       uint32_t len) {
+  unsigned char h[HEADER_SIZE];
+  h[0] = type;
+  put_u32(h + 1, id);
+  put_u32(h + 5, len);
+  write_all(ctl_out, h, HEADER_SIZE);
+  if (0 < len) write_all(ctl_out, buf, len);
+}
+
+static void send_exit(uint32_t id, int32_t status) {
+  unsigned char p[4];
+  put_u32(p, (uint32_t) status);
+  send_frame(EXIT, id, p, 4);
+}
+
+static void send_fail(uint32_t id, const char *what) {
+  char msg[512];
+  snprintf(msg, sizeof(msg), "%s: %s", what, strerror(errno));
+  send_frame(FAIL, id, msg, strlen(msg));
+}
+
+static void set_nonblocking(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+static struct job *find_job(uint32_t id) {
+  for (int i = 0; i < MAX_JOBS; i++) {
+    if (jobs[i].used && jobs[i].id == id) return &jobs[i];
+  }
+  return NULL;
+}
+
+static struct job *new_job(uint32_t id, uint8_t kind) {
+  for (int i = 0; i < MAX_JOBS; i++) {
+    if (!jobs[i].used) {
+      struct job *j = &jobs[i];
+      memset(j, 0, sizeof(*j));
+      j->used = 1;
+      j->id   = id;
+      j->kind = kind;
+      j->pid  = -1;
+      j->in_fd = j->out_fd = j->err_fd = j->file_fd = -1;
+      return j;
+    }
+  }
+  errno = EAGAIN;
+  send_fail(id, "too many jobs");
+  return NULL;
+}
+
+static void close_fd(int *fd) {
+  if (0 <= *fd) {
+    close(*fd);
+    *fd = -1;
+  }
+}
+
+static void free_job(struct job *j) {
+  close_fd(&j->in_fd);
+  close_fd(&j->out_fd);
+  close_fd(&j->err_fd);
+  close_fd(&j->file_fd);
+  free(j->in_buf);
+  j->used = 0;
+}
+
+static void start_exec(uint32_t id, const char *cmd) {
+  struct job *j = new_job(id, EXEC);
+  if (!j) return;
+
+  int in[2], out[2], err[2];
+  if (pipe2(in, O_CLOEXEC) || pipe2(out, O_CLOEXEC) || pipe2(err, O_CLOEXEC)) {
+    send_fail(id, "pipe");
+    free_job(j);
+    return;
+  }
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    send_fail(id, "fork");
+    close(in[0]);  close(in[1]);
+    close(out[0]); close(out[1]);
+    close(err[0]); close(err[1]);
+    free_job(j);
+    return;
+  }
+
+  if (pid == 0) {
+    /* Child: a fresh process group, so signals reach the whole tree */
+    setsid();
+    signal(SIGPIPE, SIG_DFL);
+    dup2(in[0], 0);
+    dup2(out[1], 1);
+    dup2(err[1], 2);
+    execl("/bin/bash", "bash", "-c", cmd, (char *) NULL);
+    execl("/bin/sh", "sh", "-c", cmd, (char *) NULL);
+    _exit(127);
+  }
+
+  close(in[0]);
+  close(out[1]);
+  close(err[1]);
+  j->pid    = pid;
+  j->in_fd  = in[1];
+  j->out_fd = out[0];
+  j->err_fd = err[0];
+  set_nonblocking(j->in_fd);
+  set_nonblocking(j->out_fd);
+  set_nonblocking(j->err_fd);
+}
+
+static void start_put(uint32_t id, const char *path) {
+  struct job *j = new_job(id, PUT);
+  if (!j) return;
+  j->file_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (j->file_fd < 0) {
+    send_fail(id, path);
+    /* Keep the job around to swallow the DATA frames which follow */
+    j->exited = 1;
+  }
+}
+
+static void start_get(uint32_t id, const char *path) {
+  struct job *j = new_job(id, GET);
+  if (!j) return;
+  j->file_fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (j->file_fd < 0) {
+    send_fail(id, path);
+    free_job(j);
+  }
+}
+
+static void handle_data(uint32_t id, const char *buf, uint32_t len) {
+  struct job *j = find_job(id);
+  if (!j) return;
+
+  if (j->kind == PUT) {
+    if (j->exited) {
+      /* Failed to open; just wait for EOF */
+      if (len == 0) free_job(j);
+    } else if (len == 0) {
+      int synced = fsync(j->file_fd);
+      int closed = close(j->file_fd);
+      j->file_fd = -1;
+      if (synced || closed) {
+        send_fail(id, "close");
+      } else {
+        send_exit(id, 0);
+      }
+      free_job(j);
+    } else if (write(j->file_fd, buf, len) != (ssize_t) len) {
+      send_fail(id, "write");
+      close_fd(&j->file_fd);
+      j->exited = 1;
+    }
+    return;
+  }
+
+  if (len == 0) {
+    j->in_eof = 1;
+  } else if (0 <= j->in_fd) {
+    /* Buffer it; we write to the child as its pipe drains */
+    if (j->in_cap < j->in_len + len) {
+      j->in_cap = 2 * (j->in_len + len);
+      j->in_buf = realloc(j->in_buf, j->in_cap);
+      if (!j->in_buf) die("realloc");
+    }
+    memcpy(j->in_buf + j->in_len, buf, len);
+    j->in_len += len;
+  }
+}
+
+static void handle_signal(uint32_t id, const unsigned char *buf,
+                          uint32_t len) {
+  struct job *j = find_job(id);
+  if (j && j->kind == EXEC && 0 < j->pid && !j->exited && len == 4) {
+    kill(-j->pid, (int) get_u32(buf));
+  }
+}
+
+/* Parses and dispatches every complete frame in the control buffer. */
+static void handle_frames(void) {
+  size_t off = 0;
+  while (HEADER_SIZE <= rbuf_len - off) {
+    unsigned char *h   = (unsigned char *) rbuf + off;
+    uint8_t       type = h[0];
+    uint32_t      id   = get_u32(h + 1);
+    uint32_t      len  = get_u32(h + 5);
+    if (rbuf_len - off < HEADER_SIZE + (size_t) len) break;
+
+    char *payload = (char *) h + HEADER_SIZE;
+    /* Paths and commands want a NUL terminator; stash and restore the byte
+     * after the payload. */
+    char saved = payload[len];
+    payload[len] = '\0';
+    switch (type) {
+      case EXEC:   start_exec(id, payload);                break;
+      case DATA:   handle_data(id, payload, len);          break;
+      case SIGNAL: handle_signal(id, h + HEADER_SIZE, len); break;
+      case PUT:    start_put(id, payload);                 break;
+      case GET:    start_get(id, payload);                 break;
+      default:
+        errno = EINVAL;
+        send_fail(id, "unknown frame type");
+    }
+    payload[len] = saved;
+    off += HEADER_SIZE + len;
+  }
+  memmove(rbuf, rbuf + off, rbuf_len - off);
+  rbuf_len -= off;
+}
+
+/* Reads what we can from the control stream. Returns 0 on EOF. */
+static int read_control(void) {
+  /* Keep one spare byte for handle_frames' NUL terminator */
+  if (rbuf_cap - rbuf_len < CHUNK_SIZE + 1) {
+    rbuf_cap = 2 * rbuf_cap + CHUNK_SIZE + 1;
+    rbuf = realloc(rbuf, rbuf_cap);
+    if (!rbuf) die("realloc");
+  }
+  ssize_t n = read(ctl_in, rbuf + rbuf_len, CHUNK_SIZE);
+  if (n < 0) return (errno == EINTR || errno == EAGAIN) ? 1 : 0;
+  if (n == 0) return 0;
+  rbuf_len += n;
+  handle_frames();
+  return 1;
+}
+
+/* Forwards output from a child fd as frames of the given type. */
+static void pump_output(struct job *j, int *fd, uint8_t type) {
+  char buf[CHUNK_SIZE];
+  ssize_t n = read(*fd, buf, sizeof(buf));
+  if (0 < n) {
+    send_frame(type, j->id, buf, n);
+  } else if (n == 0 || (errno != EINTR && errno != EAGAIN)) {
+    close_fd(fd);
+  }
+}
+
+static void pump_input(struct job *j) {
+  if (j->in_off < j->in_len) {
+    ssize_t n = write(j->in_fd, j->in_buf + j->in_off, j->in_len - j->in_off);
+    if (0 < n) {
+      j->in_off += n;
+    } else if (n < 0 && errno != EINTR && errno != EAGAIN) {
+      /* Child closed stdin; drop the rest */
+      j->in_off = j->in_len;
+      j->in_eof = 1;
+    }
+  }
+  if (j->in_off == j->in_len) {
+    j->in_off = j->in_len = 0;
+    if (j->in_eof) close_fd(&j->in_fd);
+  }
+}
+
+static void pump_get(struct job *j) {
+  char buf[CHUNK_SIZE];
+  ssize_t n = read(j->file_fd, buf, sizeof(buf));
+  if (0 < n) {
+    send_frame(OUT, j->id, buf, n);
+  } else if (n == 0) {
+    send_exit(j->id, 0);
+    free_job(j);
+  } else if (errno != EINTR) {
+    send_fail(j->id, "read");
+    free_job(j);
+  }
+}
+
+static void reap(void) {
+  char drain[64];
+  while (0 < read(sigchld_pipe[0], drain, sizeof(drain)));
+
+  int status;
+  pid_t pid;
+  while (0 < (pid = waitpid(-1, &status, WNOHANG))) {
+    for (int i = 0; i < MAX_JOBS; i++) {
+      struct job *j = &jobs[i];
+      if (j->used && j->kind == EXEC && j->pid == pid) {
+        j->exited = 1;
+        j->status = WIFSIGNALED(status) ? 128 + WTERMSIG(status)
+                                        : WEXITSTATUS(status);
+      }
+    }
+  }
+}
+
+static void on_sigchld(int sig) {
+  int saved = errno;
+  (void) sig;
+  if (write(sigchld_pipe[1], "x", 1) < 0) {}
+  errno = saved;
+}
+
+/* Kills every running command and forgets all jobs. */
+static void kill_all(void) {
+  for (int i = 0; i < MAX_JOBS; i++) {
+    struct job *j = &jobs[i];
+    if (j->used) {
+      if (j->kind == EXEC && 0 < j->pid && !j->exited) {
+        kill(-j->pid, SIGKILL);
+        waitpid(j->pid, NULL, 0);
+      }
+      free_job(j);
+    }
+  }
+  rbuf_len = 0;
+}
+
+/* Serves requests on a single control stream until it closes. */
+static void serve(int in, int out) {
+  struct pollfd pfds[2 + 3 * MAX_JOBS];
+  struct job   *owners[2 + 3 * MAX_JOBS];
+  ctl_in  = in;
+  ctl_out = out;
+
+  for (;;) {
+    int n = 0, busy = 0;
+    pfds[n].fd = ctl_in;          pfds[n].events = POLLIN; owners[n++] = NULL;
+    pfds[n].fd = sigchld_pipe[0]; pfds[n].events = POLLIN; owners[n++] = NULL;
+    for (int i = 0; i < MAX_JOBS; i++) {
+      struct job *j = &jobs[i];
+      if (!j->used) continue;
+      if (j->kind == GET) busy = 1;
+      if (j->kind != EXEC) continue;
+      if (0 <= j->out_fd) {
+        pfds[n].fd = j->out_fd; pfds[n].events = POLLIN; owners[n++] = j;
+      }
+      if (0 <= j->err_fd) {
+        pfds[n].fd = j->err_fd; pfds[n].events = POLLIN; owners[n++] = j;
+      }
+      if (0 <= j->in_fd && (j->in_off < j->in_len || j->in_eof)) {
+        pfds[n].fd = j->in_fd; pfds[n].events = POLLOUT; owners[n++] = j;
+      }
+    }
+
+    if (poll(pfds, n, busy ? 0 : -1) < 0) {
+      if (errno == EINTR) continue;
+      die("poll");
+    }
+
+    for (int i = 2; i < n; i++) {
+      struct job *j = owners[i];
+      if (!pfds[i].revents) continue;
+      if (pfds[i].fd == j->out_fd) {
+        pump_output(j, &j->out_fd, OUT);
+      } else if (pfds[i].fd == j->err_fd) {
+        pump_output(j, &j->err_fd, ERR);
+      } else if (pfds[i].fd == j->in_fd) {
+        pump_input(j);
+      }
+    }
+    if (pfds[1].revents) reap();
+
+    for (int i = 0; i < MAX_JOBS; i++) {
+      struct job *j = &jobs[i];
+      if (!j->used) continue;
+      if (j->kind == GET) {
+        pump_get(j);
+      } else if (j->kind == EXEC && j->exited &&
+                 j->out_fd < 0 && j->err_fd < 0) {
+        send_exit(j->id, j->status);
+        free_job(j);
+      }
+    }
+
+    if (pfds[0].revents && !read_control()) {
+      kill_all();
+      return;
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  signal(SIGPIPE, SIG_IGN);
+  if (pipe2(sigchld_pipe, O_CLOEXEC | O_NONBLOCK)) die("pipe");
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_sigchld;
+  sa.sa_flags   = SA_RESTART | SA_NOCLDSTOP;
+  sigaction(SIGCHLD, &sa, NULL);
+
+  if (argc == 3 && 0 == strcmp(argv[1], "-l")) {
+    /* Listen on a unix socket, serving one connection at a time */
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, argv[2], sizeof(addr.sun_path) - 1);
+    unlink(argv[2]);
+    int s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (s < 0) die("socket");
+    if (bind(s, (struct sockaddr *) &addr, sizeof(addr))) die("bind");
+    if (listen(s, 4)) die("listen");
+    for (;;) {
+      int c = accept4(s, NULL, NULL, SOCK_CLOEXEC);
+      if (c < 0) {
+        if (errno == EINTR) continue;
+        die("accept");
+      }
+      serve(c, c);
+      close(c);
+    }
+  } else if (argc == 1) {
+    serve(0, 1);
+    return 0;
+  } else {
+    fprintf(stderr, "usage: %s [-l <socket path>]\n", argv[0]);
+    return 1;
+  }
+}
@@ -0,0 +1,353 @@
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/inet_diag.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* Breaks established flows between this node and a set of peers, so that a
+ * partition takes effect immediately, rather than whenever each socket's
+ * retransmit timer next fires. We talk to the kernel over netlink directly,
+ * so there's nothing to link against.
+ *
+ * With -f, we dump the conntrack table and delete every entry whose original
+ * source or destination is a peer, so stateful firewall rules re-evaluate
+ * those flows from scratch.
+ *
+ * With -k, we dump TCP sockets via sock_diag and destroy each one connected to
+ * a peer. The kernel aborts the socket, sending the peer an RST, and fails any
+ * pending calls with ECONNABORTED. This needs CONFIG_INET_DIAG_DESTROY.
+ *
+ * Prints "<conntrack entries deleted> <sockets destroyed>".
+ */
+
+#define BUF_SIZE 65536
+
+struct peers {
+  int n;
+  struct in_addr *addrs;
+};
+
+int is_peer(struct peers *peers, uint32_t addr) {
+  for (int i = 0; i < peers->n; i++) {
+    if (peers->addrs[i].s_addr == addr) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* A growable list of fixed-size records, which we collect during a dump and
+ * act on once it's complete. */
+struct list {
+  size_t size;
+  size_t count;
+  size_t cap;
+  char *data;
+};
+
+void list_add(struct list *l, const void *rec, size_t len) {
+  if (l->count == l->cap) {
+    l->cap  = l->cap ? l->cap * 2 : 64;
+    l->data = realloc(l->data, l->cap * l->size);
+    if (!l->data) {
+      perror("realloc");
+      exit(2);
+    }
+  }
+  char *dest = l->data + l->count * l->size;
+  memset(dest, 0, l->size);
+  memcpy(dest, rec, len);
+  l->count++;
+}
+
+int nl_open(int protocol) {
+  int sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, protocol);
+  if (sock < 0) {
+    perror("socket");
+    exit(2);
+  }
+  struct sockaddr_nl addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.nl_family = AF_NETLINK;
+  if (0 != bind(sock, (struct sockaddr *) &addr, sizeof(addr))) {
+    perror("bind");
+    exit(2);
+  }
+  return sock;
+}
+
+int nl_send(int sock, struct nlmsghdr *msg) {
+  struct sockaddr_nl kernel;
+  memset(&kernel, 0, sizeof(kernel));
+  kernel.nl_family = AF_NETLINK;
+  if (sendto(sock, msg, msg->nlmsg_len, 0,
+             (struct sockaddr *) &kernel, sizeof(kernel)) < 0) {
+    perror("sendto");
+    return -1;
+  }
+  return 0;
+}
+
+/* Sends a dump request, and calls f on each message until the dump is done.
+ * Returns 0, or a negative errno. */
+int nl_dump(int sock, struct nlmsghdr *req,
+            void (*f)(struct nlmsghdr *, void *), void *arg) {
+  static char buf[BUF_SIZE];
+  if (nl_send(sock, req)) {
+    return -errno;
+  }
+  while (1) {
+    ssize_t len = recv(sock, buf, sizeof(buf), 0);
+    if (len < 0) {
+      if (errno == EINTR) continue;
+      return -errno;
+    }
+    for (struct nlmsghdr *msg = (struct nlmsghdr *) buf;
+         NLMSG_OK(msg, len);
+         msg = NLMSG_NEXT(msg, len)) {
+      if (msg->nlmsg_type == NLMSG_DONE) {
+        return 0;
+      }
+      if (msg->nlmsg_type == NLMSG_ERROR) {
+        struct nlmsgerr *err = NLMSG_DATA(msg);
+        return err->error;
+      }
+      f(msg, arg);
+    }
+  }
+}
+
+/* Sends a request with NLM_F_ACK, and returns the kernel's error code: 0, or
+ * a negative errno. */
+int nl_request(int sock, struct nlmsghdr *req) {
+  char buf[BUF_SIZE];
+  req->nlmsg_flags |= NLM_F_ACK;
+  if (nl_send(sock, req)) {
+    return -errno;
+  }
+  while (1) {
+    ssize_t len = recv(sock, buf, sizeof(buf), 0);
+    if (len < 0) {
+      if (errno == EINTR) continue;
+      return -errno;
+    }
+    for (struct nlmsghdr *msg = (struct nlmsghdr *) buf;
+         NLMSG_OK(msg, len);
+         msg = NLMSG_NEXT(msg, len)) {
+      if (msg->nlmsg_type == NLMSG_ERROR) {
+        struct nlmsgerr *err = NLMSG_DATA(msg);
+        return err->error;
+      }
+    }
+  }
+}
+
+/* Finds a nested attribute of the given type, or NULL */
+struct nlattr *nla_find(void *data, int len, int type) {
+  struct nlattr *a = data;
+  while (len >= (int) sizeof(*a) && a->nla_len >= sizeof(*a)
+         && a->nla_len <= len) {
+    if ((a->nla_type & NLA_TYPE_MASK) == type) {
+      return a;
+    }
+    int step = NLA_ALIGN(a->nla_len);
+    len -= step;
+    a = (struct nlattr *) ((char *) a + step);
+  }
+  return NULL;
+}
+
+void *nla_data(struct nlattr *a) {
+  return (char *) a + NLA_HDRLEN;
+}
+
+int nla_len(struct nlattr *a) {
+  return a->nla_len - NLA_HDRLEN;
+}
+
+/* Conntrack */
+
+#define MAX_TUPLE 256
+
+struct ct_dump {
+  struct peers *peers;
+  struct list *tuples;  /* Raw CTA_TUPLE_ORIG attributes */
+};
+
+void ct_entry(struct nlmsghdr *msg, void *arg) {
+  struct ct_dump *d = arg;
+  struct nfgenmsg *nfg = NLMSG_DATA(msg);
+  void *attrs = (char *) nfg + NLMSG_ALIGN(sizeof(*nfg));
+  int len = msg->nlmsg_len - NLMSG_LENGTH(NLMSG_ALIGN(sizeof(*nfg)));
+
+  struct nlattr *orig = nla_find(attrs, len, CTA_TUPLE_ORIG);
+  if (!orig || MAX_TUPLE < orig->nla_len) return;
+  struct nlattr *ip = nla_find(nla_data(orig), nla_len(orig), CTA_TUPLE_IP);
+  if (!ip) return;
+  struct nlattr *src = nla_find(nla_data(ip), nla_len(ip), CTA_IP_V4_SRC);
+  struct nlattr *dst = nla_find(nla_data(ip), nla_len(ip), CTA_IP_V4_DST);
+  if (!src || !dst) return;
+
+  if (is_peer(d->peers, *(uint32_t *) nla_data(src)) ||
+      is_peer(d->peers, *(uint32_t *) nla_data(dst))) {
+    list_add(d->tuples, orig, orig->nla_len);
+  }
+}
+
+struct nfreq {
+  struct nlmsghdr nlh;
+  struct nfgenmsg nfg;
+  char attrs[MAX_TUPLE];
+};
+
+void nfreq_init(struct nfreq *req, int type, int flags) {
+  memset(req, 0, sizeof(*req));
+  req->nlh.nlmsg_len   = NLMSG_LENGTH(sizeof(struct nfgenmsg));
+  req->nlh.nlmsg_type  = (NFNL_SUBSYS_CTNETLINK << 8) | type;
+  req->nlh.nlmsg_flags = NLM_F_REQUEST | flags;
+  req->nfg.nfgen_family = AF_INET;
+  req->nfg.version      = NFNETLINK_V0;
+}
+
+int flush_conntrack(struct peers *peers) {
+  int sock = nl_open(NETLINK_NETFILTER);
+  struct list tuples = { MAX_TUPLE, 0, 0, NULL };
+  struct ct_dump d = { peers, &tuples };
+
+  struct nfreq req;
+  nfreq_init(&req, IPCTNL_MSG_CT_GET, NLM_F_DUMP);
+  int err = nl_dump(sock, &req.nlh, ct_entry, &d);
+  if (err) {
+    fprintf(stderr, "conntrack dump: %s\n", strerror(-err));
+    exit(3);
+  }
+
+  int deleted = 0;
+  for (size_t i = 0; i < tuples.count; i++) {
+    struct nlattr *orig = (struct nlattr *) (tuples.data + i * MAX_TUPLE);
+    nfreq_init(&req, IPCTNL_MSG_CT_DELETE, 0);
+    memcpy(req.attrs, orig, orig->nla_len);
+    req.nlh.nlmsg_len += NLA_ALIGN(orig->nla_len);
+    err = nl_request(sock, &req.nlh);
+    if (err == 0) {
+      deleted++;
+    } else if (err != -ENOENT) {
+      /* ENOENT just means the entry expired after we saw it */
+      fprintf(stderr, "conntrack delete: %s\n", strerror(-err));
+    }
+  }
+  free(tuples.data);
+  close(sock);
+  return deleted;
+}
+
+/* Sockets */
+
+struct sock_dump {
+  struct peers *peers;
+  struct list *ids;  /* inet_diag_sockids */
+};
+
+void sock_entry(struct nlmsghdr *msg, void *arg) {
+  struct sock_dump *d = arg;
+  struct inet_diag_msg *diag = NLMSG_DATA(msg);
+  if (is_peer(d->peers, diag->id.idiag_dst[0])) {
+    list_add(d->ids, &diag->id, sizeof(diag->id));
+  }
+}
+
+struct diagreq {
+  struct nlmsghdr nlh;
+  struct inet_diag_req_v2 req;
+};
+
+void diagreq_init(struct diagreq *r, int type, int flags) {
+  memset(r, 0, sizeof(*r));
+  r->nlh.nlmsg_len      = sizeof(*r);
+  r->nlh.nlmsg_type     = type;
+  r->nlh.nlmsg_flags    = NLM_F_REQUEST | flags;
+  r->req.sdiag_family   = AF_INET;
+  r->req.sdiag_protocol = IPPROTO_TCP;
+}
+
+int kill_sockets(struct peers *peers) {
+  int sock = nl_open(NETLINK_SOCK_DIAG);
+  struct list ids = { sizeof(struct inet_diag_sockid), 0, 0, NULL };
+  struct sock_dump d = { peers, &ids };
+
+  /* Every state but LISTEN and CLOSE; see include/net/tcp_states.h */
+  struct diagreq req;
+  diagreq_init(&req, SOCK_DIAG_BY_FAMILY, NLM_F_DUMP);
+  req.req.idiag_states = ~((1 << 10) | (1 << 7)) & 0xfff;
+  int err = nl_dump(sock, &req.nlh, sock_entry, &d);
+  if (err) {
+    fprintf(stderr, "sock_diag dump: %s\n", strerror(-err));
+    exit(3);
+  }
+
+  int killed = 0;
+  for (size_t i = 0; i < ids.count; i++) {
+    diagreq_init(&req, SOCK_DESTROY, 0);
+    req.req.idiag_states = ~0;
+    memcpy(&req.req.id, ids.data + i * ids.size, ids.size);
+    err = nl_request(sock, &req.nlh);
+    if (err == 0) {
+      killed++;
+    } else if (err == -EOPNOTSUPP) {
+      fprintf(stderr, "sock_diag destroy: kernel lacks "
+          "CONFIG_INET_DIAG_DESTROY\n");
+      exit(4);
+    } else if (err != -ENOENT) {
+      fprintf(stderr, "sock_diag destroy: %s\n", strerror(-err));
+    }
+  }
+  free(ids.data);
+  close(sock);
+  return killed;
+}
+
+int main(int argc, char **argv) {
+  int flush = 0;
+  int kill  = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "fk")) != -1) {
+    switch (opt) {
+      case 'f': flush = 1; break;
+      case 'k': kill  = 1; break;
+      default: goto usage;
+    }
+  }
+  if (argc <= optind || !(flush || kill)) goto usage;
+
+  struct peers peers;
+  peers.n     = argc - optind;
+  peers.addrs = calloc(peers.n, sizeof(struct in_addr));
+  for (int i = 0; i < peers.n; i++) {
+    if (1 != inet_pton(AF_INET, argv[optind + i], &peers.addrs[i])) {
+      fprintf(stderr, "Not an IPv4 address: %s\n", argv[optind + i]);
+      return 1;
+    }
+  }
+
+  int deleted = flush ? flush_conntrack(&peers) : 0;
+  int killed  = kill  ? kill_sockets(&peers)    : 0;
+  printf("%d %d\n", deleted, killed);
+  return 0;
+
+usage:
+  fprintf(stderr, "usage: %s [-f] [-k] <peer-ip> ...\n", argv[0]);
+  fprintf(stderr, "Breaks established flows to and from the given peers. "
+      "-f deletes their conntrack entries; -k destroys TCP sockets connected "
+      "to them, which sends each peer an RST.\n");
+  return 1;
+}
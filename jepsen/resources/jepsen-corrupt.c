@@ -0,0 +1,250 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Applies a batch of file corruptions in one go. Stdin holds one fault per
+ * line:
+ *
+ *   <kind> <target> <offset> <length>
+ *
+ * Kinds are:
+ *
+ *   truncate   Cuts the file off at offset; length is ignored
+ *   bitflip    Flips one random bit in each of length bytes from offset
+ *   zero       Zeroes length bytes from offset, punching a hole where the
+ *              filesystem supports it
+ *   garbage    Overwrites length bytes from offset with random bytes
+ *
+ * A negative offset counts back from the end of the file. Ranges are clamped
+ * to the file.
+ *
+ * Targets are <selector>:<glob>, where the selector picks which matching
+ * regular files to damage: all, newest, oldest, or random. A target without a
+ * selector is the same as all:<target>.
+ *
+ * We fsync each file once we're done with it. For every range we damage, we
+ * print a line:
+ *
+ *   <kind> <file> <start> <end> <bits>
+ *
+ * where [start, end) is the byte range we changed, and bits, for bitflips, is
+ * a comma-separated list of the absolute bit offsets we flipped ("-"
+ * otherwise). Randomness comes from a seed, given with -s, so a batch can be
+ * replayed exactly. */
+
+uint64_t rng_state;
+
+/* xorshift64* */
+uint64_t rng() {
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * 2685821657736338717ULL;
+}
+
+/* Picks the files a target names. Returns the number found, filling paths,
+ * which the caller frees with globfree. */
+int select_files(char *target, glob_t *g, char ***files) {
+  char *selector = "all";
+  char *pattern  = target;
+  char *colon    = strchr(target, ':');
+  if (colon != NULL) {
+    *colon   = '\0';
+    selector = target;
+    pattern  = colon + 1;
+  }
+
+  int err = glob(pattern, 0, NULL, g);
+  if (err == GLOB_NOMATCH) {
+    return 0;
+  } else if (err != 0) {
+    fprintf(stderr, "glob %s failed\n", pattern);
+    exit(2);
+  }
+
+  /* Keep regular files only */
+  char **regular = calloc(g->gl_pathc, sizeof(char *));
+  time_t *mtimes = calloc(g->gl_pathc, sizeof(time_t));
+  long *mnanos   = calloc(g->gl_pathc, sizeof(long));
+  int n = 0;
+  for (size_t i = 0; i < g->gl_pathc; i++) {
+    struct stat st;
+    if (0 == stat(g->gl_pathv[i], &st) && S_ISREG(st.st_mode)) {
+      regular[n] = g->gl_pathv[i];
+      mtimes[n]  = st.st_mtim.tv_sec;
+      mnanos[n]  = st.st_mtim.tv_nsec;
+      n++;
+    }
+  }
+
+  int pick = -1;
+  if (0 == strcmp(selector, "all")) {
+    *files = regular;
+    free(mtimes);
+    free(mnanos);
+    return n;
+  } else if (n == 0) {
+    pick = -1;
+  } else if (0 == strcmp(selector, "random")) {
+    pick = rng() % n;
+  } else if (0 == strcmp(selector, "newest") ||
+             0 == strcmp(selector, "oldest")) {
+    int newest = (selector[0] == 'n');
+    pick = 0;
+    for (int i = 1; i < n; i++) {
+      int later = mtimes[pick] < mtimes[i] ||
+        (mtimes[pick] == mtimes[i] && mnanos[pick] < mnanos[i]);
+      if (later == newest) {
+        pick = i;
+      }
+    }
+  } else {
+    fprintf(stderr, "Unknown selector %s\n", selector);
+    exit(1);
+  }
+
+  free(mtimes);
+  free(mnanos);
+  if (pick < 0) {
+    *files = regular;
+    return 0;
+  }
+  regular[0] = regular[pick];
+  *files = regular;
+  return 1;
+}
+
+void fail(const char *what, const char *file) {
+  fprintf(stderr, "%s %s: %s\n", what, file, strerror(errno));
+  exit(2);
+}
+
+/* Writes exactly len bytes at offset */
+void pwrite_all(int fd, const char *file, const char *buf, size_t len,
+                off_t offset) {
+  while (0 < len) {
+    ssize_t n = pwrite(fd, buf, len, offset);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      fail("pwrite", file);
+    }
+    buf    += n;
+    len    -= n;
+    offset += n;
+  }
+}
+
+void corrupt(char *kind, char *file, int64_t offset, int64_t length) {
+  int fd = open(file, O_RDWR | O_CLOEXEC);
+  if (fd < 0) fail("open", file);
+  struct stat st;
+  if (0 != fstat(fd, &st)) fail("stat", file);
+  int64_t size = st.st_size;
+
+  /* Resolve and clamp the range */
+  int64_t start = offset < 0 ? size + offset : offset;
+  if (start < 0)    start = 0;
+  if (size < start) start = size;
+  int64_t end = start + (length < 0 ? 0 : length);
+  if (size < end)   end = size;
+
+  if (0 == strcmp(kind, "truncate")) {
+    if (0 != ftruncate(fd, start)) fail("ftruncate", file);
+    end = size;
+    printf("truncate %s %lld %lld -\n", file, (long long) start,
+           (long long) end);
+
+  } else if (0 == strcmp(kind, "bitflip")) {
+    printf("bitflip %s %lld %lld ", file, (long long) start, (long long) end);
+    if (start == end) printf("-");
+    for (int64_t i = start; i < end; i++) {
+      unsigned char byte;
+      if (1 != pread(fd, &byte, 1, i)) fail("pread", file);
+      int bit = rng() % 8;
+      byte ^= (1 << bit);
+      pwrite_all(fd, file, (char *) &byte, 1, i);
+      printf("%s%lld", i == start ? "" : ",", (long long) (i * 8 + bit));
+    }
+    printf("\n");
+
+  } else if (0 == strcmp(kind, "zero")) {
+    if (start < end &&
+        0 != fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                       start, end - start)) {
+      if (errno != EOPNOTSUPP) fail("fallocate", file);
+      /* No hole punching here; write zeroes instead */
+      char *zeroes = calloc(end - start, 1);
+      pwrite_all(fd, file, zeroes, end - start, start);
+      free(zeroes);
+    }
+    printf("zero %s %lld %lld -\n", file, (long long) start, (long long) end);
+
+  } else if (0 == strcmp(kind, "garbage")) {
+    char *buf = malloc(end - start + 1);
+    for (int64_t i = 0; i < end - start; i++) {
+      buf[i] = rng() & 0xff;
+    }
+    pwrite_all(fd, file, buf, end - start, start);
+    free(buf);
+    printf("garbage %s %lld %lld -\n", file, (long long) start,
+           (long long) end);
+
+  } else {
+    fprintf(stderr, "Unknown fault kind %s\n", kind);
+    exit(1);
+  }
+
+  if (0 != fsync(fd)) fail("fsync", file);
+  close(fd);
+}
+
+int main(int argc, char **argv) {
+  uint64_t seed = 0;
+  int opt;
+  while (-1 != (opt = getopt(argc, argv, "s:"))) {
+    switch (opt) {
+      case 's':
+        seed = strtoull(optarg, NULL, 10);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-s seed] < faults\n", argv[0]);
+        fprintf(stderr, "Each line of stdin is a fault: <kind> <target> "
+            "<offset> <length>. Kinds are truncate, bitflip, zero, and "
+            "garbage. Targets are [all|newest|oldest|random:]<glob>. Prints "
+            "the byte ranges damaged.\n");
+        return 1;
+    }
+  }
+  /* xorshift needs a nonzero state */
+  rng_state = seed * 0x9E3779B97F4A7C15ULL + 1;
+
+  char line[8192];
+  while (fgets(line, sizeof(line), stdin)) {
+    char kind[32];
+    char target[4096];
+    long long offset, length;
+    if (line[0] == '\n') continue;
+    if (4 != sscanf(line, "%31s %4095s %lld %lld", kind, target, &offset,
+                    &length)) {
+      fprintf(stderr, "Malformed fault: %s", line);
+      return 1;
+    }
+
+    glob_t g;
+    char **files;
+    int n = select_files(target, &g, &files);
+    for (int i = 0; i < n; i++) {
+      corrupt(kind, files[i], offset, length);
+    }
+    free(files);
+    globfree(&g);
+  }
+  return 0;
+}
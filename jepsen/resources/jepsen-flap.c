@@ -0,0 +1,174 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <nftables/libnftables.h>
+
+/* Flaps the network: alternates between two nftables rulesets on a fixed
+ * schedule, much as strobe-time alternates the clock. Stdin holds the
+ * ruleset which cuts the network, a line containing only %%, and the
+ * ruleset which restores it. Both are validated up front, so each flip is a
+ * single netlink transaction.
+ *
+ * Every period ms, we apply the cut ruleset, wait duty * period ms, and apply
+ * the restore ruleset. We schedule flips against absolute monotonic
+ * deadlines, so lateness in one flip doesn't push back the next. After
+ * duration seconds, or on SIGINT, SIGTERM, or SIGHUP, we restore the network
+ * and print the number of cuts, and the latest any flip began relative to its
+ * deadline, in microseconds. */
+
+const int64_t NANOS_PER_SEC = 1000000000;
+
+volatile sig_atomic_t stop = 0;
+
+void handle_signal(int sig) {
+  (void) sig;
+  stop = 1;
+}
+
+int64_t nanos(clockid_t clock) {
+  struct timespec now;
+  clock_gettime(clock, &now);
+  return ((int64_t) now.tv_sec) * NANOS_PER_SEC + now.tv_nsec;
+}
+
+/* Sleeps until the given time on a clock, or until we're asked to stop. */
+void sleep_until(clockid_t clock, int64_t t) {
+  struct timespec ts;
+  ts.tv_sec  = t / NANOS_PER_SEC;
+  ts.tv_nsec = t % NANOS_PER_SEC;
+  int err;
+  while (!stop &&
+         0 != (err = clock_nanosleep(clock, TIMER_ABSTIME, &ts, NULL))) {
+    if (err != EINTR) {
+      fprintf(stderr, "clock_nanosleep: %s\n", strerror(err));
+      exit(3);
+    }
+  }
+}
+
+/* Reads all of stdin into a null-terminated buffer */
+char *read_stdin() {
+  size_t cap = 4096;
+  size_t len = 0;
+  char *buf = malloc(cap);
+  size_t n;
+  while (0 < (n = fread(buf + len, 1, cap - len - 1, stdin))) {
+    len += n;
+    if (cap - len - 1 == 0) {
+      cap *= 2;
+      buf = realloc(buf, cap);
+    }
+  }
+  if (ferror(stdin)) {
+    perror("read");
+    exit(1);
+  }
+  buf[len] = '\0';
+  return buf;
+}
+
+void apply(struct nft_ctx *ctx, const char *rules) {
+  if (0 != nft_run_cmd_from_buffer(ctx, rules)) {
+    fprintf(stderr, "failed to apply ruleset:\n%s", rules);
+    exit(2);
+  }
+}
+
+void usage(char *name) {
+  fprintf(stderr, "usage: %s [-a <epoch-nanos>] <period> <duty> <duration> "
+      "< rulesets\n", name);
+  fprintf(stderr, "Period is in ms, duty is the fraction of each period "
+      "(0-1) the network spends cut, and duration is in seconds. Stdin holds "
+      "the cut ruleset, a line with just %%%%, and the restore ruleset. With "
+      "-a, waits until the given wall-clock time before starting.\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  int64_t at = 0;
+  int opt;
+  while (-1 != (opt = getopt(argc, argv, "a:"))) {
+    switch (opt) {
+      case 'a':
+        at = atoll(optarg);
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+  if (argc - optind < 3) {
+    usage(argv[0]);
+  }
+
+  int64_t period   = atof(argv[optind]) * 1000000;
+  double  duty     = atof(argv[optind + 1]);
+  int64_t duration = atof(argv[optind + 2]) * NANOS_PER_SEC;
+  int64_t cut_for  = duty * period;
+  if (period <= 0 || duty < 0 || 1 < duty) {
+    usage(argv[0]);
+  }
+
+  /* Split stdin into cut and restore rulesets */
+  char *cut = read_stdin();
+  char *sep = strstr(cut, "\n%%\n");
+  if (sep == NULL) {
+    fprintf(stderr, "expected a line with just %%%% between rulesets\n");
+    return 1;
+  }
+  sep[1] = '\0';
+  char *restore = sep + 4;
+
+  struct nft_ctx *ctx = nft_ctx_new(NFT_CTX_DEFAULT);
+  if (ctx == NULL) {
+    fprintf(stderr, "nft_ctx_new failed\n");
+    return 2;
+  }
+  nft_ctx_set_dry_run(ctx, true);
+  apply(ctx, cut);
+  apply(ctx, restore);
+  nft_ctx_set_dry_run(ctx, false);
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handle_signal;
+  sigaction(SIGINT,  &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGHUP,  &sa, NULL);
+
+  if (0 < at) {
+    sleep_until(CLOCK_REALTIME, at);
+  }
+
+  int64_t start    = nanos(CLOCK_MONOTONIC);
+  int64_t end      = start + duration;
+  int64_t count    = 0;
+  int64_t max_late = 0;
+  int64_t late;
+
+  for (int64_t t = start; !stop && t < end; t += period) {
+    sleep_until(CLOCK_MONOTONIC, t);
+    if (stop) break;
+    late = nanos(CLOCK_MONOTONIC) - t;
+    if (max_late < late) max_late = late;
+    apply(ctx, cut);
+    count += 1;
+
+    sleep_until(CLOCK_MONOTONIC, t + cut_for);
+    late = nanos(CLOCK_MONOTONIC) - (t + cut_for);
+    if (max_late < late) max_late = late;
+    apply(ctx, restore);
+  }
+
+  /* Restore, whatever state we stopped in */
+  apply(ctx, restore);
+  nft_ctx_free(ctx);
+  printf("%lld %lld\n", (long long) count, (long long) (max_late / 1000));
+  return 0;
+}
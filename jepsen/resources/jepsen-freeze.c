@@ -0,0 +1,95 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Freezes or thaws a cgroup v2, and waits for the kernel to finish. Writing
+ * cgroup.freeze only asks the kernel to stop every task in the group; tasks
+ * stop as they next leave the kernel, and cgroup.events flips its "frozen"
+ * line once all of them have. The kernel signals that flip as a POLLPRI event
+ * on cgroup.events, so we poll for it rather than sleeping.
+ *
+ * Prints "<write nanos> <observed nanos>", in wall-clock time: when we wrote
+ * cgroup.freeze, and when the kernel reported the group (un)frozen.
+ */
+
+const int64_t NANOS_PER_SEC = 1000000000;
+
+int64_t wall_nanos() {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return ((int64_t) now.tv_sec) * NANOS_PER_SEC + now.tv_nsec;
+}
+
+/* Reads cgroup.events, and returns the value of its frozen line, or -1. */
+int frozen_state(int fd) {
+  char buf[512];
+  ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+  if (len < 0) {
+    perror("read cgroup.events");
+    exit(2);
+  }
+  buf[len] = '\0';
+  char *line = strstr(buf, "frozen ");
+  return line ? atoi(line + strlen("frozen ")) : -1;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 4) {
+    fprintf(stderr, "usage: %s <cgroup-dir> <0|1> <timeout-ms>\n", argv[0]);
+    fprintf(stderr, "Freezes (1) or thaws (0) every task in a cgroup v2, "
+        "and waits up to timeout-ms for the kernel to report it done.\n");
+    return 1;
+  }
+
+  char *dir      = argv[1];
+  int want       = atoi(argv[2]);
+  int timeout_ms = atoi(argv[3]);
+
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/cgroup.events", dir);
+  int events = open(path, O_RDONLY | O_CLOEXEC);
+  if (events < 0) {
+    perror(path);
+    return 2;
+  }
+  snprintf(path, sizeof(path), "%s/cgroup.freeze", dir);
+  int freeze = open(path, O_WRONLY | O_CLOEXEC);
+  if (freeze < 0) {
+    perror(path);
+    return 2;
+  }
+
+  /* Prime poll: the first read clears any pending event */
+  frozen_state(events);
+
+  int64_t written = wall_nanos();
+  if (write(freeze, want ? "1" : "0", 1) != 1) {
+    perror("write cgroup.freeze");
+    return 2;
+  }
+
+  int64_t deadline = written + (int64_t) timeout_ms * 1000000;
+  while (frozen_state(events) != want) {
+    int64_t left = (deadline - wall_nanos()) / 1000000;
+    if (left <= 0) {
+      fprintf(stderr, "Timed out waiting for %s to %s\n", dir,
+              want ? "freeze" : "thaw");
+      return 3;
+    }
+    struct pollfd pfd = { events, POLLPRI, 0 };
+    if (poll(&pfd, 1, left) < 0 && errno != EINTR) {
+      perror("poll");
+      return 2;
+    }
+  }
+
+  printf("%lld %lld\n", (long long) written, (long long) wall_nanos());
+  return 0;
+}
@@ -0,0 +1,364 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Injects disk faults into a process, without FUSE. Built with -shared, this
+ * is a library for LD_PRELOAD which wraps read, write, pread, pwrite, fsync,
+ * and fdatasync. Built with -DJEPSEN_IOFAULT_CTL, it's a command which
+ * controls every process using the library on this node.
+ *
+ * They share a control page: a small file, normally in /dev/shm, which each
+ * process maps. The page says which faults to inject, and how often. While
+ * faults are disabled, each call costs one extra load before it goes straight
+ * to libc. Once enabled, faults only apply to regular files, optionally just
+ * those under a path prefix, so sockets and pipes are left alone.
+ *
+ * Probabilities are in parts per million, and delays in nanoseconds:
+ *
+ *   read_eio       Reads fail with EIO
+ *   write_eio      Writes fail with EIO
+ *   write_enospc   Writes fail with ENOSPC
+ *   short_write    Writes write only part of their buffer
+ *   fsync_eio      fsyncs fail with EIO
+ *   fsync_drop     fsyncs return success without syncing anything
+ *   read_delay     Delay before each read
+ *   write_delay    Delay before each write
+ *   fsync_delay    Delay before each fsync
+ *
+ * The control command takes key=value pairs, plus enabled=0|1 and
+ * path=<prefix>, and prints the page afterwards, including the number of
+ * faults injected so far. */
+
+#define MAGIC 0x4a494f46 /* JIOF */
+
+struct control {
+  uint32_t magic;
+  uint32_t enabled;
+  uint32_t read_eio;
+  uint32_t write_eio;
+  uint32_t write_enospc;
+  uint32_t short_write;
+  uint32_t fsync_eio;
+  uint32_t fsync_drop;
+  uint64_t read_delay;
+  uint64_t write_delay;
+  uint64_t fsync_delay;
+  uint64_t injected;
+  char path[256];
+};
+
+static const char *DEFAULT_PAGE = "/dev/shm/jepsen-iofault";
+
+/* Opens and maps the control page, creating it if need be. Returns NULL if
+ * we can't. */
+static struct control *map_page(const char *page) {
+  int fd = open(page, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (fd < 0) return NULL;
+  /* Whoever creates the page, the DB's user must be able to write it */
+  fchmod(fd, 0666);
+  struct stat st;
+  if (0 != fstat(fd, &st) ||
+      (st.st_size < (off_t) sizeof(struct control) &&
+       0 != ftruncate(fd, sizeof(struct control)))) {
+    close(fd);
+    return NULL;
+  }
+  struct control *c = mmap(NULL, sizeof(struct control),
+                           PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (c == MAP_FAILED) return NULL;
+  if (c->magic != MAGIC) {
+    /* A fresh page is all zeroes, which is already disabled */
+    c->magic = MAGIC;
+  }
+  return c;
+}
+
+#ifndef JEPSEN_IOFAULT_CTL
+
+static struct control *ctl;
+
+static ssize_t (*real_read)(int, void *, size_t);
+static ssize_t (*real_write)(int, const void *, size_t);
+static ssize_t (*real_pread)(int, void *, size_t, off_t);
+static ssize_t (*real_pwrite)(int, const void *, size_t, off_t);
+static int (*real_fsync)(int);
+static int (*real_fdatasync)(int);
+
+/* Finds libc's version of a call the first time we need it. Another
+ * library's constructor, or libc's own startup, may call our wrappers before
+ * our constructor runs. */
+static void *resolve(void **slot, const char *name) {
+  void *f = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+  if (!f) {
+    f = dlsym(RTLD_NEXT, name);
+    __atomic_store_n(slot, f, __ATOMIC_RELEASE);
+  }
+  return f;
+}
+
+#define REAL(f) ((__typeof__(real_##f)) resolve((void **) &real_##f, #f))
+
+__attribute__((constructor))
+static void init() {
+  const char *page = getenv("JEPSEN_IOFAULT_PAGE");
+  ctl = map_page(page ? page : DEFAULT_PAGE);
+}
+
+static __thread uint64_t rng_state;
+
+/* xorshift64*, seeded per thread */
+static uint64_t rng() {
+  if (rng_state == 0) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    rng_state = (ts.tv_nsec ^ ((uint64_t) syscall(SYS_gettid) << 32)) | 1;
+  }
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * 2685821657736338717ULL;
+}
+
+static int chance(uint32_t ppm) {
+  return ppm && (rng() % 1000000) < ppm;
+}
+
+/* Is the control page on, and is this fd a file we should damage? */
+static int active(int fd) {
+  if (!ctl || !__atomic_load_n(&ctl->enabled, __ATOMIC_RELAXED)) return 0;
+  struct stat st;
+  if (0 != fstat(fd, &st) || !S_ISREG(st.st_mode)) return 0;
+  if (ctl->path[0] == '\0') return 1;
+
+  char link[64];
+  char path[4096];
+  snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+  ssize_t len = readlink(link, path, sizeof(path) - 1);
+  if (len < 0) return 0;
+  path[len] = '\0';
+  return 0 == strncmp(path, ctl->path, strnlen(ctl->path, sizeof(ctl->path)));
+}
+
+static void delay(uint64_t nanos) {
+  if (nanos) {
+    struct timespec ts = { nanos / 1000000000, nanos % 1000000000 };
+    while (0 != nanosleep(&ts, &ts) && errno == EINTR);
+  }
+}
+
+static void injected() {
+  __atomic_add_fetch(&ctl->injected, 1, __ATOMIC_RELAXED);
+}
+
+/* Decides how a write of count bytes should go. Returns -1 and sets errno if
+ * it should fail, or the number of bytes to actually write. */
+static ssize_t plan_write(size_t count) {
+  delay(ctl->write_delay);
+  if (chance(ctl->write_eio)) {
+    injected();
+    errno = EIO;
+    return -1;
+  }
+  if (chance(ctl->write_enospc)) {
+    injected();
+    errno = ENOSPC;
+    return -1;
+  }
+  if (1 < count && chance(ctl->short_write)) {
+    injected();
+    return 1 + rng() % (count - 1);
+  }
+  return count;
+}
+
+ssize_t read(int fd, void *buf, size_t count) {
+  if (active(fd)) {
+    delay(ctl->read_delay);
+    if (chance(ctl->read_eio)) {
+      injected();
+      errno = EIO;
+      return -1;
+    }
+  }
+  return REAL(read)(fd, buf, count);
+}
+
+ssize_t pread(int fd, void *buf, size_t count, off_t offset) {
+  if (active(fd)) {
+    delay(ctl->read_delay);
+    if (chance(ctl->read_eio)) {
+      injected();
+      errno = EIO;
+      return -1;
+    }
+  }
+  return REAL(pread)(fd, buf, count, offset);
+}
+
+ssize_t write(int fd, const void *buf, size_t count) {
+  if (active(fd)) {
+    ssize_t n = plan_write(count);
+    if (n < 0) return -1;
+    count = n;
+  }
+  return REAL(write)(fd, buf, count);
+}
+
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset) {
+  if (active(fd)) {
+    ssize_t n = plan_write(count);
+    if (n < 0) return -1;
+    count = n;
+  }
+  return REAL(pwrite)(fd, buf, count, offset);
+}
+
+#if __WORDSIZE == 64
+/* Large-file builds call these instead; on 64-bit they're the same calls */
+ssize_t pread64(int fd, void *buf, size_t count, off_t offset)
+  __attribute__((alias("pread")));
+ssize_t pwrite64(int fd, const void *buf, size_t count, off_t offset)
+  __attribute__((alias("pwrite")));
+#endif
+
+/* Returns 0 if a sync should go ahead, 1 if we should pretend it succeeded,
+ * or -1 with errno set if it should fail. */
+static int plan_sync(int fd) {
+  if (!active(fd)) return 0;
+  delay(ctl->fsync_delay);
+  if (chance(ctl->fsync_eio)) {
+    injected();
+    errno = EIO;
+    return -1;
+  }
+  if (chance(ctl->fsync_drop)) {
+    injected();
+    return 1;
+  }
+  return 0;
+}
+
+int fsync(int fd) {
+  int plan = plan_sync(fd);
+  if (plan) return plan < 0 ? -1 : 0;
+  return REAL(fsync)(fd);
+}
+
+int fdatasync(int fd) {
+  int plan = plan_sync(fd);
+  if (plan) return plan < 0 ? -1 : 0;
+  return REAL(fdatasync)(fd);
+}
+
+#else
+
+int main(int argc, char **argv) {
+  const char *page = getenv("JEPSEN_IOFAULT_PAGE");
+  int i = 1;
+  if (3 <= argc && 0 == strcmp(argv[1], "-p")) {
+    page = argv[2];
+    i    = 3;
+  }
+  if (!page) page = DEFAULT_PAGE;
+
+  const char *names[] = {
+    "enabled", "path", "read_eio", "write_eio", "write_enospc", "short_write",
+    "fsync_eio", "fsync_drop", "read_delay", "write_delay", "fsync_delay",
+    "injected"
+  };
+  int nnames = sizeof(names) / sizeof(names[0]);
+
+  /* Check every argument before we touch the page, so a typo can't leave
+   * live faults half-changed, or switched off. */
+  for (int a = i; a < argc; a++) {
+    char *eq = strchr(argv[a], '=');
+    if (!eq) goto usage;
+    int found = 0;
+    for (int n = 0; n < nnames; n++) {
+      if (strlen(names[n]) == (size_t) (eq - argv[a]) &&
+          0 == strncmp(argv[a], names[n], eq - argv[a])) {
+        found = 1;
+      }
+    }
+    if (!found) goto usage;
+  }
+
+  struct control *c = map_page(page);
+  if (!c) {
+    perror(page);
+    return 2;
+  }
+
+  struct { const char *name; uint32_t *u32; uint64_t *u64; } fields[] = {
+    { "enabled",      &c->enabled,      NULL },
+    { "read_eio",     &c->read_eio,     NULL },
+    { "write_eio",    &c->write_eio,    NULL },
+    { "write_enospc", &c->write_enospc, NULL },
+    { "short_write",  &c->short_write,  NULL },
+    { "fsync_eio",    &c->fsync_eio,    NULL },
+    { "fsync_drop",   &c->fsync_drop,   NULL },
+    { "read_delay",   NULL, &c->read_delay },
+    { "write_delay",  NULL, &c->write_delay },
+    { "fsync_delay",  NULL, &c->fsync_delay },
+    { "injected",     NULL, &c->injected }
+  };
+  int nfields = sizeof(fields) / sizeof(fields[0]);
+
+  /* Apply settings with faults off, and turn them on last, so processes
+   * never see a half-written page. */
+  int enable = -1;
+  uint32_t was = c->enabled;
+  __atomic_store_n(&c->enabled, 0, __ATOMIC_SEQ_CST);
+  for (; i < argc; i++) {
+    char *eq = strchr(argv[i], '=');
+    *eq = '\0';
+    char *key = argv[i];
+    char *val = eq + 1;
+    if (0 == strcmp(key, "enabled")) {
+      enable = atoi(val);
+      continue;
+    }
+    if (0 == strcmp(key, "path")) {
+      strncpy(c->path, val, sizeof(c->path) - 1);
+      c->path[sizeof(c->path) - 1] = '\0';
+      continue;
+    }
+    for (int f = 0; f < nfields; f++) {
+      if (0 == strcmp(key, fields[f].name)) {
+        if (fields[f].u32) *fields[f].u32 = strtoul(val, NULL, 10);
+        else               *fields[f].u64 = strtoull(val, NULL, 10);
+      }
+    }
+  }
+  __atomic_store_n(&c->enabled, enable < 0 ? was : (uint32_t) enable,
+                   __ATOMIC_SEQ_CST);
+
+  for (int f = 0; f < nfields; f++) {
+    printf("%s %llu\n", fields[f].name, fields[f].u32
+           ? (unsigned long long) *fields[f].u32
+           : (unsigned long long) *fields[f].u64);
+  }
+  printf("path %s\n", c->path);
+  return 0;
+
+usage:
+  fprintf(stderr, "usage: %s [-p page] [key=value ...]\n", argv[0]);
+  fprintf(stderr, "Sets fields of the jepsen-iofault control page, and "
+      "prints them. Keys are enabled, path, read_eio, write_eio, "
+      "write_enospc, short_write, fsync_eio, and fsync_drop (parts per "
+      "million), and read_delay, write_delay, and fsync_delay (ns).\n");
+  return 1;
+}
+
+#endif
@@ -0,0 +1,117 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <nftables/libnftables.h>
+
+/* Applies an nftables ruleset, read from stdin, as a single netlink
+ * transaction: the kernel commits every rule in it at once, or none of them.
+ * We parse and validate the ruleset with a dry run first, so that the only
+ * work left at commit time is the netlink batch itself.
+ *
+ * With -a <nanos>, waits until that CLOCK_REALTIME instant before committing,
+ * so that several nodes can commit together.
+ *
+ * Prints two CLOCK_REALTIME timestamps, in nanoseconds since the epoch: when
+ * we began the commit, and when the kernel acknowledged it. */
+
+const int64_t NANOS_PER_SEC = 1000000000;
+
+/* Wall clock, in nanoseconds since the epoch */
+int64_t wall_nanos() {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return ((int64_t) now.tv_sec) * NANOS_PER_SEC + now.tv_nsec;
+}
+
+/* Sleep until the given wall-clock time, in nanoseconds since the epoch */
+void sleep_until(int64_t nanos) {
+  struct timespec t;
+  t.tv_sec  = nanos / NANOS_PER_SEC;
+  t.tv_nsec = nanos % NANOS_PER_SEC;
+  int err;
+  while (0 != (err = clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &t, NULL))) {
+    if (err != EINTR) {
+      fprintf(stderr, "clock_nanosleep: %s\n", strerror(err));
+      exit(3);
+    }
+  }
+}
+
+/* Reads all of stdin into a null-terminated buffer */
+char *read_stdin() {
+  size_t cap = 4096;
+  size_t len = 0;
+  char *buf = malloc(cap);
+  size_t n;
+  while (0 < (n = fread(buf + len, 1, cap - len - 1, stdin))) {
+    len += n;
+    if (cap - len - 1 == 0) {
+      cap *= 2;
+      buf = realloc(buf, cap);
+    }
+  }
+  if (ferror(stdin)) {
+    perror("read");
+    exit(1);
+  }
+  buf[len] = '\0';
+  return buf;
+}
+
+int main(int argc, char **argv) {
+  int64_t at = 0;
+  int opt;
+  while (-1 != (opt = getopt(argc, argv, "a:"))) {
+    switch (opt) {
+      case 'a':
+        at = atoll(optarg);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-a <epoch-nanos>] < ruleset\n", argv[0]);
+        fprintf(stderr, "Applies the nftables ruleset on stdin as one atomic "
+            "transaction, optionally waiting until the given wall-clock time, "
+            "and prints the wall-clock nanoseconds at which the commit began "
+            "and was acknowledged.\n");
+        return 1;
+    }
+  }
+
+  char *ruleset = read_stdin();
+
+  struct nft_ctx *ctx = nft_ctx_new(NFT_CTX_DEFAULT);
+  if (ctx == NULL) {
+    fprintf(stderr, "nft_ctx_new failed\n");
+    return 2;
+  }
+
+  /* Validate */
+  nft_ctx_set_dry_run(ctx, true);
+  if (0 != nft_run_cmd_from_buffer(ctx, ruleset)) {
+    fprintf(stderr, "invalid ruleset:\n%s", ruleset);
+    return 2;
+  }
+  nft_ctx_set_dry_run(ctx, false);
+
+  if (0 < at) {
+    sleep_until(at);
+  }
+
+  /* Commit */
+  int64_t start = wall_nanos();
+  if (0 != nft_run_cmd_from_buffer(ctx, ruleset)) {
+    fprintf(stderr, "commit failed\n");
+    return 2;
+  }
+  int64_t end = wall_nanos();
+
+  nft_ctx_free(ctx);
+  free(ruleset);
+  printf("%lld %lld\n", (long long) start, (long long) end);
+  return 0;
+}
@@ -0,0 +1,149 @@
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/* A heartbeat mesh for measuring when partitions actually take effect. Every
+ * interval ms, we send a small UDP datagram to each peer, and we listen for
+ * theirs. When we haven't heard from a peer for timeout ms, we log that the
+ * link from that peer went down, as of when its next heartbeat was due. When
+ * we hear from it again, we log that the link came back up.
+ *
+ * Log lines go to stdout, and look like:
+ *
+ *   <wall-clock nanos> <peer ip> down
+ *   <wall-clock nanos> <peer ip> up
+ */
+
+const int64_t NANOS_PER_SEC = 1000000000;
+const int64_t NANOS_PER_MS  = 1000000;
+
+int64_t nanos(clockid_t clock) {
+  struct timespec now;
+  clock_gettime(clock, &now);
+  return ((int64_t) now.tv_sec) * NANOS_PER_SEC + now.tv_nsec;
+}
+
+/* Converts a monotonic time to wall-clock time */
+int64_t mono_to_wall(int64_t mono) {
+  return nanos(CLOCK_REALTIME) - (nanos(CLOCK_MONOTONIC) - mono);
+}
+
+struct peer {
+  char *ip;
+  struct sockaddr_in addr;
+  int64_t last;  /* Monotonic time we last heard from this peer */
+  int down;
+};
+
+int main(int argc, char **argv) {
+  if (argc < 5) {
+    fprintf(stderr, "usage: %s <port> <interval> <timeout> <peer-ip> ...\n",
+            argv[0]);
+    fprintf(stderr, "Interval and timeout are in ms. Sends a heartbeat to "
+        "each peer every interval, and logs when a peer's heartbeats stop "
+        "arriving for longer than timeout, and when they resume.\n");
+    return 1;
+  }
+
+  int port         = atoi(argv[1]);
+  int64_t interval = atof(argv[2]) * NANOS_PER_MS;
+  int64_t timeout  = atof(argv[3]) * NANOS_PER_MS;
+  int npeers       = argc - 4;
+
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sock < 0) {
+    perror("socket");
+    return 2;
+  }
+  struct sockaddr_in local;
+  memset(&local, 0, sizeof(local));
+  local.sin_family      = AF_INET;
+  local.sin_addr.s_addr = htonl(INADDR_ANY);
+  local.sin_port        = htons(port);
+  if (0 != bind(sock, (struct sockaddr *) &local, sizeof(local))) {
+    perror("bind");
+    return 2;
+  }
+
+  int64_t now = nanos(CLOCK_MONOTONIC);
+  struct peer *peers = calloc(npeers, sizeof(struct peer));
+  for (int i = 0; i < npeers; i++) {
+    peers[i].ip = argv[4 + i];
+    peers[i].addr.sin_family = AF_INET;
+    peers[i].addr.sin_port   = htons(port);
+    if (1 != inet_pton(AF_INET, peers[i].ip, &peers[i].addr.sin_addr)) {
+      fprintf(stderr, "bad peer address %s\n", peers[i].ip);
+      return 1;
+    }
+    peers[i].last = now;
+  }
+
+  setvbuf(stdout, NULL, _IOLBF, 0);
+
+  struct pollfd pfd = {.fd = sock, .events = POLLIN};
+  int64_t next_send = now;
+  uint64_t seq = 0;
+  char buf[64];
+  struct sockaddr_in from;
+  socklen_t from_len;
+
+  while (1) {
+    now = nanos(CLOCK_MONOTONIC);
+
+    /* Send heartbeats */
+    if (next_send <= now) {
+      seq++;
+      for (int i = 0; i < npeers; i++) {
+        /* Errors here (e.g. EPERM from a firewall) are what we're
+         * measuring, so we ignore them. */
+        sendto(sock, &seq, sizeof(seq), MSG_DONTWAIT,
+               (struct sockaddr *) &peers[i].addr, sizeof(peers[i].addr));
+      }
+      next_send += interval;
+      if (next_send < now) next_send = now + interval;
+    }
+
+    /* Detect silent peers */
+    for (int i = 0; i < npeers; i++) {
+      if (!peers[i].down && timeout < now - peers[i].last) {
+        peers[i].down = 1;
+        printf("%lld %s down\n",
+               (long long) mono_to_wall(peers[i].last + interval),
+               peers[i].ip);
+      }
+    }
+
+    /* Receive until the next send */
+    int wait = (next_send - now) / NANOS_PER_MS;
+    if (wait < 0) wait = 0;
+    if (poll(&pfd, 1, wait) < 0 && errno != EINTR) {
+      perror("poll");
+      return 3;
+    }
+    while (1) {
+      from_len = sizeof(from);
+      ssize_t n = recvfrom(sock, buf, sizeof(buf), MSG_DONTWAIT,
+                           (struct sockaddr *) &from, &from_len);
+      if (n < 0) break;
+      int64_t t = nanos(CLOCK_MONOTONIC);
+      for (int i = 0; i < npeers; i++) {
+        if (peers[i].addr.sin_addr.s_addr == from.sin_addr.s_addr) {
+          if (peers[i].down) {
+            peers[i].down = 0;
+            printf("%lld %s up\n", (long long) mono_to_wall(t), peers[i].ip);
+          }
+          peers[i].last = t;
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,187 @@
+#define _GNU_SOURCE
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Simulates power loss from a dm-log-writes log. dm-log-writes records every
+ * write which reaches a device, in completion order, along with flushes,
+ * FUAs, and named marks. Given a copy of the device as it was when logging
+ * began, we replay the log onto that copy as far as the last flush before a
+ * mark, then only the FUA writes after it, which were durable on their own.
+ * Everything else after the flush--writes the device had acknowledged, but
+ * nobody had made durable--is lost, as it might be when the power goes out.
+ * A flush covers the writes completed before it, not its own data, so a
+ * flushing write only survives if it was also FUA.
+ *
+ * Prints "<entries replayed> <writes dropped> <bytes dropped>".
+ *
+ * The log format is the kernel's; see drivers/md/dm-log-writes.c. */
+
+#define WRITE_LOG_MAGIC   0x6a736677736872ULL
+#define WRITE_LOG_VERSION 1ULL
+
+#define LOG_FLUSH_FLAG    (1 << 0)
+#define LOG_FUA_FLAG      (1 << 1)
+#define LOG_DISCARD_FLAG  (1 << 2)
+#define LOG_MARK_FLAG     (1 << 3)
+
+struct log_write_super {
+  uint64_t magic;
+  uint64_t version;
+  uint64_t nr_entries;
+  uint32_t sectorsize;
+} __attribute__((packed));
+
+struct log_write_entry {
+  uint64_t sector;
+  uint64_t nr_sectors;
+  uint64_t flags;
+  uint64_t data_len;
+};
+
+struct entry {
+  uint64_t sector;
+  uint64_t nr_sectors;
+  uint64_t flags;
+  off_t    data;  /* Where this entry's data starts in the log */
+  char     mark[256];
+};
+
+void fail(const char *what) {
+  perror(what);
+  exit(2);
+}
+
+void pread_all(int fd, void *buf, size_t len, off_t offset) {
+  char *p = buf;
+  while (0 < len) {
+    ssize_t n = pread(fd, p, len, offset);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) fail("pread log");
+    p      += n;
+    len    -= n;
+    offset += n;
+  }
+}
+
+void pwrite_all(int fd, const void *buf, size_t len, off_t offset) {
+  const char *p = buf;
+  while (0 < len) {
+    ssize_t n = pwrite(fd, p, len, offset);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) fail("pwrite device");
+    p      += n;
+    len    -= n;
+    offset += n;
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc != 4) {
+    fprintf(stderr, "usage: %s <log> <device> <mark>\n", argv[0]);
+    fprintf(stderr, "Replays a dm-log-writes log onto a copy of the device "
+        "as of when logging began, up to the last flush before the given "
+        "mark, plus any FUA writes after it.\n");
+    return 1;
+  }
+
+  int log = open(argv[1], O_RDONLY | O_CLOEXEC);
+  if (log < 0) fail(argv[1]);
+  int dev = open(argv[2], O_RDWR | O_CLOEXEC);
+  if (dev < 0) fail(argv[2]);
+  const char *mark = argv[3];
+
+  struct log_write_super super;
+  pread_all(log, &super, sizeof(super), 0);
+  if (le64toh(super.magic) != WRITE_LOG_MAGIC ||
+      le64toh(super.version) != WRITE_LOG_VERSION) {
+    fprintf(stderr, "%s isn't a dm-log-writes log\n", argv[1]);
+    return 3;
+  }
+  uint64_t nr_entries = le64toh(super.nr_entries);
+  size_t sectorsize   = le32toh(super.sectorsize);
+
+  /* Index the log up to our mark */
+  struct entry *entries = calloc(nr_entries + 1, sizeof(struct entry));
+  char *block = malloc(sectorsize);
+  off_t pos = sectorsize;
+  int64_t marked = -1;
+  for (uint64_t i = 0; i < nr_entries; i++) {
+    pread_all(log, block, sectorsize, pos);
+    struct log_write_entry *e = (struct log_write_entry *) block;
+    struct entry *en = &entries[i];
+    en->sector     = le64toh(e->sector);
+    en->nr_sectors = le64toh(e->nr_sectors);
+    en->flags      = le64toh(e->flags);
+    pos += sectorsize;
+    en->data = pos;
+
+    if (en->flags & LOG_MARK_FLAG) {
+      size_t len = le64toh(e->data_len);
+      if (sizeof(en->mark) - 1 < len) len = sizeof(en->mark) - 1;
+      if (sectorsize - sizeof(*e) < len) len = sectorsize - sizeof(*e);
+      memcpy(en->mark, block + sizeof(*e), len);
+      if (0 == strcmp(en->mark, mark)) {
+        marked = i;
+        break;
+      }
+    } else if (!(en->flags & LOG_DISCARD_FLAG)) {
+      pos += en->nr_sectors * sectorsize;
+    }
+  }
+  if (marked < 0) {
+    fprintf(stderr, "No mark %s in %llu entries\n", mark,
+            (unsigned long long) nr_entries);
+    return 3;
+  }
+
+  /* Find the last flush. With none, only FUA writes survive. */
+  int64_t flushed = 0;
+  for (int64_t i = 0; i < marked; i++) {
+    if (entries[i].flags & LOG_FLUSH_FLAG) {
+      flushed = i;
+    }
+  }
+
+  /* Replay everything before it, and FUA writes from it on. Everything else
+   * with data is lost. */
+  size_t bufsize = 0;
+  char *buf = NULL;
+  int64_t replayed = 0;
+  int64_t dropped = 0;
+  uint64_t dropped_bytes = 0;
+  for (int64_t i = 0; i < marked; i++) {
+    struct entry *en = &entries[i];
+    if (en->flags & LOG_MARK_FLAG || en->nr_sectors == 0) continue;
+    if (flushed <= i && !(en->flags & LOG_FUA_FLAG)) {
+      if (!(en->flags & LOG_DISCARD_FLAG)) {
+        dropped++;
+        dropped_bytes += en->nr_sectors * sectorsize;
+      }
+      continue;
+    }
+    off_t offset = en->sector * sectorsize;
+    size_t len   = en->nr_sectors * sectorsize;
+    if (bufsize < len) {
+      bufsize = len;
+      buf = realloc(buf, bufsize);
+    }
+    if (en->flags & LOG_DISCARD_FLAG) {
+      memset(buf, 0, len);
+    } else {
+      pread_all(log, buf, len, en->data);
+    }
+    pwrite_all(dev, buf, len, offset);
+    replayed++;
+  }
+  if (0 != fsync(dev)) fail("fsync device");
+
+  printf("%lld %lld %llu\n", (long long) replayed, (long long) dropped,
+         (unsigned long long) dropped_bytes);
+  return 0;
+}
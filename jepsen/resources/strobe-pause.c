@@ -0,0 +1,170 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Strobes a process: pauses and resumes it on a fixed schedule, much as
+ * strobe-time strobes the clock, to mimic GC pauses and noisy neighbors.
+ *
+ * With -c, we pause by writing 1 to a cgroup v2 group's cgroup.freeze, and
+ * resume by writing 0, which covers every task in the group. Otherwise, we
+ * send SIGSTOP and SIGCONT to each of the given pids.
+ *
+ * Every period ms, we pause the target, wait duty * period ms, and resume it.
+ * We schedule against absolute monotonic deadlines, so lateness in one pause
+ * doesn't push back the next. After duration seconds, or on SIGINT, SIGTERM,
+ * or SIGHUP, we resume the target and print the number of pauses, and the
+ * latest any pause or resume began relative to its deadline, in
+ * microseconds. */
+
+const int64_t NANOS_PER_SEC = 1000000000;
+
+volatile sig_atomic_t stop = 0;
+
+void handle_signal(int sig) {
+  (void) sig;
+  stop = 1;
+}
+
+int64_t nanos(clockid_t clock) {
+  struct timespec now;
+  clock_gettime(clock, &now);
+  return ((int64_t) now.tv_sec) * NANOS_PER_SEC + now.tv_nsec;
+}
+
+/* Sleeps until the given time on a clock, or until we're asked to stop. */
+void sleep_until(clockid_t clock, int64_t t) {
+  struct timespec ts;
+  ts.tv_sec  = t / NANOS_PER_SEC;
+  ts.tv_nsec = t % NANOS_PER_SEC;
+  int err;
+  while (!stop &&
+         0 != (err = clock_nanosleep(clock, TIMER_ABSTIME, &ts, NULL))) {
+    if (err != EINTR) {
+      fprintf(stderr, "clock_nanosleep: %s\n", strerror(err));
+      exit(3);
+    }
+  }
+}
+
+/* What we're pausing: either a cgroup.freeze file, or some pids */
+int freeze_fd = -1;
+pid_t *pids;
+int npids;
+
+void set_paused(int paused) {
+  if (0 <= freeze_fd) {
+    if (1 != pwrite(freeze_fd, paused ? "1" : "0", 1, 0)) {
+      perror("write cgroup.freeze");
+      exit(2);
+    }
+    return;
+  }
+  for (int i = 0; i < npids; i++) {
+    /* Processes may exit underneath us; that's fine. */
+    if (0 != kill(pids[i], paused ? SIGSTOP : SIGCONT) && errno != ESRCH) {
+      perror("kill");
+      exit(2);
+    }
+  }
+}
+
+void usage(char *name) {
+  fprintf(stderr, "usage: %s (-c <cgroup-dir> | -p <pid> ...) <period> "
+      "<duty> <duration>\n", name);
+  fprintf(stderr, "Period is in ms, duty is the fraction of each period "
+      "(0-1) the target spends paused, and duration is in seconds. With -c, "
+      "freezes and thaws a cgroup v2 group; with -p, sends SIGSTOP and "
+      "SIGCONT to each pid.\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  char *cgroup = NULL;
+  int by_pid   = 0;
+  int opt;
+  while (-1 != (opt = getopt(argc, argv, "+c:p"))) {
+    switch (opt) {
+      case 'c':
+        cgroup = optarg;
+        break;
+      case 'p':
+        by_pid = 1;
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+  /* Pids come first, then the three schedule arguments */
+  int nargs = argc - optind;
+  if (nargs < 3 || !(cgroup || by_pid) || (cgroup && by_pid)) {
+    usage(argv[0]);
+  }
+  char **sched = argv + argc - 3;
+
+  int64_t period   = atof(sched[0]) * 1000000;
+  double  duty     = atof(sched[1]);
+  int64_t duration = atof(sched[2]) * NANOS_PER_SEC;
+  int64_t pause_for = duty * period;
+  if (period <= 0 || duty < 0 || 1 < duty) {
+    usage(argv[0]);
+  }
+
+  if (cgroup) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/cgroup.freeze", cgroup);
+    freeze_fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (freeze_fd < 0) {
+      perror(path);
+      return 2;
+    }
+  } else {
+    npids = nargs - 3;
+    if (npids == 0) {
+      usage(argv[0]);
+    }
+    pids = calloc(npids, sizeof(pid_t));
+    for (int i = 0; i < npids; i++) {
+      pids[i] = atoi(argv[optind + i]);
+    }
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handle_signal;
+  sigaction(SIGINT,  &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGHUP,  &sa, NULL);
+
+  int64_t start    = nanos(CLOCK_MONOTONIC);
+  int64_t end      = start + duration;
+  int64_t count    = 0;
+  int64_t max_late = 0;
+  int64_t late;
+
+  for (int64_t t = start; !stop && t < end; t += period) {
+    sleep_until(CLOCK_MONOTONIC, t);
+    if (stop) break;
+    late = nanos(CLOCK_MONOTONIC) - t;
+    if (max_late < late) max_late = late;
+    set_paused(1);
+    count += 1;
+
+    sleep_until(CLOCK_MONOTONIC, t + pause_for);
+    late = nanos(CLOCK_MONOTONIC) - (t + pause_for);
+    if (max_late < late) max_late = late;
+    set_paused(0);
+  }
+
+  /* Resume, whatever state we stopped in */
+  set_paused(0);
+  printf("%lld %lld\n", (long long) count, (long long) (max_late / 1000));
+  return 0;
+}
@@ -237,10 +237,24 @@
   [(double (util/nanos->secs (:time a)))
    (when b (double (util/nanos->secs (:time b))))])
 
+(defn interval->outage
+  "Given an interval of two operations [a b], returns the times [start end],
+  in seconds, when traffic actually stopped and resumed, as measured by
+  jepsen.nemesis.probe: from the first link's :loss-onset on a to the last
+  link's :recovery on b. Yields [start nil] if traffic didn't resume, and nil
+  if there's no :loss-onset."
+  [[a b]]
+  (when-let [onsets (seq (vals (:loss-onset a)))]
+    [(double (util/nanos->secs (reduce min onsets)))
+     (when-let [rs (seq (vals (:recovery b)))]
+       (double (util/nanos->secs (reduce max rs))))]))
+
 (defn nemesis-regions
   "Given nemesis activity, emits a sequence of gnuplot commands rendering
   shaded regions where each nemesis was active. We can render a maximum of 12
-  nemeses; this keeps size and spacing consistent."
+  nemeses; this keeps size and spacing consistent. Where ops carry probe
+  measurements (see interval->outage), we draw the measured outage as a
+  darker bar through the middle of the region."
   [plot nemeses]
   (->> nemeses
        (map-indexed
@@ -256,16 +270,27 @@
                  bot             (- graph-top-edge
                                     (* height (inc i)))
                  top             (+ bot height)]
-             (->> (:intervals n)
-                  (map interval->times)
-                  (map (fn [[start stop]]
-                         [:set :obj :rect
-                          :from (g/list start [:graph (+ bot padding)])
-                          :to   (g/list (or stop [:graph 1])
-                                        [:graph (- top padding)])
-                          :fillcolor :rgb color
-                          :fillstyle :transparent :solid transparency
-                          :noborder]))))))
+             (concat
+               (->> (:intervals n)
+                    (map interval->times)
+                    (map (fn [[start stop]]
+                           [:set :obj :rect
+                            :from (g/list start [:graph (+ bot padding)])
+                            :to   (g/list (or stop [:graph 1])
+                                          [:graph (- top padding)])
+                            :fillcolor :rgb color
+                            :fillstyle :transparent :solid transparency
+                            :noborder])))
+               (->> (:intervals n)
+                    (keep interval->outage)
+                    (map (fn [[start stop]]
+                           [:set :obj :rect
+                            :from (g/list start [:graph (+ bot (* 3 padding))])
+                            :to   (g/list (or stop [:graph 1])
+                                          [:graph (- top (* 3 padding))])
+                            :fillcolor :rgb color
+                            :fillstyle :solid
+                            :noborder])))))))
        (reduce concat)))
 
 (defn nemesis-lines
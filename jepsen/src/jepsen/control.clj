@@ -8,6 +8,7 @@
   (:require [clj-ssh.ssh    :as ssh]
             [jepsen.util    :as util :refer [real-pmap with-thread-name]]
             [jepsen.control [clj-ssh :as clj-ssh]
+                            [profile :as profile]
                             [core :as core
                              :refer [connect
                                      disconnect!
@@ -135,18 +136,48 @@
          :host   *host*
          :action action))
 
+(defn result-bytes
+  "How many bytes of input and output did an action move?"
+  [action]
+  (->> [(:in action) (:out action) (:err action)]
+       (keep (fn [x] (when (string? x) (count x))))
+       (reduce +)))
+
+(defn ssh-profiled*
+  "Like ssh*, but records the action in jepsen.control.profile under the given
+  command summary."
+  [cmd action]
+  (let [start (System/nanoTime)
+        res   (volatile! nil)]
+    (try (vreset! res (ssh* action))
+         (finally
+           (profile/record! :exec *host* cmd start
+                            (:queue-time @res)
+                            (when @res (result-bytes @res)))))))
+
 (defn exec*
   "Like exec, but does not escape."
   [& commands]
-  (->> commands
-       (str/join " ")
-       (array-map :cmd)
-       wrap-cd
-       wrap-sudo
-       wrap-trace
-       ssh*
-       core/throw-on-nonzero-exit
-       just-stdout))
+  (let [cmd (str/join " " commands)]
+    (->> {:cmd cmd}
+         wrap-cd
+         wrap-sudo
+         wrap-trace
+         (ssh-profiled* cmd)
+         core/throw-on-nonzero-exit
+         just-stdout)))
+
+(defn exec-in*
+  "Like exec*, but sends the given string to the command's stdin."
+  [in & commands]
+  (let [cmd (str/join " " commands)]
+    (->> {:cmd cmd, :in in}
+         wrap-cd
+         wrap-sudo
+         wrap-trace
+         (ssh-profiled* cmd)
+         core/throw-on-nonzero-exit
+         just-stdout)))
 
 (defn exec
   "Takes a shell command and arguments, runs the command, and returns stdout,
@@ -156,6 +187,82 @@
        (map escape)
        (apply exec*)))
 
+(defn exec-batch
+  "Runs a sequence of commands on the current node in a single round trip,
+  rather than one round trip per command. Each command is either a sequence of
+  arguments, escaped as for `exec`, or a map with a :cmd sequence and an
+  :on-error policy for that command. Policies (see
+  jepsen.control.core/batch-policies) are:
+
+    :stop       Skip the rest of the batch and throw (the default)
+    :continue   Run the rest of the batch, then throw
+    :ignore     Carry on; don't throw for this command
+
+  The optional first argument is a map of options; :on-error sets the default
+  policy.
+
+  Commands run in order, in the current directory and sudo context, with stdin
+  from /dev/null. Returns a vector with a map for each command run, of:
+
+    :cmd    The command string
+    :exit   Its exit status
+    :out    Its stdout, with trailing newlines trimmed
+    :err    Its stderr
+    :time   How long it took, in nanoseconds
+
+  When a command fails and its policy is not :ignore, throws like `exec`
+  would for the first such command, with :results attached.
+
+    (exec-batch [[:iptables :-F :-w]
+                 [:iptables :-X :-w]])
+
+    (exec-batch {:on-error :ignore}
+                [[:kill :-9 pid]
+                 [:rm :-f pidfile]])"
+  ([commands]
+   (exec-batch {} commands))
+  ([opts commands]
+   (let [default  (:on-error opts :stop)
+         specs    (map (fn [c]
+                         (if (map? c)
+                           {:cmd      (:cmd c)
+                            :on-error (:on-error c default)}
+                           {:cmd c, :on-error default}))
+                       commands)
+         _        (doseq [{:keys [on-error]} specs]
+                    (assert (core/batch-policies on-error)
+                            (str "Unknown batch policy " (pr-str on-error))))
+         cmds     (mapv (fn [{:keys [cmd]}]
+                          (str/join " " (map escape cmd)))
+                        specs)
+         policies (mapv :on-error specs)]
+     (if (empty? cmds)
+       []
+       (let [res     (->> {:cmd (core/batch-script cmds policies)}
+                          wrap-cd
+                          wrap-sudo
+                          wrap-trace
+                          (ssh-profiled* (str/join "; " cmds))
+                          core/throw-on-nonzero-exit)
+             results (mapv (fn [r]
+                             (-> r
+                                 (dissoc :index)
+                                 (assoc :cmd (nth cmds (:index r)))
+                                 (update :out str/trim-newline)))
+                           (core/parse-batch-output (:out res)))]
+         (when-let [failed (->> results
+                                (map-indexed vector)
+                                (remove (comp zero? :exit second))
+                                (remove (comp #{:ignore} policies first))
+                                first
+                                second)]
+           (core/throw-on-nonzero-exit
+             (assoc failed
+                    :host     *host*
+                    :action   {:cmd (:cmd failed)}
+                    :results  results)))
+         results)))))
+
 (defn file->path
   "Takes an object, if it's an instance of java.io.File, gets the path, otherwise
   returns the object"
@@ -164,13 +271,29 @@
     (.getCanonicalPath x)
     x))
 
+(defn local-bytes
+  "How many bytes are in the given local files and directories?"
+  [paths]
+  (->> paths
+       (mapcat (comp file-seq io/file))
+       (filter (fn [^File f] (.isFile f)))
+       (map (fn [^File f] (.length f)))
+       (reduce +)))
+
 (defn upload
-  "Copies local path(s) to remote node and returns the remote path."
-  [local-paths remote-path]
-  (let [s *session*
-        local-paths (map file->path (util/coll local-paths))]
-    (upload! s (cmd-context) local-paths remote-path {})
-    remote-path))
+  "Copies local path(s) to remote node and returns the remote path. Takes an
+  optional map of options for the remote; for instance, the SCP remote
+  understands :bandwidth-limit, in Kbit/s."
+  ([local-paths remote-path]
+   (upload local-paths remote-path {}))
+  ([local-paths remote-path opts]
+   (let [s *session*
+         local-paths (map file->path (util/coll local-paths))
+         start       (System/nanoTime)]
+     (upload! s (cmd-context) local-paths remote-path opts)
+     (profile/record! :upload *host* remote-path start nil
+                      (local-bytes local-paths))
+     remote-path)))
 
 (defn upload-resource!
   "Uploads a local JVM resource (as a string) to the given remote path."
@@ -186,7 +309,11 @@
 (defn download
   "Copies remote paths to local node."
   [remote-paths local-path]
-  (download! *session* (cmd-context) remote-paths local-path {}))
+  (let [start (System/nanoTime)
+        res   (download! *session* (cmd-context) remote-paths local-path {})]
+    (profile/record! :download *host* (str/join " " (util/coll remote-paths))
+                     start nil (local-bytes [local-path]))
+    res))
 
 (defn expand-path
   "Expands path relative to the current directory."
@@ -224,9 +351,13 @@
      ~@body))
 
 (defn session
-  "Returns a Remote bound to the given host."
+  "Returns a Remote bound to the given host. Records how long connecting took
+  in jepsen.control.profile."
   [host]
-  (connect *remote* (assoc (conn-spec) :host host)))
+  (let [start (System/nanoTime)
+        s     (connect *remote* (assoc (conn-spec) :host host))]
+    (profile/record! :connect host "connect" start nil nil)
+    s))
 
 (defn disconnect
   "Close a Remote session."
@@ -0,0 +1,445 @@
+(ns jepsen.control.agent
+  "A Remote which talks to a small native agent (resources/jepsen-agent.c)
+  running on each node, rather than opening an SSH channel and spawning a shell
+  for every command. The agent is compiled on the node, like the clock tools in
+  jepsen.nemesis.time, and speaks a framed binary protocol over a single stream:
+  here, one SSH channel per node.
+
+  Any number of commands may be in flight on a single agent at once. Their
+  output can be streamed back as it arrives, and we can deliver signals to
+  them; interrupting a thread waiting on a command kills that command's process
+  group. The agent also reads and writes files directly, so uploads and
+  downloads don't need scp.
+
+  Frames are a one-byte type, a four-byte job id, a four-byte payload length,
+  and the payload; see jepsen-agent.c for details."
+  (:require [clojure.java.io :as io]
+            [clojure.string :as str]
+            [clojure.tools.logging :refer [info warn]]
+            [jepsen.util :as util]
+            [jepsen.control [core :as core]
+                            [retry :as retry]
+                            [sshj :as sshj]]
+            [slingshot.slingshot :refer [try+ throw+]])
+  (:import (java.io BufferedInputStream
+                    BufferedOutputStream
+                    ByteArrayOutputStream
+                    DataInputStream
+                    DataOutputStream
+                    EOFException
+                    File
+                    FileInputStream
+                    FileOutputStream
+                    InputStream
+                    OutputStream)
+           (java.nio ByteBuffer)
+           (java.nio.charset StandardCharsets)
+           (java.util.concurrent ConcurrentHashMap)))
+
+(def dir
+  "Where do we install the agent?"
+  "/opt/jepsen")
+
+(def source
+  "The agent's C source."
+  (delay (slurp (io/resource "jepsen-agent.c"))))
+
+(defn bin
+  "The path to the agent binary. Includes a hash of the source, so nodes
+  recompile when the agent changes."
+  []
+  (str dir "/jepsen-agent-" (format "%08x" (hash @source))))
+
+; Frame types
+(def exec-frame   1)
+(def data-frame   2)
+(def signal-frame 3)
+(def put-frame    4)
+(def get-frame    5)
+(def out-frame    16)
+(def err-frame    17)
+(def exit-frame   18)
+(def fail-frame   19)
+
+(def chunk-size
+  "How many bytes of file data do we send per frame?"
+  65536)
+
+(def signals
+  "Signal numbers by name. These are the Linux values."
+  {:hup 1, :int 2, :quit 3, :kill 9, :usr1 10, :usr2 12, :term 15, :cont 18,
+   :stop 19})
+
+;; Channels
+
+(defrecord Channel [^DataOutputStream out
+                    ^DataInputStream in
+                    close   ; A function which releases the underlying stream
+                    jobs    ; ConcurrentHashMap of job ids to jobs
+                    next-id ; Atom: the next job ID
+                    state]) ; Atom: :open, or the Throwable which broke us
+
+(defn open?
+  "Is this channel still usable?"
+  [ch]
+  (= :open @(:state ch)))
+
+(defn broken
+  "Throws a :jepsen.control/ssh-failed error for a channel broken by cause."
+  [cause]
+  (throw+ {:type    :jepsen.control/ssh-failed
+           :message (str "Agent channel failed: " cause)}
+          cause))
+
+(defn fail!
+  "Marks a channel as broken by the given throwable, releases the underlying
+  stream, and hands the throwable to every job."
+  [ch ^Throwable t]
+  (when (compare-and-set! (:state ch) :open t)
+    (try ((:close ch))
+         (catch Exception e
+           (warn e "Error closing agent channel"))))
+  (let [^ConcurrentHashMap jobs (:jobs ch)]
+    (doseq [id (vec (.keySet jobs))]
+      (when-let [job (.remove jobs id)]
+        (deliver (:result job) t)))))
+
+(defn close!
+  "Closes a channel, killing any commands still running."
+  [ch]
+  (fail! ch (EOFException. "Agent channel closed")))
+
+(defn write-frame!
+  "Writes a single frame to the channel."
+  ([ch type id]
+   (write-frame! ch type id (byte-array 0) 0))
+  ([ch type id ^bytes payload]
+   (write-frame! ch type id payload (alength payload)))
+  ([ch type id ^bytes payload len]
+   (let [^DataOutputStream out (:out ch)]
+     (locking out
+       (when-not (open? ch)
+         (broken @(:state ch)))
+       (try
+         (.writeByte out (int type))
+         (.writeInt out (int id))
+         (.writeInt out (int len))
+         (.write out payload 0 (int len))
+         (.flush out)
+         (catch java.io.IOException e
+           (fail! ch e)
+           (broken e)))))))
+
+(defn read-loop!
+  "Reads frames off a channel and dispatches them to jobs until the stream ends
+  or breaks."
+  [ch]
+  (let [^DataInputStream in       (:in ch)
+        ^ConcurrentHashMap jobs   (:jobs ch)]
+    (try
+      (loop []
+        (let [type    (.readUnsignedByte in)
+              id      (long (.readInt in))
+              payload (byte-array (.readInt in))
+              _       (.readFully in payload)]
+          (when-let [job (.get jobs id)]
+            (condp = type
+              out-frame   ((:on-out job) payload)
+              err-frame   ((:on-err job) payload)
+              exit-frame  (do (.remove jobs id)
+                              (deliver (:result job)
+                                       {:exit (.getInt
+                                                (ByteBuffer/wrap payload))}))
+              fail-frame  (do (.remove jobs id)
+                              (deliver (:result job)
+                                       {:fail (String. payload
+                                                       StandardCharsets/UTF_8)}))
+              (warn "Unknown agent frame type" type)))
+          (recur)))
+      (catch Throwable t
+        (fail! ch t)))))
+
+(defn channel
+  "Takes an InputStream from an agent, an OutputStream to it, and a function
+  which releases both. Returns a Channel, starting a thread to read frames."
+  [^InputStream in ^OutputStream out close]
+  (let [ch (Channel. (DataOutputStream. (BufferedOutputStream. out))
+                     (DataInputStream. (BufferedInputStream. in))
+                     close
+                     (ConcurrentHashMap.)
+                     (atom 0)
+                     (atom :open))]
+    (doto (Thread. ^Runnable (fn [] (read-loop! ch))
+                   "jepsen agent channel reader")
+      (.setDaemon true)
+      (.start))
+    ch))
+
+(defn ^bytes utf8
+  "Encodes a string as UTF-8 bytes."
+  [^String s]
+  (.getBytes s StandardCharsets/UTF_8))
+
+(defn start-job!
+  "Registers a new job on the channel and sends its opening frame. Options:
+
+    :on-out   A function called with each byte array of stdout
+    :on-err   A function called with each byte array of stderr
+
+  Returns the job: a map with an :id and a :result promise."
+  [ch type ^String payload opts]
+  (let [id  (swap! (:next-id ch) inc)
+        job {:id      id
+             :result  (promise)
+             :on-out  (:on-out opts (fn [_]))
+             :on-err  (:on-err opts (fn [_]))}]
+    (.put ^ConcurrentHashMap (:jobs ch) id job)
+    (write-frame! ch type id (utf8 payload))
+    job))
+
+(defn signal!
+  "Sends a signal (a number, or a keyword from `signals`) to a job's process
+  group."
+  [ch job signal]
+  (let [signal (get signals signal signal)
+        buf    (ByteArrayOutputStream. 4)]
+    (.writeInt (DataOutputStream. buf) (int signal))
+    (write-frame! ch signal-frame (:id job) (.toByteArray buf))))
+
+(defn send-input!
+  "Sends a string (or nil) as stdin for a job, followed by EOF."
+  [ch job input]
+  (when-not (nil? input)
+    (let [bytes (utf8 (str input))]
+      (doseq [offset (range 0 (alength bytes) chunk-size)]
+        (write-frame! ch data-frame (:id job)
+                      (java.util.Arrays/copyOfRange
+                        bytes (int offset)
+                        (int (min (alength bytes) (+ offset chunk-size))))))))
+  (write-frame! ch data-frame (:id job)))
+
+(defn await-job!
+  "Waits for a job to complete, returning {:exit status} or {:fail message}.
+  If the thread is interrupted while waiting, kills the job before rethrowing."
+  [ch job]
+  (let [res (try (deref (:result job))
+                 (catch InterruptedException e
+                   (try (signal! ch job :kill)
+                        (catch Exception _))
+                   (throw e)))]
+    (if (instance? Throwable res)
+      (broken res)
+      res)))
+
+(defn start!
+  "Starts a command on the agent, returning a job which can be passed to
+  `signal!` and `await-job!`. Use :on-out and :on-err (see `start-job!`) to
+  stream output as it arrives. Takes an action map with :cmd and, optionally,
+  :in."
+  ([ch action]
+   (start! ch action {}))
+  ([ch action opts]
+   (let [job (start-job! ch exec-frame (:cmd action) opts)]
+     (send-input! ch job (:in action))
+     job)))
+
+(defn exec!
+  "Runs an action on the agent and waits for it to complete, returning the
+  action with :exit, :out, and :err, like jepsen.control.core/execute!."
+  [ch action]
+  (let [out (ByteArrayOutputStream.)
+        err (ByteArrayOutputStream.)
+        job (start! ch action {:on-out (fn [^bytes b] (.write out b 0 (alength b)))
+                               :on-err (fn [^bytes b] (.write err b 0 (alength b)))})
+        res (await-job! ch job)]
+    (when-let [msg (:fail res)]
+      (throw+ {:type    ::exec-failed
+               :cmd     (:cmd action)
+               :message msg}))
+    (assoc action
+           :exit  (:exit res)
+           :out   (.toString out "UTF-8")
+           :err   (.toString err "UTF-8"))))
+
+(defn throw-on-fail!
+  "Throws if an agent file operation failed."
+  [res op path]
+  (when-let [msg (:fail res)]
+    (throw+ {:type    ::file-failed
+             :op      op
+             :path    path
+             :message msg})))
+
+(defn put!
+  "Writes a local File to a remote path."
+  [ch ^File file remote-path]
+  (let [job (start-job! ch put-frame remote-path {})
+        buf (byte-array chunk-size)]
+    (with-open [in (FileInputStream. file)]
+      (loop []
+        (let [n (.read in buf)]
+          (when (pos? n)
+            (write-frame! ch data-frame (:id job) buf n)
+            (recur)))))
+    (write-frame! ch data-frame (:id job))
+    (throw-on-fail! (await-job! ch job) :put remote-path)))
+
+(defn get!
+  "Reads a remote path into a local File."
+  [ch remote-path ^File file]
+  (io/make-parents file)
+  (with-open [out (FileOutputStream. file)]
+    (let [job (start-job! ch get-frame remote-path
+                          {:on-out (fn [^bytes b] (.write out b))})]
+      (throw-on-fail! (await-job! ch job) :get remote-path))))
+
+;; Installation
+
+(defn sudo-exec!
+  "Runs an action through a raw Remote as root, throwing on nonzero exit."
+  [remote action]
+  (->> action
+       (core/wrap-sudo {:sudo "root"})
+       (core/execute! remote {})
+       core/throw-on-nonzero-exit))
+
+(defn install!
+  "Compiles the agent on the node behind the given Remote, if it isn't already
+  there. Installs a compiler if necessary. Returns the binary path."
+  [remote]
+  (let [bin (bin)]
+    (when-not (zero? (:exit (core/execute! remote {} {:cmd (str "test -x "
+                                                               bin)})))
+      (info "Compiling" bin)
+      (sudo-exec! remote {:cmd (str "mkdir -p " dir " && cat > " bin ".c")
+                    :in  @source})
+      (sudo-exec! remote {:cmd (str "command -v gcc > /dev/null || "
+                              "DEBIAN_FRONTEND=noninteractive "
+                              "apt-get install -y build-essential || "
+                              "yum install -y gcc")})
+      (sudo-exec! remote {:cmd (str "gcc -O2 -o " bin " " bin ".c")}))
+    bin))
+
+;; Remote
+
+(defn sudo-other?
+  "Does this context ask us to act as someone other than the login user?"
+  [conn-spec ctx]
+  (let [sudo (:sudo ctx)]
+    (and sudo (not= sudo (:username conn-spec)))))
+
+(defn tmp-path
+  "A random remote path for staging files."
+  []
+  (str "/tmp/jepsen-agent-" (rand-int Integer/MAX_VALUE)))
+
+(defn exec-as!
+  "Runs a command (a sequence of arguments, which we escape) via the agent in
+  the given context, throwing on nonzero exit."
+  [ch ctx args]
+  (->> {:cmd (str/join " " (map core/escape args))}
+       (core/wrap-sudo ctx)
+       (exec! ch)
+       core/throw-on-nonzero-exit))
+
+(defn upload-file!
+  "Uploads a single local File to a remote path, honoring sudo in ctx."
+  [ch conn-spec ctx ^File file remote-path]
+  (if-not (sudo-other? conn-spec ctx)
+    (put! ch file remote-path)
+    (let [tmp (tmp-path)]
+      (try (put! ch file tmp)
+           (exec-as! ch {:sudo "root"} [:chown (:sudo ctx) tmp])
+           (exec-as! ch {:sudo "root"} [:mv tmp remote-path])
+           (finally
+             (exec-as! ch {:sudo "root"} [:rm :-f tmp]))))))
+
+(defn upload-paths!
+  "Uploads local paths to a remote path. Like scp -r: directories are copied
+  recursively, and given multiple sources, remote-path is a directory."
+  [ch conn-spec ctx local-paths remote-path]
+  (let [sources (map io/file (util/coll local-paths))
+        into?   (or (< 1 (count sources))
+                    (zero? (:exit (exec! ch (core/wrap-sudo
+                                              ctx
+                                              {:cmd (str "test -d "
+                                                         (core/escape
+                                                           remote-path))})))))]
+    (doseq [^File src sources]
+      (let [dest (if into?
+                   (str remote-path "/" (.getName src))
+                   remote-path)]
+        (if (.isDirectory src)
+          (let [root (.toPath src)]
+            (doseq [^File f (file-seq src)]
+              (let [path (str dest "/" (.relativize root (.toPath f)))]
+                (if (.isDirectory f)
+                  (exec-as! ch ctx [:mkdir :-p path])
+                  (upload-file! ch conn-spec ctx f path)))))
+          (upload-file! ch conn-spec ctx src dest))))))
+
+(defn download-file!
+  "Downloads a single remote file to a local File, honoring sudo in ctx."
+  [ch conn-spec ctx remote-path ^File file]
+  (if-not (sudo-other? conn-spec ctx)
+    (get! ch remote-path file)
+    ; Copy to somewhere we can read, as root
+    (let [tmp (tmp-path)]
+      (try (exec-as! ch {:sudo "root"} [:cp remote-path tmp])
+           (exec-as! ch {:sudo "root"} [:chmod "a+r" tmp])
+           (get! ch tmp file)
+           (finally
+             (exec-as! ch {:sudo "root"} [:rm :-f tmp]))))))
+
+(defn download-paths!
+  "Downloads remote paths to a local path. Like scp -r: directories are copied
+  recursively, and if the local path is a directory, files go inside it."
+  [ch conn-spec ctx remote-paths local-path]
+  (doseq [src (util/coll remote-paths)]
+    (let [{:keys [dirs files]} (core/download-plan
+                                 #(:out (exec-as! ch ctx %))
+                                 src local-path)]
+      (doseq [^File d dirs]
+        (.mkdirs d))
+      (doseq [[f file] files]
+        (download-file! ch conn-spec ctx f file)))))
+
+(defrecord AgentRemote [cmd-remote conn-spec ch]
+  core/Remote
+  (connect [this conn-spec]
+    (let [cmd-remote (core/connect cmd-remote conn-spec)]
+      (try
+        (let [bin (install! cmd-remote)
+              {:keys [stdin stdout close]}
+              (core/open-stream! cmd-remote {} {:cmd bin})]
+          (assoc this
+                 :cmd-remote  cmd-remote
+                 :conn-spec   conn-spec
+                 :ch          (channel stdout stdin close)))
+        (catch Throwable t
+          (core/disconnect! cmd-remote)
+          (throw t)))))
+
+  (disconnect! [this]
+    (try (when ch (close! ch))
+         (finally
+           (core/disconnect! cmd-remote))))
+
+  (execute! [this ctx action]
+    (exec! ch action))
+
+  (upload! [this ctx local-paths remote-path _opts]
+    (upload-paths! ch conn-spec ctx local-paths remote-path))
+
+  (download! [this ctx remote-paths local-path _opts]
+    (download-paths! ch conn-spec ctx remote-paths local-path)))
+
+(defn remote
+  "Constructs a Remote which runs commands, uploads, and downloads through the
+  native agent. Takes an underlying Remote which supports
+  jepsen.control.core/Streams, which we use to install the agent and carry its
+  stream; by default, a bare SSHJ remote."
+  ([]
+   (remote (sshj/raw-remote {})))
+  ([cmd-remote]
+   (retry/remote (AgentRemote. cmd-remote nil nil))))
@@ -0,0 +1,382 @@
+(ns jepsen.control.cas
+  "Tests often push the same large files--DB tarballs, binaries, cached cluster
+  state--to every node on every run. This namespace keeps a content-addressed
+  store of uploaded files on each node, keyed by SHA-256. Before uploading, we
+  hash the local files (caching hashes by path, size, and mtime), ask the node
+  which hashes it lacks, and send only those. Deploying is then a local copy
+  on the node.
+
+  Since deployed files often run as root, the store belongs to root, and we
+  re-check an entry's hash each time we find it there, replacing it if it
+  doesn't match.
+
+  Directories are deployed file by file, so changing one file in a directory
+  re-sends only that file. Store entries are never removed automatically; use
+  `clear!` to reclaim space.
+
+  `deploy-nodes!` pushes to several nodes at once, with bounded parallelism
+  and an optional bandwidth cap. Alternatively, it can upload each file to a
+  few seed nodes, and have the other nodes stream it from one another over the
+  test network, so the control node uploads each file only a few times no
+  matter how many nodes there are."
+  (:require [clojure.java.io :as io]
+            [clojure.string :as str]
+            [clojure.tools.logging :refer [info warn]]
+            [jepsen [control :as c]])
+  (:import (java.io File)
+           (java.nio.file Files
+                          LinkOption)
+           (java.nio.file.attribute PosixFilePermission)
+           (java.security MessageDigest)
+           (java.util.concurrent Semaphore)))
+
+(def dir
+  "The remote directory where we store uploaded files, by hash."
+  "/opt/jepsen/cas")
+
+(defonce hashes
+  ; A cache of [canonical path, size, mtime] -> hex SHA-256.
+  (atom {}))
+
+(defn sha256
+  "Hashes a local File, returning a hex string. Caches hashes by path, size,
+  and modification time, so re-deploying an unchanged file is cheap."
+  [^File f]
+  (let [k [(.getCanonicalPath f) (.length f) (.lastModified f)]]
+    (or (get @hashes k)
+        (let [md  (MessageDigest/getInstance "SHA-256")
+              buf (byte-array 65536)]
+          (with-open [in (io/input-stream f)]
+            (loop []
+              (let [n (.read in buf)]
+                (when (pos? n)
+                  (.update md buf 0 n)
+                  (recur)))))
+          (let [h (format "%064x" (BigInteger. 1 (.digest md)))]
+            (swap! hashes assoc k h)
+            h)))))
+
+(defn store-path
+  "The remote path of a hash in the store."
+  [h]
+  (str dir "/" h))
+
+(defn mode
+  "A local File's permission bits, as an octal string like \"755\"."
+  [^File f]
+  (try
+    (->> (Files/getPosixFilePermissions (.toPath f) (make-array LinkOption 0))
+         (map (fn [^PosixFilePermission p] (bit-shift-left 1 (- 8 (.ordinal p)))))
+         (reduce + 0)
+         (format "%o"))
+    (catch UnsupportedOperationException _
+      ; Not a POSIX filesystem; all we can tell is whether it's executable.
+      (if (or (.isDirectory f) (.canExecute f)) "755" "644"))))
+
+(defn entries
+  "Takes a local File, and returns a sequence of entries, parents before
+  children, describing how to rebuild it on a node. Each entry is either
+  [:dir relative-path mode] or [:file relative-path hash File mode], where
+  mode is as for `mode`. The relative path of the top-level file or directory
+  itself is \"\"."
+  [^File root]
+  (let [root-path (.toPath root)]
+    (for [^File f (file-seq root)]
+      (let [rel (str (.relativize root-path (.toPath f)))]
+        (if (.isDirectory f)
+          [:dir rel (mode f)]
+          [:file rel (sha256 f) f (mode f)])))))
+
+(defn missing
+  "Which of the given hashes are absent from the current node's store? Returns
+  a set. Entries whose contents don't match their hash count as absent, and
+  will be replaced. Hashes go over stdin, since there may be too many for a
+  command line."
+  [hs]
+  (let [hs (distinct hs)]
+    (if (empty? hs)
+      #{}
+      (-> (str (str/join "\n" hs) "\n")
+          (c/exec-in*
+            (str "cd " dir " 2>/dev/null || { cat; exit 0; }; "
+                 "while read -r h; do "
+                 "[ -f \"$h\" ] && "
+                 "[ \"$(sha256sum < \"$h\" | cut -d ' ' -f 1)\" = \"$h\" ] "
+                 "|| echo \"$h\"; done"))
+          str/split-lines
+          (->> (remove str/blank?))
+          set))))
+
+(defn ensure-dir!
+  "Creates the store directory on the current node. Since we deploy its
+  contents as root, only root may write to it."
+  []
+  (c/su (c/exec-batch [[:mkdir :-p dir]
+                       [:chown "root" dir]
+                       [:chmod "0755" dir]])))
+
+(defn verify-script
+  "A shell script which checks that a file has hash h, then installs it in the
+  store as h, or removes it and fails."
+  [file h]
+  (let [file (c/escape file)]
+    (str "chown root " file " && chmod 0644 " file " && "
+         "if [ \"$(sha256sum < " file " | cut -d ' ' -f 1)\" = " h " ]; "
+         "then mv -f " file " " (store-path h) "; "
+         "else rm -f " file "; echo \"hash mismatch for " h "\" >&2; exit 1; "
+         "fi")))
+
+(defn store!
+  "Uploads a local File into the current node's store under the given hash.
+  Uploads to a temporary file as the SSH user, then, as root, moves it into
+  the store under a temporary name, and verifies its hash before giving it its
+  real one. Options are passed to jepsen.control/upload."
+  [^File f h opts]
+  (let [tmp    (str "/tmp/jepsen-cas." h "." (rand-int Integer/MAX_VALUE))
+        staged (str dir "/." h "." (rand-int Integer/MAX_VALUE))]
+    (binding [c/*sudo* nil]
+      (c/upload (.getCanonicalPath f) tmp opts))
+    (c/su
+      (c/exec :mv :-f tmp staged)
+      (c/exec* (verify-script staged h)))))
+
+(defn deploy!
+  "Replaces remote-path on the current node with a copy of a local file or
+  directory, sending only the files whose contents the node hasn't seen
+  before. Deployed files and directories keep their local modes. Creates
+  parents as necessary. Options are passed to jepsen.control/upload: for
+  instance, :bandwidth-limit. Returns remote-path."
+  ([local-path remote-path]
+   (deploy! local-path remote-path {}))
+  ([local-path remote-path opts]
+   (let [local (io/file local-path)
+         _     (assert (.exists local) (str "No such local file " local))
+         es    (entries local)
+         files (filter (comp #{:file} first) es)
+         need  (missing (map #(nth % 2) files))]
+     (when (seq need)
+       (ensure-dir!)
+       (info "Uploading" (count need) "of" (count files) "files to"
+             remote-path)
+       (->> files
+            (filter (comp need #(nth % 2)))
+            (group-by #(nth % 2))
+            vals
+            (map first)
+            (run! (fn [[_ _ h f]] (store! f h opts)))))
+     ; Now rebuild the tree from the store, in a single command. Store
+     ; entries are shared by every file with the same contents, so each copy
+     ; gets its local file's mode. Directories get theirs last, children
+     ; first, in case they aren't writable.
+     (c/exec-batch [[:rm :-rf remote-path]
+                    [:mkdir :-p (.getParent (io/file remote-path))]])
+     (c/exec-in* (->> (concat
+                        (for [[type rel x _ mode] es]
+                          (if (= :dir type)
+                            (str "- - " rel "\n")
+                            (str x " " mode " " rel "\n")))
+                        (for [[type rel mode] (reverse es)
+                              :when (= :dir type)]
+                          (str "= " mode " " rel "\n")))
+                      (apply str))
+                 (str "d=" (c/escape remote-path) "; "
+                      "while read -r h m p; do "
+                      "if [ -z \"$p\" ]; then t=\"$d\"; else t=\"$d/$p\"; fi; "
+                      "case \"$h\" in "
+                      "-) mkdir -p \"$t\" ;; "
+                      "=) chmod \"$m\" \"$t\" ;; "
+                      "*) cp -p " dir "/\"$h\" \"$t\" && chmod \"$m\" \"$t\" ;; "
+                      "esac || exit 1; "
+                      "done"))
+     remote-path)))
+
+(def default-peer-port
+  "The TCP port nodes use to stream files to one another."
+  7944)
+
+(defn peer-marker
+  "A string which appears in the command line of our listener on port, so we
+  can find it again."
+  [port]
+  (str "jepsen-peer-receive:" port ";"))
+
+(defn peer-receive-script
+  "A bash script which listens on port for a single file with hash h, saves it
+  to the store, and forwards it to the next node in the chain (if any) as it
+  arrives. Verifies the hash, and writes ok or fail to .<h>.<token>.done;
+  token identifies this transfer, so files left by an earlier one never count."
+  [h port next-node token]
+  (let [peer (str "." h "." token ".peer")
+        done (str "." h "." token ".done")]
+    (str ": " (peer-marker port) "\n"
+         "cd " dir " || exit 1\n"
+         "rm -f " peer " " done "\n"
+         ; OpenBSD netcat and traditional/busybox netcat disagree on -p
+         "if nc -h 2>&1 | grep -qi openbsd; then set -- nc -l " port "; "
+         "else set -- nc -l -p " port "; fi\n"
+         "\"$@\" < /dev/null | tee " peer " "
+         (if next-node
+           (str "> /dev/tcp/" (name next-node) "/" port)
+           "> /dev/null")
+         "\n"
+         "if [ \"$(sha256sum < " peer " | cut -d ' ' -f 1)\" = " h " ]; then "
+         "chmod a+r " peer " && mv -f " peer " " h " && echo ok > " done "; "
+         "else rm -f " peer "; echo fail > " done "; fi\n")))
+
+(defn kill-peer-receive-script
+  "A bash script which kills any listener left on port by an earlier transfer,
+  and waits for the port to come free. Fails if it doesn't."
+  [port]
+  ; The brackets keep these patterns from matching the shell running them.
+  (str "pkill -f '" (str/replace (peer-marker port) #"^j" "[j]") "'; "
+       "pkill -f '^nc -l (-p )?" port "$'; "
+       "for i in $(seq 100); do "
+       "ss -ltn | grep -q ':" port " ' || exit 0; sleep 0.1; "
+       "done; exit 1"))
+
+(defn start-peer-receive!
+  "Starts receiving a file with hash h on the current node in the background,
+  forwarding it to next-node, and waits for the listener to come up. Kills
+  any stale listener on port first, so the one we wait for is ours. Runs as
+  root, since only root writes to the store."
+  [h port next-node token]
+  (c/su
+    (c/exec* (kill-peer-receive-script port))
+    (c/exec* (str "nohup bash -c "
+                  (c/escape (peer-receive-script h port next-node token))
+                  " > /dev/null 2>&1 < /dev/null &"))
+    (c/exec* (str "for i in $(seq 100); do "
+                  "ss -ltn | grep -q ':" port " ' && exit 0; sleep 0.1; "
+                  "done; exit 1"))))
+
+(defn await-peer-receive!
+  "Waits for the current node to finish receiving hash h in the transfer
+  identified by token. Returns true if it arrived, and the store entry's
+  contents match h."
+  [h token timeout-secs]
+  (let [done (str "." h "." token ".done")]
+    (= "ok"
+       (binding [c/*sudo* nil]
+         (c/exec* (str "cd " dir "; for i in $(seq " (* 2 timeout-secs) "); do "
+                       "if [ -f " done " ]; then "
+                       "if [ \"$(cat " done ")\" = ok ] && "
+                       "[ \"$(sha256sum < " h " | cut -d ' ' -f 1)\" = " h " ]; "
+                       "then echo ok; else echo fail; fi; exit 0; fi; "
+                       "sleep 0.5; done; echo timeout"))))))
+
+(defn chains
+  "Splits nodes into n chains of roughly equal length."
+  [n nodes]
+  (let [nodes (vec nodes)]
+    (when (seq nodes)
+      (partition-all (int (Math/ceil (/ (count nodes) (max 1 n)))) nodes))))
+
+(defn distribute-peer!
+  "Ensures every given node of a test has the store entries for a local file
+  or directory, uploading each missing file from the control node to only a
+  few seed nodes. The remaining nodes are arranged in chains behind each seed;
+  the seed streams the file down its chain, and each node saves it while
+  forwarding it to the next, so every link transfers the file once, in
+  parallel. Nodes which fail to receive a file get it from the control node
+  instead. Options:
+
+    :seeds            How many nodes the control node uploads to. Default 1.
+    :peer-port        The TCP port for node-to-node transfers.
+    :peer-timeout     Seconds to wait for a chain to finish. Default 600.
+    :bandwidth-limit  Total upload bandwidth from the control node, in Kbit/s.
+
+  Nodes must be able to reach one another by name, and have nc and ss
+  installed."
+  [test nodes local-path opts]
+  (let [files   (filter (comp #{:file} first) (entries (io/file local-path)))
+        by-hash (->> files (group-by #(nth % 2)) (map (juxt key (comp first val))))
+        need    (c/on-nodes test nodes
+                            (fn [_ _] (missing (map first by-hash))))
+        seeds   (:seeds opts 1)
+        port    (:peer-port opts default-peer-port)
+        timeout (:peer-timeout opts 600)
+        up-opts (if-let [bw (:bandwidth-limit opts)]
+                  (assoc opts :bandwidth-limit (max 1 (quot bw (max 1 seeds))))
+                  opts)]
+    (doseq [[h [_ _ _ f]] by-hash]
+      (let [chains (chains seeds (filter #(get-in need [% h]) nodes))
+            ; Names this transfer's scratch files
+            token  (rand-int Integer/MAX_VALUE)]
+        (when (seq chains)
+          (info "Distributing" (str f) "to" (count (apply concat chains))
+                "nodes via" (count chains) "seeds")
+          ; Seeds get the file from us
+          (c/on-nodes test (map first chains)
+                      (fn [_ _] (ensure-dir!) (store! f h up-opts)))
+          ; Start listeners from the tail of each chain towards its head, so
+          ; each node's downstream neighbor is listening before it connects.
+          (let [rests (map rest chains)
+                len   (reduce max 0 (map count rests))]
+            (doseq [i (reverse (range len))]
+              (let [next-of (->> rests
+                                 (keep (fn [chain]
+                                         (when-let [node (nth chain i nil)]
+                                           [node (nth chain (inc i) nil)])))
+                                 (into {}))]
+                (c/on-nodes test (keys next-of)
+                            (fn [_ node]
+                              (ensure-dir!)
+                              (start-peer-receive! h port (next-of node)
+                                                   token)))))
+            ; Then have each seed stream into its chain, and wait.
+            (c/on-nodes test (map first (filter next chains))
+                        (fn [_ node]
+                          (let [chain (first (filter #(= node (first %))
+                                                     chains))]
+                            (binding [c/*sudo* nil]
+                              (c/exec :bash :-c
+                                      (str "cat " (store-path h)
+                                           " > /dev/tcp/"
+                                           (name (second chain)) "/"
+                                           port))))))
+            (let [ok (c/on-nodes test (apply concat rests)
+                                 (fn [_ _]
+                                   (await-peer-receive! h token timeout)))]
+              ; Anyone who missed out gets it the slow way.
+              (when-let [failed (seq (keep (fn [[n ok?]] (when-not ok? n)) ok))]
+                (warn "Peer transfer of" (str f) "failed on" failed
+                      "; uploading directly")
+                (c/on-nodes test failed
+                            (fn [_ _] (store! f h up-opts)))))))))))
+
+(defn deploy-nodes!
+  "Deploys a local file or directory to remote-path on the given nodes of a
+  test (by default, all of them) in parallel. Options:
+
+    :parallelism      How many nodes to push to at once. Default: all.
+    :bandwidth-limit  Total upload bandwidth, in Kbit/s, split evenly between
+                      concurrent pushes. Default: unlimited.
+    :seeds            If set, upload each file to only this many nodes, and
+                      have the rest fetch it from their peers. See
+                      `distribute-peer!` for more options.
+
+  Returns a map of nodes to remote-path."
+  ([test local-path remote-path]
+   (deploy-nodes! test (:nodes test) local-path remote-path {}))
+  ([test nodes local-path remote-path opts]
+   (let [parallelism (min (count nodes) (:parallelism opts (count nodes)))
+         sem         (Semaphore. (max 1 parallelism) true)
+         peer-opts   opts
+         opts        (if-let [bw (:bandwidth-limit opts)]
+                       (assoc opts :bandwidth-limit
+                              (max 1 (quot bw (max 1 parallelism))))
+                       opts)]
+     ; Hash once up front, rather than racing on every node thread.
+     (dorun (entries (io/file local-path)))
+     (when (:seeds opts)
+       (distribute-peer! test nodes local-path peer-opts))
+     (c/on-nodes test nodes
+                 (fn [_ _]
+                   (.acquire sem)
+                   (try (deploy! local-path remote-path opts)
+                        (finally (.release sem))))))))
+
+(defn clear!
+  "Removes the content-addressed store from the current node."
+  []
+  (c/su (c/exec :rm :-rf dir)))
@@ -2,7 +2,10 @@
   "Provides the base protocol for running commands on remote nodes, as well as
   common functions for constructing and evaluating shell commands."
   (:require [clojure [string :as str]]
-            [slingshot.slingshot :refer [try+ throw+]]))
+            [clojure.java.io :as io]
+            [slingshot.slingshot :refer [try+ throw+]])
+  (:import (java.nio.charset StandardCharsets)
+           (java.util Base64)))
 
 (defprotocol Remote
   "Remotes allow jepsen.control to run shell commands, upload, and download
@@ -57,6 +60,31 @@
     might introduce some for e.g. recursive uploads, compression, etc. This is
     also a place for Remote implementations to offer custom semantics."))
 
+(defprotocol Streams
+  "An optional protocol for Remotes which can start a long-running command and
+  hand back its raw standard streams, rather than waiting for it to complete.
+  We use this to talk to long-lived helper processes on nodes, like the framed
+  shell in jepsen.control.framed, or jepsen.control.agent."
+  (open-stream! [this context action]
+    "Starts the action's :cmd, and returns a map of:
+
+      :stdin    An OutputStream connected to the command's stdin
+      :stdout   An InputStream of the command's stdout
+      :close    A function which closes both streams and releases the
+                underlying resources"))
+
+(defn delegate-stream!
+  "Opens a stream on a remote which may or may not support Streams. Wrapper
+  remotes use this to pass streams through to the remote they wrap. Throws
+  {:type :jepsen.control/streams-unsupported} if the remote can't stream."
+  [remote context action]
+  (if (satisfies? Streams remote)
+    (open-stream! remote context action)
+    (throw+ {:type    :jepsen.control/streams-unsupported
+             :remote  (type remote)
+             :message (str "Remote " (.getName (class remote))
+                           " doesn't support streams")})))
+
 (defrecord Literal [string])
 
 (defn lit
@@ -169,3 +197,93 @@
       (:in result)
       (:out result)
       (:err result))))
+
+(def batch-policies
+  "What can we do when a command in a batch fails?
+
+    :stop       Skip the rest of the batch and throw
+    :continue   Run the rest of the batch, then throw
+    :ignore     Run the rest of the batch, and don't throw for this command"
+  #{:stop :continue :ignore})
+
+(defn download-plan
+  "Plans downloading a remote path to a local one, like scp -r: directories are
+  copied recursively, following symlinks, and if the local path is a
+  directory, src goes inside it. Takes a function which runs a command (a
+  sequence of arguments) on the node, returning its stdout. Returns
+  {:dirs [local-file ...], :files [[remote-path local-file] ...]}, parents
+  first, so that empty directories come along too."
+  [exec! src local-path]
+  (let [local  (io/file local-path)
+        ; A trailing slash would throw off relative paths
+        src    (let [s (str/replace src #"/+$" "")]
+                 (if (= "" s) "/" s))
+        dest   (if (.isDirectory local)
+                 (io/file local (.getName (io/file src)))
+                 local)
+        target (fn [f]
+                 (if (= f src)
+                   dest
+                   (io/file dest (str/replace (subs f (count src))
+                                              #"^/+" ""))))
+        ; -L follows a symlinked src, and symlinks inside it, as scp does
+        find   (fn [type]
+                 (->> (exec! [:find :-L src :-type type])
+                      str/split-lines
+                      (remove str/blank?)))]
+    {:dirs  (map target (find :d))
+     :files (map (juxt identity target) (find :f))}))
+
+(defn batch-script
+  "Takes a collection of command strings, and a parallel collection of failure
+  policies, and constructs a single bash script which runs each command in turn
+  (in a subshell, with stdin from /dev/null) and frames its results on stdout.
+  For each command, the script prints three lines:
+
+    <index> <exit status> <elapsed nanos>
+    <stdout, base64-encoded>
+    <stderr, base64-encoded>
+
+  Encoding keeps the framing plain ASCII, whatever bytes commands print. Parse
+  this with `parse-batch-output`."
+  [cmds policies]
+  (->> (map (fn [i cmd policy]
+              (str "s=$(now); ( " cmd "\n) < /dev/null > \"$d/o\" 2> \"$d/e\"\n"
+                   "x=$?; t=$(now)\n"
+                   "printf '%s %s %s\\n' " i " $x $(( (t - s) * 1000 ))\n"
+                   "b64 < \"$d/o\"; b64 < \"$d/e\"\n"
+                   (when (= :stop policy)
+                     "[ $x -eq 0 ] || exit 0\n")))
+            (range)
+            cmds
+            policies)
+       (cons (str "d=$(mktemp -d /tmp/jepsen-batch.XXXXXX) || exit 1\n"
+                  "trap 'rm -rf \"$d\"' EXIT\n"
+                  ; Microseconds since the epoch, without forking date if we
+                  ; can help it.
+                  "now() { if [ -n \"$EPOCHREALTIME\" ]; then "
+                  "echo \"${EPOCHREALTIME//[.,]/}\"; "
+                  "else date +%s%6N; fi; }\n"
+                  ; One line of base64, however long
+                  "b64() { base64 | tr -d '\\n'; echo; }\n"))
+       (apply str)))
+
+(defn parse-batch-output
+  "Parses the stdout of a `batch-script` into a vector of maps with :index,
+  :exit, :time (in nanoseconds), :out, and :err. Ignores a trailing, partial
+  frame."
+  [^String out]
+  (let [decode (fn [^String line]
+                 (String. (.decode (Base64/getDecoder) (str/trim line))
+                          StandardCharsets/UTF_8))]
+    (->> (str/split out #"\n" -1)
+         (partition 3)
+         (mapv (fn [[header out err]]
+                 (let [[index exit time] (->> (str/split (str/trim header)
+                                                         #"\s+")
+                                              (mapv #(Long/parseLong %)))]
+                   {:index index
+                    :exit  exit
+                    :time  time
+                    :out   (decode out)
+                    :err   (decode err)}))))))
@@ -4,12 +4,19 @@
   using `docker exec` and `docker cp` instead, which is what this namespace
   helps you do.
 
-  Use at your own risk, this is an unsupported way of running Jepsen."
+  Use at your own risk, this is an unsupported way of running Jepsen.
+
+  Forking `docker exec` for every command is slow, so by default, each
+  connection keeps a pool of long-running `docker exec -i` shells and sends
+  commands over them using jepsen.control.framed. To fork a fresh `docker
+  exec` per command instead, use `(assoc docker :persistent-shell? false)`."
   (:require [clojure.string :as str]
             [clojure.java.shell :refer [sh]]
             [slingshot.slingshot :refer [throw+]]
             [jepsen.control.core :as core]
-            [jepsen.control :as c]))
+            [jepsen.control.framed :as framed]
+            [jepsen.control :as c])
+  (:import (java.util.concurrent ConcurrentLinkedQueue)))
 
 (defn resolve-container-id
   "Takes a host, e.g. `localhost:30404`, and resolves the Docker container id
@@ -77,15 +84,28 @@
 (defrecord DockerRemote [container-id]
   core/Remote
   (connect [this conn-spec]
-    (assoc this :container-id (resolve-container-id (:host conn-spec))))
+    (assoc this
+           :container-id (resolve-container-id (:host conn-spec))
+           :shells       (ConcurrentLinkedQueue.)))
   (disconnect! [this]
-    (dissoc this :container-id))
+    (when-let [shells (:shells this)]
+      (framed/close-pool! shells))
+    (dissoc this :container-id :shells))
   (execute! [this ctx action]
-    (exec container-id action))
+    (if (:persistent-shell? this true)
+      (framed/execute-pooled! (:shells this)
+                              (fn open [] (framed/open! this "sh"))
+                              action)
+      (exec container-id action)))
   (upload! [this ctx local-paths remote-path _opts]
     (cp-to container-id local-paths remote-path))
   (download! [this ctx remote-paths local-path _opts]
-    (cp-from container-id remote-paths local-path)))
+    (cp-from container-id remote-paths local-path))
+
+  core/Streams
+  (open-stream! [this ctx action]
+    (framed/process-stream!
+      ["docker" "exec" "-i" container-id "sh" "-c" (:cmd action)])))
 
 (def docker
   "A remote that does things via `docker exec` and `docker cp`."
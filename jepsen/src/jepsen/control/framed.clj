@@ -0,0 +1,289 @@
+(ns jepsen.control.framed
+  "Opening a fresh channel and spawning a fresh shell for every command is
+  expensive, especially over high-latency links. This namespace runs a tiny
+  shell loop at the far end of a single long-lived byte stream (an SSH channel,
+  a `docker exec -i` process, etc.) and speaks a simple framed protocol to it.
+
+  Each request is a single line:
+
+    <id> <base64 command> <base64 stdin>\\n
+
+  The loop runs the command with `bash -c`, capturing stdout and stderr, and
+  replies with a header line
+
+    <id> <exit status> <stdout length> <stderr length>\\n
+
+  followed by exactly that many bytes of stdout, then stderr. Responses arrive
+  in request order, so callers may write several requests before reading any
+  responses back; this lets us pipeline commands rather than paying a round
+  trip for each one.
+
+  A channel is threadsafe: any number of threads may send requests, and a
+  dedicated reader thread delivers responses to them. If the underlying stream
+  fails, every pending and future request throws :type
+  :jepsen.control/ssh-failed, which jepsen.control.retry knows to retry with a
+  fresh connection."
+  (:require [clojure.java.io :as io]
+            [clojure.string :as str]
+            [clojure.tools.logging :refer [info warn]]
+            [jepsen.control.core :as core]
+            [slingshot.slingshot :refer [try+ throw+]])
+  (:import (java.io BufferedInputStream
+                    ByteArrayOutputStream
+                    DataInputStream
+                    EOFException
+                    InputStream
+                    IOException
+                    OutputStream)
+           (java.nio.charset StandardCharsets)
+           (java.lang ProcessBuilder$Redirect)
+           (java.util Base64
+                      List)
+           (java.util.concurrent ConcurrentLinkedQueue
+                                 LinkedBlockingQueue)))
+
+(defn shell-script
+  "The shell loop we run on the far end of the stream, which runs each command
+  with the given shell (e.g. \"bash\" or \"sh\"). Stdout is reserved for
+  responses, so we silence the loop's own stderr, and every command gets its
+  own stdin, stdout, and stderr files. The loop itself sticks to POSIX sh, so
+  it runs on minimal container images too."
+  [shell]
+  (str/join
+    "\n"
+    ["exec 2>/dev/null"
+     "d=$(mktemp -d /tmp/jepsen-framed.XXXXXX) || exit 1"
+     "trap 'rm -rf \"$d\"' EXIT"
+     "while IFS=' ' read -r id cmd in; do"
+     "  printf '%s' \"$cmd\" | base64 -d > \"$d/cmd\""
+     "  printf '%s' \"$in\" | base64 -d > \"$d/in\""
+     (str "  " shell " -c \"$(cat \"$d/cmd\")\" < \"$d/in\" > \"$d/out\" "
+          "2> \"$d/err\"")
+     "  status=$?"
+     "  printf '%s %s %s %s\\n' \"$id\" \"$status\" \\"
+     "    \"$(wc -c < \"$d/out\")\" \"$(wc -c < \"$d/err\")\""
+     "  cat \"$d/out\" \"$d/err\""
+     "done"]))
+
+(def script
+  "The shell loop, running commands with bash."
+  (shell-script "bash"))
+
+(defn encode
+  "Base64-encodes a command or its stdin: nil, a string (as UTF-8), a byte
+  array, or an InputStream, which we read to the end. Throws
+  IllegalArgumentException for anything else, rather than sending its
+  toString."
+  [x]
+  (.encodeToString
+    (Base64/getEncoder)
+    ^bytes (cond (nil? x)    (byte-array 0)
+                 (string? x) (.getBytes ^String x StandardCharsets/UTF_8)
+                 (bytes? x)  x
+                 (instance? InputStream x)
+                 (let [out (ByteArrayOutputStream.)]
+                   (io/copy x out)
+                   (.toByteArray out))
+
+                 true
+                 (throw (IllegalArgumentException.
+                          (str "Can't send a " (class x)
+                               " to a framed shell; use a string, byte "
+                               "array, or InputStream"))))))
+
+(defn read-line!
+  "Reads a single newline-terminated line of ASCII from an input stream,
+  returning nil if the stream is exhausted before any bytes are read."
+  [^InputStream in]
+  (let [buf (ByteArrayOutputStream. 64)]
+    (loop []
+      (let [b (.read in)]
+        (cond (= -1 b)  (when (pos? (.size buf))
+                          (throw (EOFException. "Truncated response header")))
+              (= 10 b)  (.toString buf "US-ASCII")
+              true      (do (.write buf b)
+                            (recur)))))))
+
+(defn read-response!
+  "Reads a single response from a DataInputStream, returning a map of :id,
+  :exit, :out, and :err, or nil if the stream is exhausted."
+  [^DataInputStream in]
+  (when-let [header (read-line! in)]
+    (let [[id exit out-len err-len] (->> (str/split (str/trim header) #"\s+")
+                                         (map #(Long/parseLong %)))
+          out (byte-array out-len)
+          err (byte-array err-len)]
+      (.readFully in out)
+      (.readFully in err)
+      {:id    id
+       :exit  exit
+       :out   (String. out StandardCharsets/UTF_8)
+       :err   (String. err StandardCharsets/UTF_8)})))
+
+(defrecord Channel [^OutputStream out
+                    ^DataInputStream in
+                    close     ; A function which releases the underlying stream
+                    pending   ; LinkedBlockingQueue of [id promise] pairs
+                    next-id   ; Atom: the next request ID
+                    state])   ; Atom: :open, or the Throwable which broke us
+
+(defn open?
+  "Is this channel still usable?"
+  [^Channel ch]
+  (= :open @(:state ch)))
+
+(defn fail!
+  "Marks a channel as broken by the given throwable, releases the underlying
+  stream, and hands the throwable to every pending request."
+  [^Channel ch ^Throwable t]
+  (when (compare-and-set! (:state ch) :open t)
+    (try ((:close ch))
+         (catch Exception e
+           (warn e "Error closing framed channel"))))
+  (locking ch
+    (loop []
+      (when-let [[_ p] (.poll ^LinkedBlockingQueue (:pending ch))]
+        (deliver p t)
+        (recur)))))
+
+(defn close!
+  "Closes a channel. Any in-flight requests will throw."
+  [ch]
+  (fail! ch (EOFException. "Framed channel closed")))
+
+(defn read-loop!
+  "Reads responses off a channel and delivers them to pending requests until
+  the stream ends or breaks."
+  [^Channel ch]
+  (try
+    (loop []
+      (if-let [res (read-response! (:in ch))]
+        (let [[id p] (.poll ^LinkedBlockingQueue (:pending ch))]
+          (when-not (= id (:id res))
+            (throw (IOException.
+                     (str "Expected response to request " id ", but got "
+                          (:id res)))))
+          (deliver p res)
+          (recur))
+        (throw (EOFException. "Framed shell exited"))))
+    (catch Throwable t
+      (fail! ch t))))
+
+(defn channel
+  "Takes an input stream of responses, an output stream for requests, and a
+  function which releases both. Assumes the shell loop `script` is already
+  running at the far end, and returns a Channel, starting a thread to read its
+  responses."
+  [^InputStream in ^OutputStream out close]
+  (let [ch (Channel. out
+                     (DataInputStream. (BufferedInputStream. in))
+                     close
+                     (LinkedBlockingQueue.)
+                     (atom 0)
+                     (atom :open))]
+    (doto (Thread. ^Runnable (fn [] (read-loop! ch))
+                   "jepsen framed channel reader")
+      (.setDaemon true)
+      (.start))
+    ch))
+
+(defn open!
+  "Takes a Remote supporting jepsen.control.core/Streams, starts the shell loop
+  on it, and returns a Channel. Commands run with bash, unless another shell is
+  given."
+  ([remote]
+   (open! remote "bash"))
+  ([remote shell]
+   (let [{:keys [stdin stdout close]}
+         (core/open-stream! remote {} {:cmd (str shell " -c "
+                                                 (core/escape
+                                                   (shell-script shell)))})]
+     (channel stdout stdin close))))
+
+(defn process-stream!
+  "Starts a local process from a sequence of arguments, and returns a stream
+  map, as for jepsen.control.core/open-stream!, talking to its stdin and
+  stdout. Its stderr is discarded."
+  [args]
+  (let [p (-> (ProcessBuilder. ^List (mapv str args))
+              (.redirectError ProcessBuilder$Redirect/DISCARD)
+              .start)]
+    {:stdin  (.getOutputStream p)
+     :stdout (.getInputStream p)
+     :close  (fn close [] (.destroy p))}))
+
+(defn broken
+  "Throws a :jepsen.control/ssh-failed error for a channel broken by cause."
+  [action cause]
+  (throw+ {:type    :jepsen.control/ssh-failed
+           :cmd     (:cmd action)
+           :message (str "Framed channel failed: " cause)}
+          cause))
+
+(defn send!
+  "Writes an action to the channel without waiting for it to complete. Returns
+  a promise of the raw response. Use `await!` to obtain the completed action."
+  [^Channel ch action]
+  (let [p (promise)]
+    (locking ch
+      (let [state @(:state ch)]
+        (when-not (= :open state)
+          (broken action state)))
+      (let [id (swap! (:next-id ch) inc)
+            ^OutputStream out (:out ch)]
+        ; Enqueue before writing, so the reader always finds us.
+        (.put ^LinkedBlockingQueue (:pending ch) [id p])
+        (try
+          (.write out (.getBytes (str id " " (encode (:cmd action)) " "
+                                      (encode (:in action)) "\n")
+                                 StandardCharsets/US_ASCII))
+          (.flush out)
+          (catch IOException e
+            (fail! ch e)
+            (broken action e)))))
+    p))
+
+(defn await!
+  "Waits for a promise from `send!`, and returns the action with :exit, :out,
+  and :err, like jepsen.control.core/execute!."
+  [action p]
+  (let [res @p]
+    (if (instance? Throwable res)
+      (broken action res)
+      (assoc action
+             :exit  (:exit res)
+             :out   (:out res)
+             :err   (:err res)))))
+
+(defn execute!
+  "Runs a single action on the channel and waits for it to complete."
+  [ch action]
+  (await! action (send! ch action)))
+
+(defn execute-all!
+  "Pipelines a sequence of actions: writes them all to the channel, then waits
+  for each in turn. Returns a vector of completed actions."
+  [ch actions]
+  (->> actions
+       (mapv (fn [action] [action (send! ch action)]))
+       (mapv (partial apply await!))))
+
+(defn execute-pooled!
+  "Executes an action on one of the idle channels in a ConcurrentLinkedQueue,
+  opening a new one with (open) if none are free. Puts the channel back in the
+  pool afterwards, unless it broke."
+  [^ConcurrentLinkedQueue pool open action]
+  (let [ch (or (.poll pool) (open))]
+    (try (execute! ch action)
+         (finally
+           (if (open? ch)
+             (.offer pool ch)
+             (close! ch))))))
+
+(defn close-pool!
+  "Closes every idle channel in a pool."
+  [^ConcurrentLinkedQueue pool]
+  (loop []
+    (when-let [ch (.poll pool)]
+      (close! ch)
+      (recur))))
@@ -3,13 +3,20 @@
   It's however sometimes conveniet to be able to setup and teardown
   the databases using `kubectl` instead, which is what this namespace
   helps you do. Use at your own risk, this is an unsupported way
-  of running Jepsen."
+  of running Jepsen.
+
+  Forking `kubectl exec` for every command is slow, so by default, each
+  connection keeps a pool of long-running `kubectl exec -i` shells and sends
+  commands over them using jepsen.control.framed. To fork a fresh `kubectl
+  exec` per command instead, assoc :persistent-shell? false onto the remote."
   (:require [clojure.java.shell :refer [sh]]
             [slingshot.slingshot :refer [throw+]]
             [jepsen.control.core :as core]
+            [jepsen.control.framed :as framed]
             [jepsen.control :as c]
-            [clojure.string :refer [split-lines trim]]
-            [clojure.tools.logging :refer [info]]))
+            [clojure.string :refer [blank? split-lines trim]]
+            [clojure.tools.logging :refer [info]])
+  (:import (java.util.concurrent ConcurrentLinkedQueue)))
 
 (defn exec
   "Execute a shell command on a pod."
@@ -82,15 +89,30 @@
     (assoc this
            :context   (or-parameter "context" context)
            :namespace (or-parameter "namespace" namespace)
-           :pod-name  (:host conn-spec)))
+           :pod-name  (:host conn-spec)
+           :shells    (ConcurrentLinkedQueue.)))
   (disconnect! [this]
-    (dissoc this :context :namespace :pod-name))
+    (when-let [shells (:shells this)]
+      (framed/close-pool! shells))
+    (dissoc this :context :namespace :pod-name :shells))
   (execute! [this ctx action]
-    (exec context namespace (:pod-name this) action))
+    (if (:persistent-shell? this true)
+      (framed/execute-pooled! (:shells this)
+                              (fn open [] (framed/open! this "sh"))
+                              action)
+      (exec context namespace (:pod-name this) action)))
   (upload! [this ctx local-paths remote-path _opts]
     (cp-to context namespace (:pod-name this) local-paths remote-path))
   (download! [this ctx remote-paths local-path _opts]
-    (cp-from context namespace (:pod-name this) remote-paths local-path)))
+    (cp-from context namespace (:pod-name this) remote-paths local-path))
+
+  core/Streams
+  (open-stream! [this ctx action]
+    ; context and namespace are pre-rendered flags, or empty strings
+    (framed/process-stream!
+      (concat ["kubectl" "exec" "-i" (:pod-name this)]
+              (remove blank? [context namespace])
+              ["--" "sh" "-c" (:cmd action)]))))
 
 (defn k8s
   "Returns a remote that does things via `kubectl exec` and `kubectl cp`, in the default context and namespacd."
@@ -0,0 +1,109 @@
+(ns jepsen.control.nsenter
+  "A Remote for clusters whose nodes are network namespaces on the control
+  machine itself (see jepsen.net.netns). Rather than SSH, each command runs in
+  its node's namespace via `nsenter --net`. Like jepsen.control.docker, each
+  connection keeps a pool of long-running shells inside the namespace and
+  talks to them with jepsen.control.framed, so a command costs a pipe write
+  rather than a fork of nsenter; use `:persistent-shell? false` to fork one
+  per command instead.
+
+  Namespaces only separate networking: nodes share the control machine's
+  filesystem, processes, and users. Uploads and downloads are therefore plain
+  local copies, and DBs must keep their files and pidfiles in per-node paths.
+  Entering namespaces requires root."
+  (:require [clojure.java.io :as io]
+            [clojure.java.shell :refer [sh]]
+            [jepsen.control.core :as core]
+            [jepsen.control.framed :as framed]
+            [jepsen.util :as util]
+            [slingshot.slingshot :refer [throw+]])
+  (:import (java.util.concurrent ConcurrentLinkedQueue)))
+
+(def default-prefix
+  "We name each node's namespace by prefixing the node's name with this."
+  "jepsen-")
+
+(defn netns-name
+  "The name of a node's network namespace."
+  [prefix node]
+  (str prefix (name node)))
+
+(defn netns-path
+  "Where the kernel exposes a named network namespace."
+  [netns]
+  (str "/var/run/netns/" netns))
+
+(defn nsenter-args
+  "The arguments to run a shell command string in a namespace."
+  [netns cmd]
+  ["nsenter" (str "--net=" (netns-path netns)) "--" "sh" "-c" cmd])
+
+(defn exec!
+  "Runs a shell command string in a namespace, with optional stdin, and returns
+  {:exit, :out, :err}."
+  ([netns cmd]
+   (exec! netns cmd nil))
+  ([netns cmd in]
+   (apply sh (concat (nsenter-args netns cmd)
+                     (when in [:in in])))))
+
+(defn copy!
+  "Copies local files or directories to a destination path, throwing on
+  failure."
+  [sources dest]
+  (doseq [src (util/coll sources)]
+    (let [res (sh "cp" "-r" (str src) (str dest))]
+      (when-not (zero? (:exit res))
+        (throw+ (assoc res
+                       :type   ::copy-failed
+                       :source src
+                       :dest   dest))))))
+
+(defrecord NsenterRemote [prefix persistent-shell? netns shells]
+  core/Remote
+  (connect [this conn-spec]
+    (let [netns (netns-name prefix (:host conn-spec))]
+      (when-not (.exists (io/file (netns-path netns)))
+        (throw+ {:type    :jepsen.control/ssh-failed
+                 :host    (:host conn-spec)
+                 :netns   netns
+                 :message (str "No network namespace " netns
+                               "; was the topology created?")}))
+      (assoc this
+             :netns  netns
+             :shells (ConcurrentLinkedQueue.))))
+
+  (disconnect! [this]
+    (when shells
+      (framed/close-pool! shells))
+    (assoc this :netns nil, :shells nil))
+
+  (execute! [this ctx action]
+    (if persistent-shell?
+      (framed/execute-pooled! shells
+                              (fn open [] (framed/open! this "sh"))
+                              action)
+      (exec! netns (:cmd action) (:in action))))
+
+  (upload! [this ctx local-paths remote-path _opts]
+    (copy! local-paths remote-path))
+
+  (download! [this ctx remote-paths local-path _opts]
+    (copy! remote-paths local-path))
+
+  core/Streams
+  (open-stream! [this ctx action]
+    (framed/process-stream! (nsenter-args netns (:cmd action)))))
+
+(defn remote
+  "Constructs an nsenter Remote. Options:
+
+    :prefix             The prefix of nodes' namespace names. Defaults to
+                        \"jepsen-\", as in jepsen.net.netns.
+    :persistent-shell?  Whether to keep shells running in each namespace.
+                        Defaults to true."
+  ([]
+   (remote {}))
+  ([opts]
+   (map->NsenterRemote {:prefix            (:prefix opts default-prefix)
+                        :persistent-shell? (:persistent-shell? opts true)})))
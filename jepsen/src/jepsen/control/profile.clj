@@ -0,0 +1,172 @@
+(ns jepsen.control.profile
+  "Where does the time go during setup and teardown? This namespace records
+  every control action--exec, upload, and download--in a fixed-size,
+  in-memory ring buffer. Recording is cheap: a couple of clock reads and an
+  atomic increment per action. At the end of a run, jepsen.core writes the
+  ring to control-profile.tsv in the test's store directory, and adds a
+  summary of the slowest commands and per-node skew to the test's results."
+  (:refer-clojure :exclude [reset!])
+  (:require [clojure.java.io :as io]
+            [clojure.string :as str]
+            [clojure.tools.logging :refer [info]]
+            [jepsen [store :as store]
+                    [util :as util]])
+  (:import (java.util.concurrent.atomic AtomicLong
+                                        AtomicReferenceArray)))
+
+(def capacity
+  "How many events do we retain? Older events are overwritten."
+  65536)
+
+(def cmd-length
+  "How many characters of each command do we keep?"
+  80)
+
+(defrecord Event [kind      ; :exec, :upload, :download, :connect, or :auth
+                  host
+                  cmd       ; A summary of the command or paths
+                  start     ; System/nanoTime when we began
+                  queue     ; Nanos spent waiting for the remote, or nil
+                  duration  ; Nanos from start to completion
+                  bytes])   ; Bytes of input and output, or files moved
+
+(defonce ^AtomicReferenceArray ring (AtomicReferenceArray. (int capacity)))
+
+(defonce ^AtomicLong cursor (AtomicLong. 0))
+
+(defonce ^AtomicLong origin (AtomicLong. (System/nanoTime)))
+
+(defn reset!
+  "Clears the ring, and makes event times relative to now."
+  []
+  (locking ring
+    (.set origin (System/nanoTime))
+    (.set cursor 0)
+    (dotimes [i capacity]
+      (.set ring (int i) nil))))
+
+(defn summarize-cmd
+  "Truncates a command (or anything else) to cmd-length characters."
+  [x]
+  (let [s (str/replace (str x) #"\s+" " ")]
+    (if (< cmd-length (count s))
+      (subs s 0 cmd-length)
+      s)))
+
+(defn record!
+  "Records an event which began at start (in System/nanoTime) and ended just
+  now."
+  [kind host cmd ^long start queue bytes]
+  (let [i (.getAndIncrement cursor)]
+    (.set ring (int (mod i capacity))
+          (Event. kind host (summarize-cmd cmd) start queue
+                  (- (System/nanoTime) start) bytes))))
+
+(defn events
+  "Returns all retained events, oldest first."
+  []
+  (locking ring
+    (let [n (.get cursor)]
+      (->> (range (max 0 (- n capacity)) n)
+           (keep (fn [i] (.get ring (int (mod i capacity)))))
+           vec))))
+
+(defn ms
+  "Rounds nanos to milliseconds, as a double with microsecond precision."
+  [nanos]
+  (when nanos
+    (/ (Math/round (/ nanos 1e3)) 1e3)))
+
+(defn summary
+  "Summarizes a collection of events: how many there were, the commands which
+  took the most total time, how long each node took to connect and
+  authenticate, and how time was spread across nodes. Times are in
+  milliseconds."
+  ([events]
+   (summary 10 events))
+  ([n events]
+   (let [by-cmd (->> events
+                     (group-by (juxt :kind :cmd))
+                     (map (fn [[[kind cmd] es]]
+                            (let [ds (map :duration es)]
+                              {:kind  kind
+                               :cmd   cmd
+                               :count (count es)
+                               :time  (reduce + ds)
+                               :max   (reduce max ds)})))
+                     (sort-by :time >)
+                     (take n)
+                     (mapv #(-> % (update :time ms) (update :max ms))))
+         nodes  (->> events
+                     (group-by :host)
+                     (map (fn [[host es]]
+                            [host {:count (count es)
+                                   :time  (reduce + (map :duration es))
+                                   :queue (reduce + (keep :queue es))
+                                   :bytes (reduce + (keep :bytes es))}]))
+                     (into (sorted-map)))
+         times  (map :time (vals nodes))
+         ; Session establishment, per node
+         sessions (->> events
+                       (filter (comp #{:connect :auth} :kind))
+                       (group-by :host)
+                       (map (fn [[host es]]
+                              [host (->> es
+                                         (group-by :kind)
+                                         (util/map-vals
+                                           (comp ms
+                                                 (partial reduce +)
+                                                 (partial map :duration))))]))
+                       (into (sorted-map)))]
+     {:count        (count events)
+      :dropped      (max 0 (- (.get cursor) capacity))
+      :time         (ms (reduce + (map :duration events)))
+      :top-commands by-cmd
+      :nodes        (util/map-vals (fn [m]
+                                     (-> m (update :time ms)
+                                         (update :queue ms)))
+                                   nodes)
+      :sessions     sessions
+      :skew         (when (seq times)
+                      (let [lo (reduce min times)
+                            hi (reduce max times)]
+                        {:min   (ms lo)
+                         :max   (ms hi)
+                         :ratio (when (pos? lo) (double (/ hi lo)))}))})))
+
+(defn log-sessions!
+  "Logs how long it took to connect to each node, based on the :connect events
+  recorded since the last reset."
+  []
+  (let [cs (filter (comp #{:connect} :kind) (events))]
+    (when (seq cs)
+      (let [slowest (apply max-key :duration cs)
+            start   (reduce min (map :start cs))
+            end     (reduce max (map #(+ (:start %) (:duration %)) cs))]
+        (info "Connected to" (count cs) "nodes in" (ms (- end start))
+              "ms; slowest was" (:host slowest) "at" (ms (:duration slowest))
+              "ms")))))
+
+(defn write!
+  "Writes events to a file as tab-separated values, one event per line."
+  [file events]
+  (let [o (.get origin)]
+    (with-open [w (io/writer file)]
+      (.write w "start-ms\thost\tkind\tqueue-ms\tduration-ms\tbytes\tcmd\n")
+      (doseq [e events]
+        (.write w (str (ms (- (:start e) o)) "\t"
+                       (:host e) "\t"
+                       (name (:kind e)) "\t"
+                       (ms (:queue e)) "\t"
+                       (ms (:duration e)) "\t"
+                       (:bytes e) "\t"
+                       (:cmd e) "\n"))))))
+
+(defn save!
+  "Writes the ring to control-profile.tsv in the test's store directory, and
+  returns the test with a :control-profile summary."
+  [test]
+  (let [es (events)]
+    (when (:name test)
+      (write! (store/path! test "control-profile.tsv") es))
+    (assoc test :control-profile (summary es))))
@@ -0,0 +1,263 @@
+(ns jepsen.control.relay
+  "On large clusters, having the control node open an SSH connection to every
+  node becomes a bottleneck: the control node spends its CPU on crypto and
+  handshakes for every setup and nemesis step. This namespace provides a Remote
+  which arranges nodes in a tree instead. The control node connects directly
+  to only a few relay nodes; every other node is reached by running `ssh` from
+  its parent in the tree, and results flow back up the same path.
+
+  For instance, with a fanout of 2 and nodes n1...n6, the control node
+  connects to n1 and n2. Commands for n3 and n4 are relayed through n1, and
+  commands for n5 and n6 through n2.
+
+  This is transparent to callers of jepsen.control/on-nodes and friends: use
+  it as the test's :remote, and each node's session runs commands, uploads,
+  and downloads through its relays. Connections to relays are shared between
+  sessions, and use persistent shells (see jepsen.control.sshj), so relayed
+  commands multiplex over a single connection per relay. Relays use OpenSSH
+  connection sharing (ControlMaster) for their own hops.
+
+  Relays must be able to SSH to their children without a password, as the
+  test's SSH user--typically via a key distributed during OS setup. Hops use
+  the conn spec's :private-key-path, at the same path on each relay, and its
+  :strict-host-key-checking, so with checking on, relays need their
+  children's host keys. File
+  transfers are carried inline as base64, which is fine for configuration
+  files and logs, but for large artifacts, prefer fetching them on the nodes
+  directly."
+  (:require [clojure.java.io :as io]
+            [clojure.string :as str]
+            [clojure.tools.logging :refer [warn]]
+            [jepsen.util :as util]
+            [jepsen.control [core :as core]
+                            [retry :as retry]
+                            [sshj :as sshj]]
+            [slingshot.slingshot :refer [try+ throw+]])
+  (:import (java.io File)
+           (java.nio.file Files)
+           (java.util Base64)))
+
+(def default-fanout
+  "How many children does each relay (and the control node) have, by default?"
+  8)
+
+(def ssh-opts
+  "Options for the ssh commands relays run to reach their children. See also
+  conn-spec-opts."
+  ["-o" "BatchMode=yes"
+   "-o" "ControlMaster=auto"
+   "-o" "ControlPath=/tmp/jepsen-relay-%r@%h:%p"
+   "-o" "ControlPersist=60"])
+
+(defn parents
+  "Takes a fanout and a sequence of nodes, and arranges them in a tree rooted
+  at the control node, breadth-first, like a k-ary heap. Returns a map of each
+  node to its parent node, or nil if the control node connects to it
+  directly."
+  [fanout nodes]
+  (let [nodes (vec nodes)]
+    (->> nodes
+         (map-indexed (fn [i node]
+                        (let [p (quot i fanout)]
+                          [node (when (pos? p) (nth nodes (dec p)))])))
+         (into {}))))
+
+(defn path
+  "Takes a map of parents and a node, and returns the sequence of relays we
+  pass through to reach that node, starting with the one the control node
+  connects to."
+  [parents node]
+  (loop [node node
+         path ()]
+    (if-let [p (get parents node)]
+      (recur p (cons p path))
+      path)))
+
+(defn quote-arg
+  "Single-quotes a string for the shell."
+  [^String s]
+  (str "'" (str/replace s "'" "'\\''") "'"))
+
+(defn conn-spec-opts
+  "ssh options for a hop which follow the test's conn spec: its identity file
+  (which must exist at the same path on relays) and host key checking."
+  [conn-spec]
+  (concat ["-o" (str "StrictHostKeyChecking="
+                     (let [v (:strict-host-key-checking conn-spec :yes)]
+                       (cond (true? v)  "yes"
+                             (false? v) "no"
+                             true       (name v))))]
+          (when-let [k (:private-key-path conn-spec)]
+            ["-i" (quote-arg k)])))
+
+(defn hop
+  "Wraps a command string so that it runs on host, via ssh from the previous
+  hop."
+  [conn-spec host cmd]
+  (str/join " " (concat ["ssh"]
+                        ssh-opts
+                        (conn-spec-opts conn-spec)
+                        ["-p" (:port conn-spec 22)
+                         "-l" (quote-arg (:username conn-spec "root"))
+                         (quote-arg (name host))
+                         (quote-arg cmd)])))
+
+(defn acquire!
+  "Opens (if necessary) a connection to the given root relay, and increments
+  its reference count. Returns the delay of the connected remote. Roots are
+  opened concurrently, each at most once."
+  [registry remote conn-spec root]
+  (let [entry (-> (swap! registry
+                         (fn [reg]
+                           (if (contains? reg root)
+                             (update-in reg [root :refs] inc)
+                             (assoc reg root
+                                    {:refs 1
+                                     :conn (delay
+                                             (core/connect
+                                               remote
+                                               (assoc conn-spec
+                                                      :host root)))}))))
+                  (get root))]
+    (try @(:conn entry)
+         (:conn entry)
+         (catch Throwable t
+           ; Forget this entry so the next attempt can try again
+           (swap! registry (fn [reg]
+                             (if (identical? (:conn entry)
+                                             (get-in reg [root :conn]))
+                               (dissoc reg root)
+                               reg)))
+           (throw t)))))
+
+(defn release!
+  "Decrements the reference count for a root relay's connection, closing it
+  once nobody uses it. Takes the connection's delay, so that releasing a
+  connection we've already replaced is a no-op. With force?, closes the
+  connection regardless of references, e.g. because it's broken."
+  [registry root conn force?]
+  (let [[reg _] (swap-vals! registry
+                            (fn [reg]
+                              (let [e (get reg root)]
+                                (cond (not (identical? conn (:conn e))) reg
+                                      (or force? (<= (:refs e) 1))
+                                      (dissoc reg root)
+                                      true (update-in reg [root :refs] dec)))))
+        e (get reg root)]
+    (when (and (identical? conn (:conn e))
+               (or force? (<= (:refs e) 1))
+               (realized? conn))
+      (try+ (core/disconnect! @conn)
+            (catch Object e
+              (warn "Error closing relay connection to" root e))))))
+
+(defn exec!
+  "Runs a command (a sequence of arguments, which we escape) via a relayed
+  remote in the given context, throwing on nonzero exit."
+  [remote ctx args]
+  (->> {:cmd (str/join " " (map core/escape args))}
+       (core/wrap-sudo ctx)
+       (core/execute! remote ctx)
+       core/throw-on-nonzero-exit))
+
+(defrecord RelayRemote [remote     ; The underlying remote for root relays
+                        fanout
+                        parents    ; Map of nodes to parent nodes
+                        registry   ; Atom: root -> {:refs, :conn (delay)}
+                        conn-spec
+                        root       ; The relay the control node talks to
+                        conn       ; The delay of our root's connection
+                        hops]      ; Hosts to ssh through, after the root
+  core/Remote
+  (connect [this conn-spec]
+    (let [host           (:host conn-spec)
+          [root & hops]  (concat (path parents host) [host])]
+      (assoc this
+             :conn-spec conn-spec
+             :root      root
+             :conn      (acquire! registry remote conn-spec root)
+             :hops      hops)))
+
+  (disconnect! [this]
+    (release! registry root conn false))
+
+  (execute! [this ctx action]
+    (let [cmd (reduce (fn [cmd host] (hop conn-spec host cmd))
+                      (:cmd action)
+                      (reverse hops))]
+      (try+
+        (-> (core/execute! @conn ctx (assoc action :cmd cmd))
+            (assoc :cmd (:cmd action)))
+        (catch [:type :jepsen.control/ssh-failed] e
+          ; The shared connection is broken; throw it away so that a
+          ; reconnect opens a fresh one.
+          (release! registry root conn true)
+          (throw+ e)))))
+
+  (upload! [this ctx local-paths remote-path _opts]
+    (let [sources (map io/file (util/coll local-paths))
+          into?   (or (< 1 (count sources))
+                      (zero? (:exit (core/execute!
+                                      this ctx
+                                      (core/wrap-sudo
+                                        ctx
+                                        {:cmd (str "test -d "
+                                                   (core/escape
+                                                     remote-path))})))))]
+      (doseq [^File src sources]
+        (let [dest (if into?
+                     (str remote-path "/" (.getName src))
+                     remote-path)
+              root (.toPath src)]
+          (doseq [^File f (file-seq src)]
+            (let [path (if (.isDirectory src)
+                         (str dest "/" (.relativize root (.toPath f)))
+                         dest)]
+              (if (.isDirectory f)
+                (exec! this ctx [:mkdir :-p path])
+                ; wrap-sudo puts any sudo password ahead of our data
+                (->> {:cmd (str "base64 -d > " (core/escape path))
+                      :in  (->> (Files/readAllBytes (.toPath f))
+                                (.encodeToString (Base64/getMimeEncoder)))}
+                     (core/wrap-sudo ctx)
+                     (core/execute! this ctx)
+                     core/throw-on-nonzero-exit))))))))
+
+  (download! [this ctx remote-paths local-path _opts]
+    (doseq [src (util/coll remote-paths)]
+      (let [{:keys [dirs files]} (core/download-plan
+                                   #(:out (exec! this ctx %))
+                                   src local-path)]
+        (doseq [^File d dirs]
+          (.mkdirs d))
+        (doseq [[f ^File file] files]
+          (let [bytes (->> (exec! this ctx [:base64 f])
+                           :out
+                           (.decode (Base64/getMimeDecoder)))]
+            (io/make-parents file)
+            (Files/write (.toPath file) ^bytes bytes
+                         (into-array java.nio.file.OpenOption []))))))))
+
+(defn remote
+  "Constructs a Remote which reaches nodes through a tree of relay nodes.
+  Options:
+
+    :nodes    The nodes of the test, in order. Required: we use these to
+              arrange the tree. Hosts not in this list are connected to
+              directly.
+    :fanout   How many children the control node and each relay have.
+              Defaults to 8.
+    :remote   The remote used to connect to root relays. Defaults to an SSHJ
+              remote with persistent shells.
+
+    (relay/remote {:nodes (:nodes test), :fanout 10})"
+  [opts]
+  (assert (seq (:nodes opts)) "relay/remote requires :nodes")
+  (let [fanout (:fanout opts default-fanout)]
+    (assert (pos? fanout))
+    (retry/remote
+      (map->RelayRemote
+        {:remote    (:remote opts (sshj/raw-remote {:persistent-shell? true}))
+         :fanout    fanout
+         :parents   (parents fanout (:nodes opts))
+         :registry  (atom {})}))))
@@ -62,7 +62,13 @@
   (download! [this context remote-paths local-path more]
     (with-retry
       (rc/with-conn [c conn]
-        (core/download! c context remote-paths local-path more)))))
+        (core/download! c context remote-paths local-path more))))
+
+  core/Streams
+  (open-stream! [this context action]
+    (with-retry
+      (rc/with-conn [c conn]
+        (core/delegate-stream! c context action)))))
 
 (defn remote
   "Constructs a new Remote by wrapping another Remote in one which
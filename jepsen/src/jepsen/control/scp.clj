@@ -58,15 +58,20 @@
 
 (defn scp!
   "Runs an SCP command by shelling out. Takes a conn-spec (used for port, key,
-  etc), a seq of sources, and a single destination, all as strings."
-  [conn-spec sources dest]
-  (apply util/sh "scp" "-rpC"
-         "-P" (str (:port conn-spec))
-         (concat (when-let [k (:private-key-path conn-spec)]
-                   ["-i" k])
-                 sources
-                 [dest]))
-  nil)
+  etc), a seq of sources, and a single destination, all as strings. Options
+  may include a :bandwidth-limit, in Kbit/s."
+  ([conn-spec sources dest]
+   (scp! conn-spec sources dest nil))
+  ([conn-spec sources dest opts]
+   (apply util/sh "scp" "-rpC"
+          "-P" (str (:port conn-spec))
+          (concat (when-let [k (:private-key-path conn-spec)]
+                    ["-i" k])
+                  (when-let [l (:bandwidth-limit opts)]
+                    ["-l" (str l)])
+                  sources
+                  [dest]))
+   nil))
 
 (defn remote-path
   "Returns the string representation of a remote path using a conn spec; e.g.
@@ -90,20 +95,21 @@
   (execute! [this ctx action]
     (core/execute! cmd-remote ctx action))
 
-  (upload! [this ctx srcs dest _]
+  (upload! [this ctx srcs dest opts]
     (let [sudo (:sudo ctx)]
       (if (or (nil? sudo) (= sudo (:user conn-spec)))
         ; We can upload directly using our connection credentials.
         (scp! conn-spec
               (util/coll srcs)
-              (remote-path conn-spec dest))
+              (remote-path conn-spec dest)
+              opts)
 
         ; We need to become a different user for this. Upload each source to a
         ; tmpfile and rename.
         (with-tmp-file cmd-remote ctx [tmp]
           (doseq [src (util/coll srcs)]
             ; Upload to tmpfile
-            (core/upload! this {} src tmp nil)
+            (core/upload! this {} src tmp opts)
             ; Chown and move to dest, as root
             (exec! cmd-remote {:sudo "root"} [:chown sudo tmp])
             (exec! cmd-remote {:sudo "root"} [:mv tmp dest]))))))
@@ -135,7 +141,11 @@
                   ; Make the tmpfile readable to us
                   (exec! cmd-remote {:sudo "root"} [:chown sudo tmp])
                   ; Download it
-                  (core/download! this {} tmp dest nil)))))))))
+                  (core/download! this {} tmp dest nil))))))))
+
+  core/Streams
+  (open-stream! [this ctx action]
+    (core/delegate-stream! cmd-remote ctx action)))
 
 (defn remote
   "Takes a remote which can execute commands, and wraps it in a remote which
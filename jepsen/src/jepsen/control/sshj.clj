@@ -5,6 +5,8 @@
             [clojure.tools.logging :refer [info warn]]
             [jepsen [util :as util]]
             [jepsen.control [core :as core]
+                            [framed :as framed]
+                            [profile :as profile]
                             [retry :as retry]
                             [scp :as scp]]
             [slingshot.slingshot :refer [try+ throw+]])
@@ -19,11 +21,13 @@
            (net.schmizz.sshj.connection.channel OpenFailException)
            (net.schmizz.sshj.connection.channel.direct Session)
            (net.schmizz.sshj.userauth UserAuthException)
+           (net.schmizz.sshj.userauth.keyprovider KeyProvider)
            (net.schmizz.sshj.userauth.method AuthMethod)
            (net.schmizz.sshj.xfer FileSystemFile)
            (java.io IOException
                     InterruptedIOException)
-           (java.util.concurrent Semaphore
+           (java.util.concurrent ConcurrentLinkedQueue
+                                 Semaphore
                                  TimeUnit)))
 
 (defn auth-methods
@@ -39,6 +43,27 @@
       .createConnector
       AgentProxy.))
 
+(defonce shared-agent-proxy
+  ; Opening a fresh agent connection for every node is wasteful when we connect
+  ; to dozens of nodes at once, so we share a single one. Nil if there's no
+  ; agent to talk to.
+  (delay (try (agent-proxy)
+              (catch Exception e
+                (info "No SSH agent available:" (.getMessage e))
+                nil))))
+
+(defonce key-providers
+  ; Parsed private keys, by path, shared between connections.
+  (atom {}))
+
+(defn key-provider
+  "Returns a (cached) KeyProvider for the given private key path."
+  [^SSHClient c path]
+  (or (get @key-providers path)
+      (let [kp (.loadKeys c ^String path)]
+        (swap! key-providers assoc path kp)
+        kp)))
+
 (defn auth!
   "Tries a bunch of ways to authenticate an SSHClient. We start with the given
   key file, if provided, then fall back to general public keys, then fall back
@@ -46,14 +71,14 @@
   [^SSHClient c {:keys [username password private-key-path] :as conn-spec}]
   (or ; Try given key
       (when-let [k private-key-path]
-        (.authPublickey c username (into-array [k]))
+        (.authPublickey c ^String username
+                        (into-array KeyProvider [(key-provider c k)]))
         true)
 
       ; Try agent
       (try
-        (let [agent-proxy (agent-proxy)
-              methods (auth-methods agent-proxy)]
-          (.auth c username methods)
+        (when-let [agent-proxy @shared-agent-proxy]
+          (.auth c username (auth-methods agent-proxy))
           true)
         (catch UserAuthException e
           false))
@@ -104,71 +129,249 @@
      (catch ConnectionException   e# (handle-error ~conn ~context e#))
      (catch OpenFailException     e# (handle-error ~conn ~context e#))))
 
+(defn acquire-channel!
+  "Acquires a connection's semaphore permit for a new session channel. Every
+  channel we hold open, whether running a command, streaming, or idling in
+  the shell pool, holds a permit, so that together they stay under the
+  server's MaxSessions. If no permit is free, closes idle shells to free
+  theirs."
+  [^Semaphore semaphore ^ConcurrentLinkedQueue shells]
+  (loop []
+    (when-not (.tryAcquire semaphore 10 TimeUnit/MILLISECONDS)
+      (when-let [ch (and shells (.poll shells))]
+        (framed/close! ch))
+      (recur))))
+
+(defn session-stream!
+  "Opens a stream map, as for jepsen.control.core/open-stream!, for an action
+  on a fresh session channel, for which the caller holds a semaphore permit.
+  Releases the permit when the stream closes, or if it can't be opened."
+  [^SSHClient client ^Semaphore semaphore action]
+  (let [released (atom false)
+        release  (fn []
+                   (when (compare-and-set! released false true)
+                     (.release semaphore)))]
+    (try
+      (let [session (.startSession client)
+            cmd     (.exec session (:cmd action))]
+        {:stdin   (.getOutputStream cmd)
+         :stdout  (.getInputStream cmd)
+         :close   (fn close []
+                    (try (.close cmd)
+                         (.close session)
+                         (finally (release))))})
+      (catch Throwable t
+        (release)
+        (throw t)))))
+
+(defn execute-shell!
+  "Executes an action on one of a remote's idle persistent shells, opening a
+  new one if none are free and the remote's semaphore has a permit to spare,
+  and otherwise waiting for a shell to come free. Shells keep their permits
+  while idle."
+  [remote action]
+  (let [^Semaphore semaphore         (:semaphore remote)
+        ^ConcurrentLinkedQueue shells (:shells remote)
+        t0                            (System/nanoTime)
+        ch (loop []
+             (or (.poll shells)
+                 (when (.tryAcquire semaphore 10 TimeUnit/MILLISECONDS)
+                   (let [{:keys [stdin stdout close]}
+                         (session-stream!
+                           (:client remote) semaphore
+                           {:cmd (str "bash -c "
+                                      (core/escape framed/script))})]
+                     (framed/channel stdout stdin close)))
+                 (recur)))
+        ; How long did we wait for a shell? See jepsen.control.profile.
+        queue-time (- (System/nanoTime) t0)]
+    (try (-> (framed/execute! ch action)
+             (assoc :queue-time queue-time))
+         (finally
+           (if (framed/open? ch)
+             (.offer shells ch)
+             (framed/close! ch))))))
+
+(defn execute-exec!
+  "Executes an action on a fresh session channel."
+  [^SSHClient client action]
+  (with-open [session (.startSession client)]
+    (let [cmd (.exec session (:cmd action))
+          ; Feed it input
+          _ (when-let [input (:in action)]
+              (let [stream (.getOutputStream cmd)]
+                (bs/transfer input stream)
+                (send-eof! client session)
+                (.close stream)))
+          ; Read output
+          out (.toString (IOUtils/readFully (.getInputStream cmd)))
+          err (.toString (IOUtils/readFully (.getErrorStream cmd)))
+          ; Wait on command
+          _ (.join cmd)]
+      ; Return completion
+      (assoc action
+             :out   out
+             :err   err
+             ; There's also a .getExitErrorMessage that might be
+             ; interesting here?
+             :exit  (.getExitStatus cmd)))))
+
+(defn open-client
+  "Opens and authenticates an SSHClient for a conn spec, recording how long
+  authentication took in jepsen.control.profile."
+  [conn-spec]
+  (try+ (let [c     (doto (SSHClient.)
+                      (.loadKnownHosts)
+                      (.connect (:host conn-spec) (:port conn-spec)))
+              start (System/nanoTime)]
+          (auth! c conn-spec)
+          (profile/record! :auth (:host conn-spec) "auth" start nil nil)
+          c)
+        (catch Exception e
+          ; SSHJ wraps InterruptedException in its own exceptions, so we
+          ; have to see through that and rethrow properly.
+          (let [cause (util/ex-root-cause e)]
+            (when (instance? InterruptedException cause)
+              (throw cause)))
+          (throw+ (assoc conn-spec
+                         :type    :jepsen.control/session-error
+                         :message "Error opening SSH session. Verify username, password, and node hostnames are correct.")))))
+
+(defn open-conn
+  "Opens a connection: a map of an authenticated :client, a :semaphore bounding
+  open channels (see acquire-channel!), and a pool of idle :shells."
+  [concurrency-limit conn-spec]
+  {:client    (open-client conn-spec)
+   :semaphore (Semaphore. concurrency-limit true)
+   :shells    (ConcurrentLinkedQueue.)})
+
+(defn close-conn!
+  "Closes a connection's shells and client."
+  [{:keys [^SSHClient client shells]}]
+  (when shells
+    (framed/close-pool! shells))
+  (when client
+    (.close client)))
+
+(defonce shared-conns
+  ; Like OpenSSH's ControlMaster: when connections are shared, every session
+  ; to the same [host port username] multiplexes channels over a single
+  ; connection. Map of those keys to {:refs n, :conn (delay conn)}.
+  (atom {}))
+
+(defn conn-key
+  [conn-spec]
+  [(:host conn-spec) (:port conn-spec) (:username conn-spec)])
+
+(defn acquire-shared-conn!
+  "Returns a shared connection for a conn spec, opening one if there isn't a
+  live one already, and incrementing its reference count."
+  [concurrency-limit conn-spec]
+  (let [k     (conn-key conn-spec)
+        fresh (fn [] {:refs 1
+                      :conn (delay (open-conn concurrency-limit conn-spec))})
+        live? (fn [e]
+                (let [d (:conn e)]
+                  (or (not (realized? d))
+                      (try (.isConnected ^SSHClient (:client @d))
+                           (catch Throwable _ false)))))
+        e     (-> (swap! shared-conns
+                         (fn [conns]
+                           (let [e (get conns k)]
+                             (if (and e (live? e))
+                               (update-in conns [k :refs] inc)
+                               (assoc conns k (fresh))))))
+                  (get k))]
+    (try @(:conn e)
+         (catch Throwable t
+           (swap! shared-conns
+                  (fn [conns]
+                    (if (identical? (:conn e) (get-in conns [k :conn]))
+                      (dissoc conns k)
+                      conns)))
+           (throw t)))))
+
+(defn release-shared-conn!
+  "Decrements a shared connection's reference count, closing it when nobody
+  uses it any more. Releasing a connection which has since been replaced
+  closes it, since nobody else will."
+  [conn-spec conn]
+  (let [k       (conn-key conn-spec)
+        mine?   (fn [e]
+                  (and e
+                       (realized? (:conn e))
+                       (identical? (:client conn) (:client @(:conn e)))))
+        [old _] (swap-vals! shared-conns
+                            (fn [conns]
+                              (let [e (get conns k)]
+                                (cond (not (mine? e))   conns
+                                      (<= (:refs e) 1)  (dissoc conns k)
+                                      true              (update-in
+                                                          conns [k :refs]
+                                                          dec)))))
+        e       (get old k)]
+    (when (or (not (mine? e))
+              (<= (:refs e) 1))
+      (close-conn! conn))))
+
 (defrecord SSHJRemote [concurrency-limit
+                       persistent-shell?
+                       share-connections?
                        conn-spec
                        ^SSHClient client
-                       ^Semaphore semaphore]
+                       ^Semaphore semaphore
+                       ^ConcurrentLinkedQueue shells]
   core/Remote
   (connect [this conn-spec]
-    (try+ (let [c (doto (SSHClient.)
-                    (.loadKnownHosts)
-                    (.connect (:host conn-spec) (:port conn-spec))
-                    (auth! conn-spec))]
-            (assoc this
-                   :conn-spec conn-spec
-                   :client c
-                   :semaphore (Semaphore. concurrency-limit true)))
-          (catch Exception e
-            ; SSHJ wraps InterruptedException in its own exceptions, so we
-            ; have to see through that and rethrow properly.
-            (let [cause (util/ex-root-cause e)]
-              (when (instance? InterruptedException cause)
-                (throw cause)))
-            (throw+ (assoc conn-spec
-                           :type    :jepsen.control/session-error
-                           :message "Error opening SSH session. Verify username, password, and node hostnames are correct.")))))
+    (let [conn (if share-connections?
+                 (acquire-shared-conn! concurrency-limit conn-spec)
+                 (open-conn concurrency-limit conn-spec))]
+      (merge (assoc this :conn-spec conn-spec) conn)))
 
   (disconnect! [this]
-    (when-let [c client]
-      (.close c)))
+    (let [conn {:client client, :semaphore semaphore, :shells shells}]
+      (if share-connections?
+        (release-shared-conn! conn-spec conn)
+        (close-conn! conn))))
 
   (execute! [this ctx action]
     ;  (info :permits (.availablePermits semaphore))
-    (.acquire semaphore)
     (with-errors conn-spec ctx
+      (if persistent-shell?
+        (execute-shell! this action)
+        (let [t0 (System/nanoTime)]
+          (acquire-channel! semaphore shells)
+          ; How long did we wait for a channel? See jepsen.control.profile.
+          (let [queue-time (- (System/nanoTime) t0)]
+            (try
+              (-> (execute-exec! client action)
+                  (assoc :queue-time queue-time))
+              (finally
+                (.release semaphore))))))))
+
+  (upload! [this ctx local-paths remote-path _opts]
+    (with-errors conn-spec ctx
+      (acquire-channel! semaphore shells)
       (try
-        (with-open [session (.startSession client)]
-          (let [cmd (.exec session (:cmd action))
-                ; Feed it input
-                _ (when-let [input (:in action)]
-                    (let [stream (.getOutputStream cmd)]
-                      (bs/transfer input stream)
-                      (send-eof! client session)
-                      (.close stream)))
-                ; Read output
-                out (.toString (IOUtils/readFully (.getInputStream cmd)))
-                err (.toString (IOUtils/readFully (.getErrorStream cmd)))
-                ; Wait on command
-                _ (.join cmd)]
-            ; Return completion
-            (assoc action
-                   :out   out
-                   :err   err
-                   ; There's also a .getExitErrorMessage that might be
-                   ; interesting here?
-                   :exit  (.getExitStatus cmd))))
+        (with-open [sftp (.newSFTPClient client)]
+          (.put sftp (FileSystemFile. local-paths) remote-path))
         (finally
           (.release semaphore)))))
 
-  (upload! [this ctx local-paths remote-path _opts]
+  (download! [this ctx remote-paths local-path _opts]
     (with-errors conn-spec ctx
-      (with-open [sftp (.newSFTPClient client)]
-        (.put sftp (FileSystemFile. local-paths) remote-path))))
+      (acquire-channel! semaphore shells)
+      (try
+        (with-open [sftp (.newSFTPClient client)]
+          (.get sftp remote-paths (FileSystemFile. local-path)))
+        (finally
+          (.release semaphore)))))
 
-  (download! [this ctx remote-paths local-path _opts]
+  core/Streams
+  (open-stream! [this ctx action]
     (with-errors conn-spec ctx
-      (with-open [sftp (.newSFTPClient client)]
-        (.get sftp remote-paths (FileSystemFile. local-path))))))
+      (acquire-channel! semaphore shells)
+      (session-stream! client semaphore action))))
 
 (def concurrency-limit
   "OpenSSH has a standard limit of 10 concurrent channels per connection.
@@ -178,10 +381,35 @@
   by running jepsen.control-test's integration test... <sigh>"
   6)
 
+(defn raw-remote
+  "Constructs a bare SSHJ remote, without the SCP and retry wrappers that
+  `remote` provides. Useful as a building block for other remotes, since it
+  supports jepsen.control.core/Streams. Takes options as for `remote`."
+  [opts]
+  (SSHJRemote. concurrency-limit
+               (boolean (:persistent-shell? opts))
+               (boolean (:share-connections? opts))
+               nil nil nil nil))
+
 (defn remote
-  "Constructs an SSHJ remote."
-  []
-  (-> (SSHJRemote. concurrency-limit nil nil nil)
-      ; We *can* use our own SCP, but shelling out is faster.
-      scp/remote
-      retry/remote))
+  "Constructs an SSHJ remote. Options:
+
+    :persistent-shell?  If true, rather than opening a new channel and shell
+                        for every command, keeps a few long-lived shells open
+                        per node and runs commands over them using
+                        jepsen.control.framed. Much faster for setup code
+                        which runs hundreds of short commands, especially over
+                        high-latency links.
+
+    :share-connections? If true, sessions to the same host, port, and user
+                        share a single SSH connection, like OpenSSH's
+                        ControlMaster. Reconnects after errors then reuse the
+                        live connection rather than paying for a fresh
+                        handshake."
+  ([]
+   (remote {}))
+  ([opts]
+   (-> (raw-remote opts)
+       ; We *can* use our own SCP, but shelling out is faster.
+       scp/remote
+       retry/remote)))
@@ -223,9 +223,8 @@
          dest       (expand-path dest)]
 
      ; Clean up old dest and make sure parent directory is ready
-     (exec :rm :-rf dest)
-     (let [parent (exec :dirname dest)]
-       (exec :mkdir :-p parent))
+     (exec-batch [[:rm :-rf dest]
+                  [:mkdir :-p (.getParent (java.io.File. ^String dest))]])
 
      (try+
        (cd tmpdir
@@ -274,6 +273,187 @@
          (exec :rm :-rf tmpdir))))
    dest))
 
+(def archive-compression
+  "How can we compress archives for download? Maps names to a remote
+  compression command, and the flags local tar needs to decompress it."
+  {:gzip  ["gzip -1"          ["-z"]]
+   :zstd  ["zstd -1 -T0 -q -c" ["--zstd"]]
+   :none  ["cat"              []]})
+
+(defn archive-script
+  "Builds a shell command which writes a compressed tar archive of the given
+  absolute remote paths to stdout, named relative to /. With
+  :max-file-bytes, files are truncated to their last max-file-bytes bytes,
+  which means staging copies in a temporary directory first."
+  [paths {:keys [compression max-file-bytes] :or {compression :gzip}}]
+  (let [[compress _] (or (archive-compression compression)
+                         (throw (IllegalArgumentException.
+                                  (str "Unknown compression "
+                                       (pr-str compression)))))
+        rel      (map #(str/replace % #"^/+" "") paths)
+        tar      (str "tar --ignore-failed-read --warning=no-file-changed "
+                      "-cf - ")]
+    (if max-file-bytes
+      (str "mkdir -p " tmp-dir-base " && "
+           "d=$(mktemp -d " tmp-dir-base "/archive.XXXXXX) || exit 1; "
+           "trap 'rm -rf \"$d\"' EXIT; "
+           "for p in " (escape rel) "; do "
+           "find \"/$p\" -type f 2>/dev/null | while IFS= read -r f; do "
+           "mkdir -p \"$d$(dirname \"$f\")\" && "
+           "tail -c " (long max-file-bytes) " \"$f\" > \"$d$f\"; "
+           "done; done; "
+           "cd \"$d\" && " tar (escape rel) " 2>/dev/null | " compress)
+      (str "cd / && " tar (escape rel) " 2>/dev/null | " compress))))
+
+(defn status-script
+  "Wraps an archive script so that bash records the exit statuses of its final
+  pipeline--tar's, then the compressor's--in a status file."
+  [script status-file]
+  (str "bash -c "
+       (escape (str script "; echo \"${PIPESTATUS[@]}\" > "
+                    (escape status-file)))))
+
+(defn archive-ok?
+  "Takes the contents of a status file written by status-script, and returns
+  true iff the archive is complete. tar exits 1 when files change as it reads
+  them, which is fine for logs; 2 is fatal. A script which bailed out early
+  leaves one status, or none."
+  [status]
+  (let [[tar & more :as codes] (->> (str/split (str/trim status) #"\s+")
+                                    (remove str/blank?)
+                                    (map util/parse-long))]
+    (boolean (and (seq more)
+                  (<= 0 tar 1)
+                  (every? zero? more)))))
+
+(defn copy-counting!
+  "Copies an InputStream to an OutputStream, closing the output when done.
+  Returns the number of bytes copied."
+  [^java.io.InputStream in ^java.io.OutputStream out]
+  (let [buf (byte-array 65536)]
+    (try
+      (loop [n 0]
+        (let [r (.read in buf)]
+          (if (neg? r)
+            n
+            (do (.write out buf 0 r)
+                (recur (+ n r))))))
+      (finally
+        (.close out)))))
+
+(defn extract-stream!
+  "Extracts a compressed tar stream into a local directory, returning the
+  number of (compressed) bytes read."
+  [in local-dir compression strip]
+  (let [[_ flags] (archive-compression compression)
+        p (-> (ProcessBuilder. ^java.util.List
+                               (concat ["tar" "-x"] flags
+                                       ["-C" (str local-dir)
+                                        (str "--strip-components=" strip)
+                                        "-f" "-"]))
+              (.redirectErrorStream true)
+              .start)
+        n (copy-counting! in (.getOutputStream p))
+        out (slurp (.getInputStream p))]
+    (when-not (zero? (.waitFor p))
+      (throw+ {:type    ::extract-failed
+               :host    *host*
+               :dir     (str local-dir)
+               :message out}))
+    n))
+
+(defn stream-archive!
+  "Streams one archive of paths from the current node into local-dir. Uses
+  the remote's Streams support if it has it; otherwise writes the archive to
+  a temporary file on the node and downloads that. Returns compressed bytes
+  transferred."
+  [paths local-dir {:keys [compression strip-components]
+                    :or {compression :gzip, strip-components 0}
+                    :as opts}]
+  (let [status (tmp-file!)
+        script (status-script (archive-script paths opts) status)
+        check! (fn [n]
+                 (let [s (exec :cat status)]
+                   (when-not (archive-ok? s)
+                     (throw+ {:type    ::archive-failed
+                              :host    *host*
+                              :paths   paths
+                              :status  s
+                              :message (str "Archiving " (pr-str paths)
+                                            " failed with exit statuses "
+                                            (pr-str s))}))
+                   n))]
+    (try
+      (try+
+        (let [action (wrap-sudo {:cmd script})
+              {:keys [^java.io.OutputStream stdin stdout close]}
+              (core/open-stream! *session* (cmd-context) action)]
+          (try
+            ; wrap-sudo may have given us a sudo password to send
+            (when-let [in (:in action)]
+              (.write stdin (.getBytes ^String in "UTF-8"))
+              (.flush stdin))
+            (.close stdin)
+            ; bash holds stdout open until it exits, so by the time the
+            ; stream ends, the status file is written.
+            (check! (extract-stream! stdout local-dir compression
+                                     strip-components))
+            (finally (close))))
+        (catch [:type :jepsen.control/streams-unsupported] _
+          (let [remote (tmp-file!)
+                local  (java.io.File/createTempFile "jepsen-archive" ".tar")]
+            (try
+              (exec* (str script " > " (escape remote)))
+              (download remote (.getCanonicalPath local))
+              (with-open [in (java.io.FileInputStream. local)]
+                (check! (extract-stream! in local-dir compression
+                                         strip-components)))
+              (finally
+                (.delete local)
+                (exec :rm :-f remote))))))
+      (finally
+        (exec :rm :-f status)))))
+
+(defn stream-download!
+  "Downloads remote files and directories from the current node into a local
+  directory by streaming a compressed tar archive, rather than copying files
+  one at a time. Remote paths are expanded relative to the current directory,
+  and arrive under local-dir at their full path, minus :strip-components
+  leading directories. Options:
+
+    :compression      :gzip (default), :zstd, or :none. zstd needs zstd on
+                      the node and a tar with --zstd locally.
+    :max-file-bytes   Keep only the last n bytes of larger files: handy for
+                      huge logs.
+    :streams          Split paths across this many concurrent streams.
+                      Default 1.
+    :strip-components Drop this many leading path components locally.
+
+  Logs and returns a map of :bytes (compressed), :time (seconds), and
+  :throughput (bytes/sec)."
+  ([remote-paths local-dir]
+   (stream-download! remote-paths local-dir {}))
+  ([remote-paths local-dir opts]
+   (let [paths  (map expand-path (util/coll remote-paths))
+         groups (->> paths
+                     (map-indexed vector)
+                     (group-by #(mod (first %) (:streams opts 1)))
+                     vals
+                     (map (partial map second)))
+         start  (System/nanoTime)
+         _      (.mkdirs (file local-dir))
+         bytes  (->> groups
+                     (util/real-pmap (bound-fn [ps]
+                                       (stream-archive! ps local-dir opts)))
+                     (reduce + 0))
+         secs   (util/nanos->secs (- (System/nanoTime) start))
+         res    {:bytes      bytes
+                 :time       secs
+                 :throughput (if (pos? secs) (/ bytes secs) 0)}]
+     (info (format "Downloaded %.1f MB from %s in %.1f s (%.1f MB/s)"
+                   (/ bytes 1e6) *host* secs (/ (:throughput res) 1e6)))
+     res)))
+
 (defn ensure-user!
   "Make sure a user exists."
   [username]
@@ -326,23 +506,25 @@
   [opts bin & args]
   (let [env (env (:env opts))]
     (info "Starting" (.getName (file (name bin))))
-    (exec :echo (lit "`date +'%Y-%m-%d %H:%M:%S'`")
-          (str "Jepsen starting " (escape env) " " bin " " (escape args))
-          :>> (:logfile opts))
-    (apply exec
-           env
-           :start-stop-daemon :--start
-           (when (:background? opts true) [:--background :--no-close])
-           (when (:make-pidfile? opts true) :--make-pidfile)
-           (when (:match-executable? opts true) [:--exec bin])
-           (when (:match-process-name? opts false)
-             [:--name (:process-name opts (.getName (file bin)))])
-           :--pidfile  (:pidfile opts)
-           :--chdir    (:chdir opts)
-           :--oknodo
-           :--startas  bin
-           :--
-           (concat args [:>> (:logfile opts) (lit "2>&1")]))))
+    (-> (exec-batch
+          [[:echo (lit "`date +'%Y-%m-%d %H:%M:%S'`")
+            (str "Jepsen starting " (escape env) " " bin " " (escape args))
+            :>> (:logfile opts)]
+           [env
+            :start-stop-daemon :--start
+            (when (:background? opts true) [:--background :--no-close])
+            (when (:make-pidfile? opts true) :--make-pidfile)
+            (when (:match-executable? opts true) [:--exec bin])
+            (when (:match-process-name? opts false)
+              [:--name (:process-name opts (.getName (file bin)))])
+            :--pidfile  (:pidfile opts)
+            :--chdir    (:chdir opts)
+            :--oknodo
+            :--startas  bin
+            :--
+            (concat args [:>> (:logfile opts) (lit "2>&1")])]])
+        peek
+        :out)))
 
 (defn stop-daemon!
   "Kills a daemon process by pidfile, or, if given a command name, kills all
@@ -351,13 +533,15 @@
    (when (exists? pidfile)
      (info "Stopping" pidfile)
      (let [pid (Long/parseLong (exec :cat pidfile))]
-       (meh (exec :kill :-9 pid))
-       (meh (exec :rm :-rf pidfile)))))
+       (meh (exec-batch {:on-error :ignore}
+                        [[:kill :-9 pid]
+                         [:rm :-rf pidfile]])))))
 
   ([cmd pidfile]
    (info "Stopping" cmd)
-   (meh (exec :killall :-9 :-w cmd))
-   (meh (exec :rm :-rf pidfile))))
+   (meh (exec-batch {:on-error :ignore}
+                    [[:killall :-9 :-w cmd]
+                     [:rm :-rf pidfile]]))))
 
 (defn daemon-running?
   "Given a pidfile, returns true if the pidfile is present and the process it
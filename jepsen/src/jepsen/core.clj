@@ -35,6 +35,7 @@
             [jepsen.nemesis :as nemesis]
             [jepsen.store :as store]
             [jepsen.control.util :as cu]
+            [jepsen.control.profile :as control.profile]
             [jepsen.generator [interpreter :as gen.interpreter]]
             [slingshot.slingshot :refer [try+ throw+]])
   (:import (java.util.concurrent CyclicBarrier
@@ -115,24 +116,36 @@
                                 util/drop-common-proper-prefix
                                 (map (partial str/join "/"))
                                 (zipmap full-paths))]
-            (doseq [[remote local] paths]
-              (when (cu/exists? remote)
-                (info "downloading" remote "to" local)
-                (try
-                  (control/download
-                    remote
-                    (.getCanonicalPath
-                      (store/path! test (name node)
-                                   ; strip leading /
-                                   (str/replace local #"^/" ""))))
-                  (catch java.io.IOException e
-                    (if (= "Pipe closed" (.getMessage e))
-                      (info remote "pipe closed")
-                      (throw e)))
-                  (catch java.lang.IllegalArgumentException e
-                    ; This is a jsch bug where the file is just being
-                    ; created
-                    (info remote "doesn't exist")))))))))
+            (if-let [archive-opts (:log-archive test)]
+              ; Stream everything in one compressed archive, stripping the
+              ; same common prefix as the short paths above.
+              (when (seq full-paths)
+                (let [[full short] (first paths)
+                      dropped (- (count (str/split full #"/"))
+                                 (count (str/split short #"/")))]
+                  (cu/stream-download!
+                    full-paths
+                    (store/path! test (name node))
+                    (assoc archive-opts
+                           :strip-components (max 0 (dec dropped))))))
+              (doseq [[remote local] paths]
+                (when (cu/exists? remote)
+                  (info "downloading" remote "to" local)
+                  (try
+                    (control/download
+                      remote
+                      (.getCanonicalPath
+                        (store/path! test (name node)
+                                     ; strip leading /
+                                     (str/replace local #"^/" ""))))
+                    (catch java.io.IOException e
+                      (if (= "Pipe closed" (.getMessage e))
+                        (info remote "pipe closed")
+                        (throw e)))
+                    (catch java.lang.IllegalArgumentException e
+                      ; This is a jsch bug where the file is just being
+                      ; created
+                      (info remote "doesn't exist"))))))))))
     (store/update-symlinks! test)))
 
 (defn maybe-snarf-logs!
@@ -230,7 +243,11 @@
         test (assoc test :results (checker/check-safe
                                    (:checker test)
                                    test
-                                   (:history test)))]
+                                   (:history test)))
+        ; Fold in the control profile, if we have one
+        test (if-let [p (:control-profile test)]
+               (assoc-in test [:results :control-profile] p)
+               test)]
     (info "Analysis complete")
     (when (:name test) (store/save-2! test))
     test))
@@ -279,12 +296,14 @@
   the binding expression, and evaluates body."
   [[test' test] & body]
   `(let [test# ~test]
+     (control.profile/reset!)
      (control/with-remote (:remote test#)
        (control/with-ssh (:ssh test#)
          (with-resources [sessions#
                           (bound-fn* control/session)
                           control/disconnect
                           (:nodes test#)]
+           (control.profile/log-sessions!)
            ; Index sessions by node name and add to test
            (let [~test' (->> sessions#
                              (map vector (:nodes test#))
@@ -346,6 +365,10 @@
   :checker    Verifies that the history is valid
   :log-files  A list of paths to logfiles/dirs which should be captured at
               the end of the test.
+  :log-archive  If present, a map of options for
+                jepsen.control.util/stream-download!. Log files are then
+                downloaded as a single compressed tar stream per node, rather
+                than one file at a time.
   :nonserializable-keys   A collection of top-level keys in the test which
                           shouldn't be serialized to disk.
   :leave-db-running? Whether to leave the DB running at the end of the test.
@@ -390,7 +413,8 @@
                                         (-> test
                                             (assoc :history (run-case! test))
                                             ; Remove state
-                                            (dissoc :barrier :sessions)))))]
+                                            (dissoc :barrier :sessions)))))
+                             test (control.profile/save! test)]
                          (info "Run complete, writing")
                          (when (:name test) (store/save-1! test))
                          (analyze! test)))]
@@ -49,7 +49,8 @@
             [clojure.tools.logging :refer [info warn]]
             [fipp.edn :refer [pprint]]
             [jepsen [control :as c]
-                    [util :as util]])
+                    [util :as util]]
+            [jepsen.control.cas :as cas])
   (:import (java.io File)))
 
 ;; Where do we store files, and how do we encode paths?
@@ -222,19 +223,20 @@
 
 (defn deploy-remote!
   "Deploys a cached path to the given remote path (a string). Deletes remote
-  path first. Creates parents if necessary."
-  [cache-path remote-path]
-  (when-not (cached? cache-path)
-    (throw (IllegalStateException. (str "Path " (pr-str cache-path) " is not cached and cannot be deployed."))))
-  (when-not (re-find #"/\w+/.+" remote-path)
-    (throw (IllegalArgumentException.
-             (str "You asked to deploy to a remote path " (pr-str remote-path)
-                  " which looks relative or suspiciously short--this might be dangerous!"))))
-
-  (c/exec :rm :-rf remote-path)
-  (let [parent (.getParent (io/file remote-path))]
-    (c/exec :mkdir :-p parent)
-    (c/upload (.getCanonicalPath (file cache-path)) remote-path)))
+  path first. Creates parents if necessary. Nodes keep a content-addressed
+  store of deployed files (see jepsen.control.cas), so we only upload a cached
+  file to a node once. Options are as for jepsen.control.cas/deploy!."
+  ([cache-path remote-path]
+   (deploy-remote! cache-path remote-path {}))
+  ([cache-path remote-path opts]
+   (when-not (cached? cache-path)
+     (throw (IllegalStateException. (str "Path " (pr-str cache-path) " is not cached and cannot be deployed."))))
+   (when-not (re-find #"/\w+/.+" remote-path)
+     (throw (IllegalArgumentException.
+              (str "You asked to deploy to a remote path " (pr-str remote-path)
+                   " which looks relative or suspiciously short--this might be dangerous!"))))
+
+   (cas/deploy! (.getCanonicalPath (file cache-path)) remote-path opts)))
 
 ;; Locks
 
@@ -131,6 +131,20 @@
             {}
             components)))
 
+(defn one-way-grudge
+  "Takes two collections of nodes, `from` and `to`, and returns a directed
+  grudge (see jepsen.net/directed-grudge) which drops traffic from every node
+  in `from` to every node in `to`, while traffic from `to` to `from` flows
+  freely. By default, packets are dropped as they arrive at `to` (:input);
+  with :output, they're dropped as they leave `from`, so senders see errors
+  rather than silence."
+  ([from to]
+   (one-way-grudge :input from to))
+  ([direction from to]
+   (case direction
+     :input  (zipmap to   (repeat {:input  (set from)}))
+     :output (zipmap from (repeat {:output (set to)})))))
+
 (defn invert-grudge
   "Takes a universe of nodes and a map of nodes to nodes they should be
   connected to, and returns a map of nodes to nodes they should NOT be
@@ -154,11 +168,29 @@
         ; Nobody hates the bridge
         (->> (util/map-vals #(disj % bridge))))))
 
+(defn with-commit-times
+  "If a net reported when its changes took effect on each node (see
+  jepsen.net/commit-times), adds them to op as :commit-times."
+  [op result]
+  (if-let [times (net/commit-times result)]
+    (assoc op :commit-times times)
+    op))
+
 (defn partitioner
   "Responds to a :start operation by cutting network links as defined by
   (grudge nodes), and responds to :stop by healing the network. The grudge to
   apply is either taken from the :value of a :start op, or if that is nil, by
-  calling (grudge (:nodes test))"
+  calling (grudge (:nodes test)). When the test's net reports commit times,
+  as jepsen.net.nftables does, completions carry them in :commit-times.
+
+  Nets which support jepsen.net.proto/Flap can also flap a partition, with an
+  op like:
+
+    {:f :flap, :value {:grudge grudge, :period 10, :duty 0.5, :duration 5}}
+
+  This cuts the network according to the grudge every :period ms, for
+  :duty * :period ms each time, over :duration seconds, then leaves the network
+  healed. The completion's :flaps has each node's results."
   ([] (partitioner nil))
   ([grudge]
    (reify Nemesis
@@ -174,10 +206,17 @@
                                    (throw (IllegalArgumentException.
                                             (str "Expected op " (pr-str op)
                                                  " to have a grudge for a :value, but none given.")))))]
-                  (net/drop-all! test grudge)
-                  (assoc op :value [:isolated grudge]))
-         :stop  (do (net/heal! (:net test) test)
-                    (assoc op :value :network-healed))))
+                  (-> op
+                      (assoc :value [:isolated grudge])
+                      (with-commit-times (net/drop-all! test grudge))))
+         :stop  (-> op
+                    (assoc :value :network-healed)
+                    (with-commit-times (net/heal! (:net test) test)))
+         :flap  (let [{:keys [grudge] :as v} (:value op)]
+                  (assoc op
+                         :value [:flapped grudge]
+                         :flaps (net/flap! test grudge
+                                           (dissoc v :grudge))))))
 
      (teardown! [this test]
        (net/heal! (:net test) test)))))
@@ -199,6 +238,31 @@
   []
   (partitioner (comp complete-grudge split-one)))
 
+(defn partition-one-way
+  "Splits the network into randomly chosen halves, and cuts traffic from the
+  first half to the second, but not from the second to the first. Options:
+
+    :direction  :input (the default) drops packets at their destinations;
+                :output drops them at their sources."
+  ([]
+   (partition-one-way {}))
+  ([opts]
+   (partitioner (fn [nodes]
+                  (let [[a b] (bisect (shuffle nodes))]
+                    (one-way-grudge (:direction opts :input) a b))))))
+
+(defn partition-one-way-node
+  "Picks a random node which can still send to every other node, but hears
+  nothing back from any of them: a node which thinks it's healthy. Options as
+  for partition-one-way."
+  ([]
+   (partition-one-way-node {}))
+  ([opts]
+   (partitioner (fn [nodes]
+                  (let [[[loner] others] (split-one nodes)]
+                    (one-way-grudge (:direction opts :input)
+                                    others [loner]))))))
+
 (defn majorities-ring-perfect
   "The perfect variant of majorities-ring, used for 5-node clusters."
   [nodes]
@@ -465,34 +529,49 @@
   skips the start. The return values from the start and stop fns will become
   the :values of the returned :info operations from the nemesis, e.g.:
 
-      {:value {:n1 [:killed \"java\"]}}"
-  [targeter start! stop!]
-  (let [nodes (atom nil)]
-    (reify Nemesis
-      (setup! [this test] this)
-
-      (invoke! [this test op]
-        (locking nodes
-          (assoc op :type :info, :value
-                 (case (:f op)
-                   :start (let [ns (:nodes test)
-                                ns (try (targeter test ns)
-                                        (catch clojure.lang.ArityException e
-                                          (targeter ns)))
-                                ns (util/coll ns)]
-                            (if ns
-                              (if (compare-and-set! nodes nil ns)
-                                (c/on-many ns (start! test c/*host*))
-                                (str "nemesis already disrupting "
-                                     (pr-str @nodes)))
-                              :no-target))
-                   :stop (if-let [ns @nodes]
-                           (let [value (c/on-many ns (stop! test c/*host*))]
-                             (reset! nodes nil)
-                             value)
-                           :not-started)))))
-
-      (teardown! [this test]))))
+      {:value {:n1 [:killed \"java\"]}}
+
+  Optionally takes a map of other :f values to functions `(f test node op)`,
+  for self-contained faults, like a burst of pauses, which begin and end in a
+  single op. These run on freshly targeted nodes, like start!, but only while
+  the nemesis isn't already disrupting nodes."
+  ([targeter start! stop!]
+   (node-start-stopper targeter start! stop! {}))
+  ([targeter start! stop! fs]
+   (let [nodes  (atom nil)
+         target (fn [test]
+                  (let [ns (:nodes test)]
+                    (util/coll (try (targeter test ns)
+                                    (catch clojure.lang.ArityException e
+                                      (targeter ns))))))]
+     (reify Nemesis
+       (setup! [this test] this)
+
+       (invoke! [this test op]
+         (locking nodes
+           (assoc op :type :info, :value
+                  (case (:f op)
+                    :start (let [ns (target test)]
+                             (if ns
+                               (if (compare-and-set! nodes nil ns)
+                                 (c/on-many ns (start! test c/*host*))
+                                 (str "nemesis already disrupting "
+                                      (pr-str @nodes)))
+                               :no-target))
+                    :stop (if-let [ns @nodes]
+                            (let [value (c/on-many ns (stop! test c/*host*))]
+                              (reset! nodes nil)
+                              value)
+                            :not-started)
+                    (let [f (get fs (:f op))]
+                      (assert f (str "Unexpected op " (pr-str op)))
+                      (if-let [ns @nodes]
+                        (str "nemesis already disrupting " (pr-str ns))
+                        (if-let [ns (target test)]
+                          (c/on-many ns (f test c/*host* op))
+                          :no-target)))))))
+
+       (teardown! [this test])))))
 
 (defn hammer-time
   "Responds to `{:f :start}` by pausing the given process name on a given node
@@ -518,7 +597,8 @@
                               :drop 64}}}
 
   where the value is a map of nodes to {:file, :drop} maps, on those nodes,
-  drops the last :drop bytes from the given file."
+  drops the last :drop bytes from the given file. For other kinds of damage,
+  or many files at once, see jepsen.nemesis.file."
   []
   (reify Nemesis
     (setup! [this test] this)
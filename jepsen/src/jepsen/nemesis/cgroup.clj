@@ -0,0 +1,412 @@
+(ns jepsen.nemesis.cgroup
+  "Controls DB processes through cgroup v2. Rather than signalling processes
+  one by one, as jepsen.nemesis/hammer-time does with killall, we move a
+  process and all of its descendants into a cgroup under
+  /sys/fs/cgroup/jepsen, and act on the group as a whole. Children forked
+  later land in the same group, and every thread goes along, so there's
+  nothing for a fault to miss or race with.
+
+  Freezing writes cgroup.freeze once, then waits for the kernel to report,
+  through cgroup.events, that every task has actually stopped. A small native
+  helper (resources/jepsen-freeze.c) does the write and the wait, so we can
+  report when the kernel observed the group frozen, rather than when we asked.
+
+  For pauses shorter than a round trip, strobe-pause! runs another helper
+  (resources/strobe-pause.c) which pauses and resumes a process over and over,
+  at millisecond granularity, by freezing its group or by signals.
+
+  Groups can also be starved of resources, to make slow nodes. Limits are maps
+  of:
+
+    :cpu      CPUs' worth of time per period, e.g. 0.5 (cpu.max)
+    :memory   Bytes of memory above which the kernel reclaims aggressively
+              and throttles allocations (memory.high)
+    :io       A map of :rbps, :wbps (bytes/sec), :riops, and :wiops (ops/sec)
+              for the disk behind :dev, a directory (io.max)
+
+  Needs a node with the unified (v2) cgroup hierarchy mounted at
+  /sys/fs/cgroup."
+  (:require [clojure.string :as str]
+            [clojure.tools.logging :refer [warn]]
+            [jepsen [control :as c]
+                    [nemesis :as n]
+                    [util :as util]]
+            [jepsen.control.util :as cu]
+            [jepsen.nemesis.time :as nt]
+            [slingshot.slingshot :refer [throw+ try+]]))
+
+(def root
+  "Where the cgroup v2 hierarchy lives."
+  "/sys/fs/cgroup")
+
+(def parent
+  "The cgroup we create groups under."
+  (str root "/jepsen"))
+
+(def freeze-bin
+  "The freeze helper, in jepsen.nemesis.time/dir."
+  "jepsen-freeze")
+
+(def strobe-bin
+  "The pause strober, in jepsen.nemesis.time/dir."
+  "strobe-pause")
+
+(def default-timeout
+  "How long we wait for the kernel to freeze or thaw a group, in ms."
+  10000)
+
+(defn path
+  "The directory of a named group."
+  [group]
+  (str parent "/" (name group)))
+
+(defn install!
+  "Compiles our helpers on the current node."
+  []
+  (nt/install-resources! [["jepsen-freeze.c" freeze-bin]
+                          ["strobe-pause.c" strobe-bin]]))
+
+(defn run-helper!
+  "Runs one of our helpers on the current node as root, with the given
+  arguments, and returns stdout. Installs helpers if they're missing."
+  [bin & args]
+  (let [run #(c/su (apply c/exec (str nt/dir "/" bin) args))]
+    (try+ (run)
+          (catch [:type :jepsen.control/nonzero-exit, :exit 127] _
+            (install!)
+            (run)))))
+
+(defn check-v2!
+  "Throws unless the current node has a cgroup v2 hierarchy at root."
+  []
+  (when-not (cu/exists? (str root "/cgroup.controllers"))
+    (throw+ {:type    ::cgroup-v2-required
+             :node    c/*host*
+             :message (str c/*host* " has no cgroup v2 hierarchy at " root)})))
+
+(defn create!
+  "Creates a group on the current node, if it doesn't exist. Returns its path."
+  [group]
+  (check-v2!)
+  (c/su (c/exec :mkdir :-p (path group)))
+  (path group))
+
+(defn process-tree
+  "Takes the output of `ps -e -o pid=,ppid=,comm=` and a process name, and
+  returns the pids of every process with that name, and all of their
+  descendants."
+  [ps process]
+  (let [procs    (->> (str/split-lines ps)
+                      (keep (fn [line]
+                              (let [[pid ppid comm] (-> line
+                                                        str/trim
+                                                        (str/split #"\s+" 3))]
+                                (when comm
+                                  {:pid  (util/parse-long pid)
+                                   :ppid (util/parse-long ppid)
+                                   :comm comm})))))
+        children (group-by :ppid procs)]
+    (loop [pids     []
+           frontier (->> procs
+                         (filter (comp #{process} :comm))
+                         (map :pid))]
+      (if-let [pid (first frontier)]
+        (recur (conj pids pid)
+               (concat (next frontier) (map :pid (children pid))))
+        (vec (distinct pids))))))
+
+(defn adopt!
+  "Moves every process with the given name, and all of their descendants,
+  into a group on the current node, creating it if necessary. Moving a process
+  moves all its threads. Returns the pids we moved."
+  [group process]
+  (create! group)
+  (let [procs (str (path group) "/cgroup.procs")
+        pids  (process-tree (c/exec :ps :-e :-o "pid=,ppid=,comm=") process)]
+    ; The kernel takes one pid per write. Processes may exit as we go.
+    (when (seq pids)
+      (c/su (c/exec-batch {:on-error :ignore}
+                          (for [pid pids]
+                            [:echo pid :>> procs]))))
+    pids))
+
+(defn parse-freeze
+  "Parses the freeze helper's output into {:requested nanos, :observed
+  nanos}, in wall-clock time."
+  [out]
+  (let [[requested observed] (str/split (str/trim out) #"\s+")]
+    {:requested (util/parse-long requested)
+     :observed  (util/parse-long observed)}))
+
+(defn set-frozen!
+  "Freezes or thaws a group on the current node, and waits for the kernel to
+  finish. Returns {:requested nanos, :observed nanos}: when we wrote
+  cgroup.freeze, and when the kernel reported the change, in wall-clock time."
+  ([group frozen?]
+   (set-frozen! group frozen? default-timeout))
+  ([group frozen? timeout-ms]
+   (parse-freeze
+     (run-helper! freeze-bin (path group) (if frozen? 1 0) timeout-ms))))
+
+(defn freeze!
+  "Freezes every task in a group on the current node. See set-frozen!."
+  [group]
+  (set-frozen! group true))
+
+(defn thaw!
+  "Thaws a group on the current node. See set-frozen!."
+  [group]
+  (set-frozen! group false))
+
+(def cpu-period
+  "The cpu.max period we use, in microseconds."
+  100000)
+
+(def io-keys
+  "The io.max keys we set."
+  [:rbps :wbps :riops :wiops])
+
+(defn io-line
+  "An io.max line for a \"major:minor\" block device. nil I/O limits are
+  lifted."
+  [block-dev io]
+  (->> io-keys
+       (map (fn [k]
+              (str (name k) "=" (if-let [v (get io k)] (long v) "max"))))
+       (cons block-dev)
+       (str/join " ")))
+
+(defn limit-files
+  "Takes limits and the \"major:minor\" numbers of the block devices to limit
+  I/O on, and returns a sequence of [file contents] writes to cgroup files.
+  io.max takes one device per write. nil limits are lifted."
+  [limits block-devs]
+  (concat
+    (when (contains? limits :cpu)
+      [["cpu.max" (if-let [cpu (:cpu limits)]
+                    (str (max 1000 (Math/round (* cpu cpu-period)))
+                         " " cpu-period)
+                    (str "max " cpu-period))]])
+
+    (when (contains? limits :memory)
+      [["memory.high" (if-let [m (:memory limits)]
+                        (str (long m))
+                        "max")]])
+
+    (when (contains? limits :io)
+      (for [dev block-devs]
+        ["io.max" (io-line dev (:io limits))]))))
+
+(defn lift-files
+  "Takes a map of cgroup files (cpu.max, memory.high, io.max) to their current
+  contents, or nil if missing, and returns the [file contents] writes which
+  lift whatever limits are in force, and nothing else."
+  [current]
+  (concat
+    (when-let [cpu (current "cpu.max")]
+      (when-not (str/starts-with? cpu "max")
+        [["cpu.max" (str "max " cpu-period)]]))
+
+    (when-let [m (current "memory.high")]
+      (when-not (= "max" (str/trim m))
+        [["memory.high" "max"]]))
+
+    (for [line (str/split-lines (current "io.max" ""))
+          :when (not (str/blank? line))]
+      ["io.max" (io-line (first (str/split line #" ")) {})])))
+
+(defn controllers
+  "The controllers, e.g. [\"cpu\"], which a map of limits needs."
+  [limits]
+  (filter (comp (set (keys limits)) keyword) ["cpu" "memory" "io"]))
+
+(defn enable-controllers!
+  "Delegates the controllers a map of limits needs to our groups on the
+  current node. We enable each separately, so that one the kernel lacks
+  doesn't stop the others; we log it, and writing its limits fails later."
+  [limits]
+  (c/su
+    (doseq [r (c/exec-batch {:on-error :ignore}
+                            (for [dir        [root parent]
+                                  controller (controllers limits)]
+                              [:echo (str "+" controller)
+                               :> (str dir "/cgroup.subtree_control")]))
+            :when (not (zero? (:exit r)))]
+      (warn "Couldn't enable cgroup controller:" (:cmd r) (:err r)))))
+
+(defn whole-disks
+  "Takes a \"major:minor\" block device number on the current node, and
+  returns the numbers of the whole disks under it: partitions resolve to
+  their disk, and device-mapper devices (LVM, crypt, ...) to the disks beneath
+  them."
+  [dev]
+  (let [sys    (c/exec :readlink :-f (str "/sys/dev/block/" dev))
+        slaves (when (cu/exists? (str sys "/slaves"))
+                 (remove str/blank?
+                         (str/split-lines (c/exec :ls (str sys "/slaves")))))]
+    (cond (seq slaves)
+          (->> slaves
+               (mapcat (fn [slave]
+                         (whole-disks
+                           (c/exec :cat (str sys "/slaves/" slave "/dev")))))
+               distinct)
+
+          (cu/exists? (str sys "/partition"))
+          [(c/exec :cat (str sys "/../dev"))]
+
+          true
+          [dev])))
+
+(defn block-devs
+  "The \"major:minor\" numbers of the whole disks behind a directory on the
+  current node, for io.max."
+  [dir]
+  (let [; btrfs subvolumes look like /dev/sda1[/@]
+        src (-> (c/exec :findmnt :-n :-o :SOURCE :--target dir)
+                str/trim
+                (str/replace #"\[.*\]$" ""))]
+    (when-not (str/starts-with? src "/dev/")
+      (throw+ {:type    ::no-block-device
+               :dir     dir
+               :source  src
+               :message (str dir " is on " src
+                             ", not a block device; can't limit its I/O")}))
+    (whole-disks (str/trim (c/exec :lsblk :-ndo "MAJ:MIN" src)))))
+
+(defn limit!
+  "Moves a process tree into a group on the current node, and applies limits
+  to the group. Limits only affect the keys present. Options:
+
+    :dev    A directory on the disk to limit I/O to. Defaults to /."
+  ([group process limits]
+   (limit! group process limits {}))
+  ([group process limits opts]
+   (adopt! group process)
+   (enable-controllers! limits)
+   (let [devs (when (contains? limits :io)
+                (block-devs (:dev opts "/")))]
+     (c/su
+       (c/exec-batch
+         (for [[file contents] (limit-files limits devs)]
+           [:echo contents :> (str (path group) "/" file)]))))
+   limits))
+
+(defn lift!
+  "Lifts whatever limits are in force on a group on the current node, leaving
+  alone controllers we never used."
+  [group]
+  (c/su
+    (let [dir     (path group)
+          current (->> ["cpu.max" "memory.high" "io.max"]
+                       (keep (fn [file]
+                               (let [f (str dir "/" file)]
+                                 (when (cu/exists? f)
+                                   [file (c/exec :cat f)]))))
+                       (into {}))
+          writes  (lift-files current)]
+      (when (seq writes)
+        (c/exec-batch
+          (for [[file contents] writes]
+            [:echo contents :> (str dir "/" file)]))))))
+
+(defn ramp-limits
+  "A sequence of steps limits, going geometrically from `from` (exclusive)
+  to `to` (inclusive). Both are limit maps; we ramp every number in `to`
+  which also has a value in `from`, and use the rest of `to` as is."
+  [from to steps]
+  (let [interp (fn interp [a b i]
+                 (cond (and (map? a) (map? b))
+                       (into b (for [[k v] b :when (contains? a k)]
+                                 [k (interp (get a k) v i)]))
+
+                       (and (number? a) (number? b) (pos? a))
+                       (* a (Math/pow (/ (double b) a)
+                                      (/ i (double steps))))
+
+                       true b))]
+    (for [i (range 1 (inc steps))]
+      (interp from to i))))
+
+(defn destroy!
+  "Thaws a group on the current node, moves its processes back to the root
+  group, and removes it. Does nothing if the group doesn't exist."
+  [group]
+  (let [dir (path group)]
+    (when (cu/exists? dir)
+      (thaw! group)
+      (let [pids (str/split-lines (c/su (c/exec :cat (str dir "/cgroup.procs"))))]
+        (c/su (c/exec-batch {:on-error :ignore}
+                            (concat
+                              (for [pid pids :when (seq pid)]
+                                [:echo pid :>> (str root "/cgroup.procs")])
+                              [[:rmdir dir]])))))))
+
+(defn parse-strobe
+  "Parses the strober's output into {:count pauses, :max-late-us n}."
+  [out]
+  (let [[n late] (str/split (str/trim out) #"\s+")]
+    {:count       (util/parse-long n)
+     :max-late-us (util/parse-long late)}))
+
+(defn strobe-pause!
+  "Pauses and resumes a process tree on the current node, over and over,
+  blocking until done. Options:
+
+    :period     How often to pause, in ms
+    :duty       The fraction of each period (0-1) to spend paused
+    :duration   How long to strobe for, in seconds
+    :mode       :freeze, to freeze and thaw the process's group, or :signal,
+                to send SIGSTOP and SIGCONT to each process. Defaults to
+                :freeze.
+
+  Returns the options, plus the number of pauses we achieved as :count, and
+  the latest any pause or resume began, relative to schedule, as
+  :max-late-us. In :signal mode, returns :no-target if the process isn't
+  running."
+  [process {:keys [period duty duration mode] :as opts :or {mode :freeze}}]
+  (let [; Ratios like 1/2 would reach the helper's atof as 1
+        schedule (map double [period duty duration])
+        res      (case mode
+                   :freeze (do (adopt! process process)
+                               (apply run-helper! strobe-bin
+                                      :-c (path process) schedule))
+                   :signal (let [ps   (c/exec :ps :-e :-o "pid=,ppid=,comm=")
+                                 pids (process-tree ps process)]
+                             (when (seq pids)
+                               (apply run-helper! strobe-bin :-p
+                                      (concat pids schedule)))))]
+    (if res
+      (merge opts (parse-strobe res))
+      :no-target)))
+
+(defn freezer
+  "Like jepsen.nemesis/hammer-time, but pauses the given process, and all its
+  descendants and threads, by freezing a cgroup. Responds to {:f :start} by
+  moving the process tree into a group named after the process and freezing
+  it, and to {:f :stop} by thawing it. Values look like:
+
+    {\"n1\" [:frozen \"java\" {:pids [123 456], :requested t, :observed t}]}
+
+  where times are wall-clock nanoseconds: when we asked the kernel to freeze
+  the group, and when it reported every task stopped. Picks nodes with
+  targeter, as for hammer-time.
+
+  Also responds to
+
+    {:f :strobe-pause, :value {:period 10, :duty 0.5, :duration 5}}
+
+  by strobing the process on freshly targeted nodes; see strobe-pause! for
+  options. The completion's value has each node's achieved :count of pauses."
+  ([process] (freezer rand-nth process))
+  ([targeter process]
+   (n/node-start-stopper targeter
+                         (fn start [t n]
+                           (let [pids (adopt! process process)]
+                             [:frozen process
+                              (assoc (freeze! process) :pids pids)]))
+                         (fn stop [t n]
+                           [:thawed process (thaw! process)])
+                         {:strobe-pause
+                          (fn strobe [t n op]
+                            [:strobed process
+                             (strobe-pause! process (:value op))])})))
@@ -22,7 +22,14 @@
                     [util :as util :refer [majority
                                            minority-third
                                            random-nonempty-subset]]]
-            [jepsen.nemesis.time :as nt]))
+            [jepsen.control.util :as cu]
+            [jepsen.nemesis [cgroup :as cgroup]
+                            [conntrack :as conntrack]
+                            [probe :as probe]
+                            [time :as nt]]
+            [jepsen.net.tc :as tc]
+            [slingshot.slingshot :refer [throw+]])
+  (:import (java.util Random)))
 
 (def default-interval
   "The default interval, in seconds, between nemesis operations."
@@ -35,6 +42,51 @@
    :nemesis         n/noop
    :perf            #{}})
 
+(defn rng
+  "A source of randomness for a package's generators. When opts has a :seed,
+  each package (named by k) gets its own Random, seeded from it, so a test run
+  with the same seed makes the same choices.
+
+  The interpreter may ask a generator for an op many times before it takes
+  one, so packages must not draw from their Random in a generator function;
+  instead, they draw ops into a lazy sequence, which only advances when an op
+  is actually emitted. See `rng-ops`."
+  ^Random [opts k]
+  (if-let [seed (:seed opts)]
+    (Random. (hash [seed k]))
+    (Random.)))
+
+(defn rng-nth
+  "Like rand-nth, but draws from a Random."
+  [^Random rng coll]
+  (nth coll (.nextInt rng (count coll))))
+
+(defn rng-double
+  "Like rand, but draws from a Random."
+  ([^Random rng]
+   (.nextDouble rng))
+  ([^Random rng n]
+   (* n (.nextDouble rng))))
+
+(defn rng-shuffle
+  "Like shuffle, but draws from a Random."
+  [^Random rng coll]
+  (let [l (java.util.ArrayList. ^java.util.Collection (vec coll))]
+    (java.util.Collections/shuffle l rng)
+    (vec l)))
+
+(defn rng-nonempty-subset
+  "Like jepsen.util/random-nonempty-subset, but draws from a Random."
+  [^Random rng coll]
+  (when (seq coll)
+    (take (inc (.nextInt rng (count coll))) (rng-shuffle rng coll))))
+
+(defn rng-ops
+  "A lazy, infinite sequence of ops made by calling (f rng). Usable as a
+  generator."
+  [^Random rng f]
+  (repeatedly #(f rng)))
+
 (defn db-nodes
   "Takes a test, a DB, and a node specification. Returns a collection of
   nodes taken from that test. node-spec may be one of:
@@ -47,18 +99,23 @@
      :primaries       - A random nonempty subset of nodes which we think are
                         primaries
      :all             - All nodes
-     [\"a\", ...]     - The specified nodes"
-  [test db node-spec]
-  (let [nodes (:nodes test)]
-    (case node-spec
-      nil         (random-nonempty-subset nodes)
-      :one        (list (rand-nth nodes))
-      :minority   (take (dec (majority (count nodes))) (shuffle nodes))
-      :majority   (take      (majority (count nodes))  (shuffle nodes))
-      :minority-third (take (minority-third (count nodes)) (shuffle nodes))
-      :primaries  (random-nonempty-subset (db/primaries db test))
-      :all        nodes
-      node-spec)))
+     [\"a\", ...]     - The specified nodes
+
+  Random choices are drawn from rng, if given."
+  ([test db node-spec]
+   (db-nodes (Random.) test db node-spec))
+  ([^Random rng test db node-spec]
+   (let [nodes (:nodes test)]
+     (case node-spec
+       nil         (rng-nonempty-subset rng nodes)
+       :one        (list (rng-nth rng nodes))
+       :minority   (take (dec (majority (count nodes))) (rng-shuffle rng nodes))
+       :majority   (take      (majority (count nodes))  (rng-shuffle rng nodes))
+       :minority-third (take (minority-third (count nodes))
+                             (rng-shuffle rng nodes))
+       :primaries  (rng-nonempty-subset rng (db/primaries db test))
+       :all        nodes
+       node-spec))))
 
 (defn node-specs
   "Returns all possible node specification for the given DB. Helpful when you
@@ -202,7 +259,7 @@
    (reify
      n/Reflection
      (fs [this]
-       [:start-partition :stop-partition])
+       [:start-partition :stop-partition :flap-partition])
 
      n/Nemesis
      (setup! [this test]
@@ -216,33 +273,70 @@
                                                          :f     :start
                                                          :value grudge)))
              ; Have the partitioner heal
-             :stop-partition (n/invoke! p test (assoc op :f :stop)))
+             :stop-partition (n/invoke! p test (assoc op :f :stop))
+             ; Flap a partition, computing the grudge from the target spec
+             :flap-partition (let [v      (:value op)
+                                   grudge (grudge test db (:target v))]
+                               (n/invoke! p test
+                                          (assoc op
+                                                 :f     :flap
+                                                 :value (-> v
+                                                            (dissoc :target)
+                                                            (assoc :grudge
+                                                                   grudge))))))
            ; Remap the :f to what the caller expects on the way back out
            (assoc :f (:f op))))
 
      (teardown! [this test]
        (n/teardown! p test)))))
 
+(defn flap-op
+  "A :flap-partition op over one of the given partition specs, drawn from rng.
+  Flaps every 1 ms to 1 second, spending 10-90% of each period partitioned, for
+  up to 32 seconds. flap-opts may override any of :period, :duty, and
+  :duration."
+  [^Random rng targets flap-opts]
+  {:type  :info
+   :f     :flap-partition
+   :value (merge {:target   (rng-nth rng targets)
+                  :period   (long (Math/pow 2 (rng-double rng 10)))
+                  :duty     (+ 0.1 (rng-double rng 0.8))
+                  :duration (rng-double rng 32)}
+                 (when (map? flap-opts)
+                   (select-keys flap-opts [:period :duty :duration])))})
+
 (defn partition-package
   "A nemesis and generator package for network partitions. Options as for
   nemesis-package."
   [opts]
   (let [needed? ((:faults opts) :partition)
         db      (:db opts)
+        rng     (rng opts :partition)
         targets (:targets (:partition opts) (partition-specs db))
-        start (fn start [_ _]
-                {:type  :info
-                 :f     :start-partition
-                 :value (rand-nth targets)})
+        flap    (:flap (:partition opts))
+        ; A flap ends by healing the network, so it can't overlap a standing
+        ; partition; it takes the place of a start instead.
+        start (rng-ops rng (fn [rng]
+                             (if (and flap (< (rng-double rng) 0.5))
+                               (flap-op rng targets flap)
+                               {:type  :info
+                                :f     :start-partition
+                                :value (rng-nth rng targets)})))
         stop  {:type :info, :f :stop-partition, :value nil}
         gen   (->> (gen/flip-flop start (repeat stop))
                    (gen/stagger (:interval opts default-interval)))]
     {:generator       (when needed? gen)
      :final-generator (when needed? stop)
-     :nemesis         (partition-nemesis db)
+     :nemesis         (let [{:keys [probe conntrack]} (:partition opts)]
+                        (cond-> (partition-nemesis db)
+                          conntrack (conntrack/nemesis (if (keyword? conntrack)
+                                                         conntrack
+                                                         :both))
+                          probe     (probe/nemesis (if (map? probe) probe {}))))
      :perf            #{{:name  "partition"
                          :start #{:start-partition}
                          :stop  #{:stop-partition}
+                         :fs    #{:flap-partition}
                          :color "#E9DCA0"}}}))
 
 (defn clock-package
@@ -279,6 +373,329 @@
                            :fs    #{:strobe-clock}
                            :color "#A0E9E3"}}}))
 
+(defn throttle-links
+  "Which [src dst] links does a throttle target cover? Target may be :link, for
+  a single random link, or a node spec, as for db-nodes, which covers every
+  link to and from those nodes. Random choices are drawn from rng, if given."
+  ([test db target]
+   (throttle-links (Random.) test db target))
+  ([^Random rng test db target]
+   (let [nodes (:nodes test)]
+     (if (= :link target)
+       (let [[a b] (take 2 (rng-shuffle rng nodes))]
+         (when b [[a b]]))
+       (let [targets (set (db-nodes rng test db target))]
+         (for [a nodes, b nodes
+               :when (not= a b)
+               :when (or (targets a) (targets b))]
+           [a b]))))))
+
+(defn links-op
+  "Takes a Random, a DB, and an op whose :value has a :target, as for
+  throttle-links. Returns a generator which emits that op once, with the
+  [src dst] links its target covers in :links. We can't choose links until we
+  see the test's nodes, so we draw a seed for them from rng now, and the op
+  comes out the same however many times the interpreter asks for it."
+  [^Random rng db op]
+  (let [seed (.nextLong rng)]
+    (gen/once (fn [test _]
+                (assoc-in op [:value :links]
+                          (throttle-links (Random. seed) test db
+                                          (:target (:value op))))))))
+
+(defn op-links
+  "The links a throttle or packet op acts on: its :links, if it has them, or
+  those its :target covers."
+  [test db op]
+  (let [v (:value op)]
+    (if (contains? v :links)
+      (:links v)
+      (throttle-links test db (:target v)))))
+
+(defn tc-net
+  "Returns the test's net, if it's a jepsen.net.tc Net, and throws otherwise."
+  [test]
+  (let [net (:net test)]
+    (when-not (tc/tc-net? net)
+      (throw+ {:type    ::tc-net-required
+               :net     net
+               :message "This fault needs the test's :net to be a jepsen.net.tc Net"}))
+    net))
+
+(defn throttle-nemesis
+  "A nemesis which limits bandwidth and queue depth on links between nodes.
+  Needs the test's :net to be a jepsen.net.tc Net. Responds to:
+
+    {:f :start-throttle, :value {:target t, :rate kbps, :limit packets}}
+    {:f :ramp-throttle,  :value {:target t, :from kbps, :to kbps,
+                                 :duration s, :steps n, :limit packets}}
+    {:f :stop-throttle}
+
+  Targets are as for throttle-links; ops may give the concrete [src dst] links
+  to use as :links instead, as links-op does. Ramps block for their duration. Stopping
+  lifts all rate and queue limits, leaving other link faults in place."
+  [db]
+  (reify
+    n/Reflection
+    (fs [this] #{:start-throttle :ramp-throttle :stop-throttle})
+
+    n/Nemesis
+    (setup! [this test] this)
+
+    (invoke! [this test op]
+      (let [net (tc-net test)
+            v   (:value op)]
+        (case (:f op)
+          :start-throttle
+          (let [links (op-links test db op)]
+            (tc/merge-links! net test links (select-keys v [:rate :limit]))
+            (assoc op :value (assoc v :links links)))
+
+          :ramp-throttle
+          (let [links (op-links test db op)
+                rates (tc/ramp! net test links (dissoc v :target :links))]
+            (assoc op :value (assoc v :links links, :rates rates)))
+
+          :stop-throttle
+          (do (tc/dissoc-links! net test [:rate :limit])
+              (assoc op :value :unthrottled)))))
+
+    (teardown! [this test]
+      (when (tc/tc-net? (:net test))
+        (tc/dissoc-links! (:net test) test [:rate :limit])))))
+
+(defn throttle-package
+  "A nemesis and generator package for saturating links: limiting bandwidth
+  and queue depth, either all at once or by ramping bandwidth down over time.
+  Options as for nemesis-package."
+  [opts]
+  (let [needed? ((:faults opts) :throttle)
+        db      (:db opts)
+        topts   (:throttle opts)
+        rng     (rng opts :throttle)
+        targets (:targets topts (cons :link (node-specs db)))
+        rates   (:rates topts [10000 1000 100])
+        limits  (:limits topts [nil 100 10])
+        start (fn start [rng]
+                {:type  :info
+                 :f     :start-throttle
+                 :value {:target (rng-nth rng targets)
+                         :rate   (rng-nth rng rates)
+                         :limit  (rng-nth rng limits)}})
+        ramp  (fn ramp [rng]
+                {:type  :info
+                 :f     :ramp-throttle
+                 :value {:target   (rng-nth rng targets)
+                         :from     (reduce max rates)
+                         :to       (reduce min rates)
+                         :duration (:interval opts default-interval)
+                         :steps    10
+                         :limit    (rng-nth rng limits)}})
+        stop  {:type :info, :f :stop-throttle}
+        either (rng-ops rng (fn [rng]
+                              (links-op rng db (if (< (rng-double rng) 0.5)
+                                                 (start rng)
+                                                 (ramp rng)))))
+        gen   (->> (gen/flip-flop either (repeat stop))
+                   (gen/stagger (:interval opts default-interval)))]
+    {:generator       (when needed? gen)
+     :final-generator (when needed? stop)
+     :nemesis         (throttle-nemesis db)
+     :perf            #{{:name  "throttle"
+                         :start #{:start-throttle :ramp-throttle}
+                         :stop  #{:stop-throttle}
+                         :color "#C3A0E9"}}}))
+
+(defn slow-node-nemesis
+  "A nemesis which starves a DB process of CPU, memory, and I/O bandwidth on
+  some nodes, by moving its process tree into a cgroup and limiting the group.
+  See jepsen.nemesis.cgroup for limits. Responds to:
+
+    {:f :start-slow-node, :value {:target spec, :limits limits}}
+    {:f :ramp-slow-node,  :value {:target spec, :from limits, :to limits,
+                                  :duration s, :steps n}}
+    {:f :stop-slow-node}
+
+  Targets are node specs, as for db-nodes. Ramps tighten limits step by step,
+  blocking for their duration; their completions have the limits and
+  relative time of each step in :steps. Stopping lifts all limits. Options:
+
+    :process  The name of the DB process. Required.
+    :dev      A directory on the disk whose I/O we limit. Defaults to /."
+  [db opts]
+  (let [process (:process opts)
+        limit!  (fn [test nodes limits]
+                  (c/on-nodes test nodes
+                              (fn [_ _]
+                                (cgroup/limit! process process limits opts))))
+        lift!   (fn [test]
+                  (c/on-nodes test
+                              (fn [_ _]
+                                (when (cu/exists? (cgroup/path process))
+                                  (cgroup/lift! process)))))]
+    (assert process "The slow-node nemesis needs a :process name")
+    (reify
+      n/Reflection
+      (fs [this] #{:start-slow-node :ramp-slow-node :stop-slow-node})
+
+      n/Nemesis
+      (setup! [this test] this)
+
+      (invoke! [this test op]
+        (let [v (:value op)]
+          (case (:f op)
+            :start-slow-node
+            (let [nodes (db-nodes test db (:target v))]
+              (limit! test nodes (:limits v))
+              (assoc op :value (assoc v :nodes nodes)))
+
+            :ramp-slow-node
+            (let [{:keys [from to duration steps] :or {steps 10}} v
+                  nodes (db-nodes test db (:target v))
+                  step  (long (/ (* 1000 duration) steps))
+                  steps (mapv (fn [limits]
+                                (let [t (util/relative-time-nanos)]
+                                  (limit! test nodes limits)
+                                  (Thread/sleep step)
+                                  {:time t, :limits limits}))
+                              (cgroup/ramp-limits from to steps))]
+              (assoc op :value (assoc v :nodes nodes, :steps steps)))
+
+            :stop-slow-node
+            (do (lift! test)
+                (assoc op :value :limits-lifted)))))
+
+      (teardown! [this test]
+        (lift! test)))))
+
+(def packet-keys
+  "The jepsen.net.tc link options which packet faults set."
+  [:reorder :reorder-correlation :gap
+   :duplicate :duplicate-correlation
+   :corrupt :corrupt-correlation])
+
+(defn packet-nemesis
+  "A nemesis which reorders, duplicates, and corrupts packets on links between
+  nodes. Needs the test's :net to be a jepsen.net.tc Net. Responds to:
+
+    {:f :start-packet, :value {:target t, :reorder pct, :duplicate pct, ...}}
+    {:f :stop-packet}
+
+  Targets are as for throttle-links; ops may give the concrete [src dst] links
+  to use as :links instead, as links-op does. Other keys are jepsen.net.tc
+  link options from packet-keys. Stopping clears all packet faults, leaving other link
+  faults in place."
+  [db]
+  (reify
+    n/Reflection
+    (fs [this] #{:start-packet :stop-packet})
+
+    n/Nemesis
+    (setup! [this test] this)
+
+    (invoke! [this test op]
+      (let [net (tc-net test)
+            v   (:value op)]
+        (case (:f op)
+          :start-packet
+          (let [links (op-links test db op)]
+            (tc/merge-links! net test links (select-keys v packet-keys))
+            (assoc op :value (assoc v :links links)))
+
+          :stop-packet
+          (do (tc/dissoc-links! net test packet-keys)
+              (assoc op :value :packets-healed)))))
+
+    (teardown! [this test]
+      (when (tc/tc-net? (:net test))
+        (tc/dissoc-links! (:net test) test packet-keys)))))
+
+(defn packet-gen
+  "A generator of :start-packet ops, drawing from rng. Each op picks one of the
+  given faults (:reorder, :duplicate, :corrupt) and a target, and applies that
+  fault to a percentage of packets drawn from percents, with a correlation of
+  0-75%. Its links are drawn from rng too; see links-op."
+  [^Random rng db faults targets percents]
+  (let [faults (vec faults)]
+    (rng-ops rng
+             (fn [rng]
+               (let [fault (rng-nth rng faults)]
+                 (links-op rng db
+                           {:type  :info
+                            :f     :start-packet
+                            :value {:target (rng-nth rng targets)
+                                    fault   (rng-nth rng percents)
+                                    (keyword (str (name fault) "-correlation"))
+                                    (long (rng-double rng 75))}}))))))
+
+(defn packet-package
+  "A nemesis and generator package for reordering, duplicating, and corrupting
+  packets. Options as for nemesis-package."
+  [opts]
+  (let [faults   (filter (:faults opts) [:reorder :duplicate :corrupt])
+        popts    (:packet opts)
+        targets  (:targets popts (cons :link (node-specs (:db opts))))
+        percents (:percents popts [1 10 25 50])
+        start    (packet-gen (rng opts :packet) (:db opts) faults targets
+                             percents)
+        stop     {:type :info, :f :stop-packet}
+        gen      (->> (gen/flip-flop start (repeat stop))
+                      (gen/stagger (:interval opts default-interval)))]
+    {:generator       (when (seq faults) gen)
+     :final-generator (when (seq faults) stop)
+     :nemesis         (packet-nemesis (:db opts))
+     :perf            #{{:name  "packet"
+                         :start #{:start-packet}
+                         :stop  #{:stop-packet}
+                         :color "#A0E9B0"}}}))
+
+(defn slow-node-package
+  "A nemesis and generator package for slow nodes: starving the DB process of
+  CPU, memory, and I/O, all at once or ramping down over time. Options as for
+  nemesis-package."
+  [opts]
+  (let [needed? ((:faults opts) :slow-node)
+        db      (:db opts)
+        sopts   (:slow-node opts)
+        rng     (rng opts :slow-node)
+        targets (:targets sopts (node-specs db))
+        limits  (:limits sopts [{:cpu 0.5}
+                                {:cpu 0.1}
+                                {:memory (* 256 1024 1024)}
+                                {:io {:rbps (* 1024 1024)
+                                      :wbps (* 1024 1024)}}])
+        start (fn start [rng]
+                {:type  :info
+                 :f     :start-slow-node
+                 :value {:target (rng-nth rng targets)
+                         :limits (rng-nth rng limits)}})
+        ramp  (fn ramp [rng]
+                {:type  :info
+                 :f     :ramp-slow-node
+                 :value {:target   (rng-nth rng targets)
+                         :from     {:cpu 1, :io {:rbps (* 100 1024 1024)
+                                                 :wbps (* 100 1024 1024)}}
+                         :to       {:cpu 0.05, :io {:rbps (* 256 1024)
+                                                    :wbps (* 256 1024)}}
+                         :duration (:interval opts default-interval)
+                         :steps    10}})
+        either (rng-ops rng (fn [rng]
+                              (if (< (rng-double rng) 0.5)
+                                (start rng)
+                                (ramp rng))))
+        stop  {:type :info, :f :stop-slow-node}
+        gen   (->> (gen/flip-flop either (repeat stop))
+                   (gen/stagger (:interval opts default-interval)))]
+    {:generator       (when needed? gen)
+     :final-generator (when needed? stop)
+     :nemesis         (if needed?
+                        (slow-node-nemesis db sopts)
+                        n/noop)
+     :perf            #{{:name  "slow-node"
+                         :start #{:start-slow-node :ramp-slow-node}
+                         :stop  #{:stop-slow-node}
+                         :color "#E9C9A0"}}}))
+
 (defn f-map-perf
   "Takes a perf map, and transforms the fs in it using `lift`."
   [lift perf]
@@ -320,10 +737,15 @@
   the combined package, so you can manipulate it further before composition."
   [opts]
   (let [faults   (set (:faults opts [:partition :kill :pause :clock]))
-        opts     (assoc opts :faults faults)]
+        seed     (:seed opts (rand-int Integer/MAX_VALUE))
+        opts     (assoc opts :faults faults, :seed seed)]
+    (info "Nemesis generators use seed" seed)
     [(partition-package opts)
      (clock-package opts)
-     (db-package opts)]))
+     (db-package opts)
+     (throttle-package opts)
+     (packet-package opts)
+     (slow-node-package opts)]))
 
 (defn nemesis-package
   "Takes an option map, and returns a map with a :nemesis, a :generator for
@@ -355,6 +777,12 @@
     :partition  Controls network partitions
     :kill       Controls process kills
     :pause      Controls process pauses and restarts
+    :throttle   Controls bandwidth and queue limits
+    :packet     Controls packet reordering, duplication, and corruption
+    :slow-node  Controls CPU, memory, and I/O limits
+    :seed       A long which seeds the targets and parameters our generators
+                choose, so that a run can be replayed. Random by default; we
+                log the seed in use.
 
   Possible faults:
 
@@ -362,13 +790,49 @@
     :kill
     :pause
     :clock
+    :throttle   (needs a jepsen.net.tc Net)
+    :reorder    (needs a jepsen.net.tc Net)
+    :duplicate  (needs a jepsen.net.tc Net)
+    :corrupt    (needs a jepsen.net.tc Net)
+    :slow-node  (needs cgroup v2 on nodes)
 
   Partition options:
 
     :targets    A collection of partition specs, e.g. [:majorities-ring, ...]
+    :flap       If set, also flaps partitions at high frequency, which needs a
+                net supporting jepsen.net.proto/Flap, like jepsen.net.nftables.
+                Either true, or a map of fixed :period (ms), :duty (0-1), and
+                :duration (s) to use instead of random ones.
+    :probe      If set, runs heartbeat probes between nodes, and records when
+                each partition actually took effect and healed. Either true,
+                or a map of options for jepsen.nemesis.probe/nemesis.
+    :conntrack  If set, breaks established flows across each partition as it
+                begins, so that it takes effect at once. Either true, or a
+                mode for jepsen.nemesis.conntrack/nemesis: :flush, :reset, or
+                :both.
 
   Kill and Pause options:
 
-    :targets    A collection of node specs, e.g. [:one, :all]"
+    :targets    A collection of node specs, e.g. [:one, :all]
+
+  Throttle options:
+
+    :targets    A collection of node specs, or :link for a single link
+    :rates      A collection of rates to limit links to, in kbit/s
+    :limits     A collection of queue limits, in packets, or nil for netem's
+                default
+
+  Packet options:
+
+    :targets    As for throttle
+    :percents   A collection of percentages of packets to reorder, duplicate,
+                or corrupt
+
+  Slow-node options:
+
+    :process    The name of the DB process to limit. Required.
+    :targets    A collection of node specs
+    :limits     A collection of limits to apply; see jepsen.nemesis.cgroup
+    :dev        A directory on the disk whose I/O to limit. Defaults to /."
   [opts]
   (compose-packages (nemesis-packages opts)))
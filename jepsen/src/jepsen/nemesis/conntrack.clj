@@ -0,0 +1,111 @@
+(ns jepsen.nemesis.conntrack
+  "Makes partitions break established connections at once. Firewall rules
+  drop packets, but a TCP socket whose packets vanish doesn't notice for a
+  while: it sits in retransmit backoff, and different sockets give up at
+  different times. Stateful rules and NAT can also keep matching conntrack
+  entries from before the partition.
+
+  This nemesis wraps a partitioner. Right after each partition begins, it runs
+  a small native helper (resources/jepsen-conntrack.c) on every affected node,
+  which talks netlink to the kernel to:
+
+    :flush    Delete conntrack entries for flows to and from cut peers
+    :reset    Destroy TCP sockets connected to cut peers. The kernel aborts
+              them, sending RSTs, and pending calls fail with ECONNABORTED.
+              This needs a kernel with CONFIG_INET_DIAG_DESTROY.
+
+  Both ends of every cut link do this, so connections fail immediately and
+  deterministically, even when the partition is one-way. Completions carry
+  each node's counts in :conntrack, e.g. {\"n1\" {:flushed 3, :reset 2}}."
+  (:require [clojure.string :as str]
+            [jepsen [control :as c]
+                    [nemesis :as n]
+                    [net :as net]
+                    [util :as util]]
+            [jepsen.nemesis [probe :as probe]
+                            [time :as nt]]))
+
+(def bin
+  "The helper binary, in jepsen.nemesis.time/dir."
+  "jepsen-conntrack")
+
+(defn install!
+  "Compiles the helper on the current node."
+  []
+  (nt/install-resources! [["jepsen-conntrack.c" bin]]))
+
+(defn peers
+  "Takes a plain or directed grudge, and returns a map of each node to the set
+  of nodes it's cut off from, in either direction."
+  [grudge]
+  (reduce (fn [m [a b]]
+            (-> m
+                (update a (fnil conj #{}) b)
+                (update b (fnil conj #{}) a)))
+          {}
+          (net/grudge->pairs grudge)))
+
+(defn flags
+  "The helper's flags for a mode: :flush, :reset, or :both."
+  [mode]
+  (case mode
+    :flush [:-f]
+    :reset [:-k]
+    :both  [:-f :-k]))
+
+(defn parse-output
+  "Parses the helper's output into {:flushed n, :reset n}."
+  [out]
+  (let [[flushed reset] (str/split (str/trim out) #"\s+")]
+    {:flushed (util/parse-long flushed)
+     :reset   (util/parse-long reset)}))
+
+(defn break!
+  "Breaks flows between the current node and the given peer IPs. Returns
+  {:flushed n, :reset n}."
+  [mode peer-ips]
+  (parse-output
+    (c/su (apply c/exec (str nt/dir "/" bin) (concat (flags mode) peer-ips)))))
+
+(defn break-all!
+  "Breaks flows across every link a grudge cuts, on all affected nodes at
+  once. Takes a map of nodes to IPs. Returns a map of nodes to counts."
+  [test ips mode grudge]
+  (let [peers (peers grudge)]
+    (when (seq peers)
+      (c/on-nodes test (keys peers)
+                  (fn [_ node]
+                    (break! mode (map ips (get peers node))))))))
+
+(defrecord Conntrack [nem mode ips]
+  n/Reflection
+  (fs [this]
+    (n/fs nem))
+
+  n/Nemesis
+  (setup! [this test]
+    (c/with-test-nodes test (install!))
+    (assoc this
+           :nem (n/setup! nem test)
+           :ips (probe/resolve-ips test)))
+
+  (invoke! [this test op]
+    (let [op' (n/invoke! nem test op)
+          v   (:value op')]
+      (if (and (vector? v) (= :isolated (first v)))
+        (assoc op' :conntrack (break-all! test ips mode (second v)))
+        op')))
+
+  (teardown! [this test]
+    (n/teardown! nem test)))
+
+(defn nemesis
+  "Wraps a partitioning nemesis (e.g. jepsen.nemesis/partitioner, or
+  jepsen.nemesis.combined/partition-nemesis). Mode is :flush, :reset, or
+  :both, which is the default."
+  ([nem]
+   (nemesis nem :both))
+  ([nem mode]
+   (assert (#{:flush :reset :both} mode)
+           (str "Unknown conntrack mode " (pr-str mode)))
+   (map->Conntrack {:nem nem, :mode mode})))
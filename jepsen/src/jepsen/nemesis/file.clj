@@ -0,0 +1,111 @@
+(ns jepsen.nemesis.file
+  "Corrupts files on nodes. jepsen.nemesis/truncate-file can chop the end off a
+  single file per node; here, a native helper (resources/jepsen-corrupt.c)
+  applies a whole batch of faults per node in one call, fsyncs what it
+  damaged, and tells us exactly which bytes changed. A fault is a map of:
+
+    :kind     :truncate, :bitflip, :zero, or :garbage
+    :file     A path, or a glob pattern
+    :select   Which files matching :file to damage: :all (the default),
+              :newest, :oldest, or :random. :newest is handy for hitting the
+              segment a log is currently writing.
+    :offset   Where to start, in bytes. Negative offsets count back from the
+              end of the file. Defaults to 0.
+    :length   How many bytes to damage. Defaults to 1.
+
+  Truncation cuts a file off at :offset. Bitflips flip one random bit in each
+  byte of the range. Zeroing punches a hole where the filesystem allows, and
+  garbage overwrites the range with random bytes. Each damaged range comes
+  back as a map of :kind, :file, :start and :end (a half-open byte range), and
+  for bitflips, the absolute :bits we flipped."
+  (:require [clojure.string :as str]
+            [jepsen [control :as c]
+                    [nemesis :as n]
+                    [util :as util]]
+            [jepsen.nemesis.time :as nt]
+            [slingshot.slingshot :refer [try+]]))
+
+(def bin
+  "The corruption helper, in jepsen.nemesis.time/dir."
+  "jepsen-corrupt")
+
+(defn install!
+  "Compiles the helper on the current node."
+  []
+  (nt/install-resources! [["jepsen-corrupt.c" bin]]))
+
+(defn fault-line
+  "Renders a fault as a line of helper input."
+  [{:keys [kind file select offset length]
+    :or   {select :all, offset 0, length 1}}]
+  (assert (#{:truncate :bitflip :zero :garbage} kind)
+          (str "Unknown fault kind " (pr-str kind)))
+  (assert (not (re-find #"\s" file))
+          (str "Can't corrupt files with whitespace in their names: "
+               (pr-str file)))
+  (str (name kind) " " (name select) ":" file " " offset " " length "\n"))
+
+(defn parse-output
+  "Parses the helper's output into a vector of damaged ranges."
+  [out]
+  (->> (str/split-lines out)
+       (keep (fn [line]
+               (when-let [[_ kind file start end bits]
+                          (re-find #"^(\S+) (\S+) (\d+) (\d+) (\S+)$" line)]
+                 (cond-> {:kind  (keyword kind)
+                          :file  file
+                          :start (util/parse-long start)
+                          :end   (util/parse-long end)}
+                   (not= "-" bits)
+                   (assoc :bits (mapv util/parse-long
+                                      (str/split bits #",")))))))
+       vec))
+
+(defn corrupt!
+  "Applies a collection of faults on the current node, using the given seed
+  for randomness. Returns a vector of damaged ranges."
+  ([faults]
+   (corrupt! (rand-int Integer/MAX_VALUE) faults))
+  ([seed faults]
+   (let [cmd (str nt/dir "/" bin " -s " (long seed))
+         in  (str/join (map fault-line faults))
+         run #(c/su (c/exec-in* in cmd))]
+     (parse-output
+       (try+ (run)
+             (catch [:type :jepsen.control/nonzero-exit, :exit 127] _
+               (install!)
+               (run)))))))
+
+(defn corrupt-nemesis
+  "A nemesis which responds to
+
+    {:f     :corrupt-file
+     :value {\"n1\" [{:kind :bitflip, :file \"/var/db/*.log\",
+                     :select :newest, :offset -4096, :length 16}
+                    ...]
+             ...}}
+
+  by applying each node's faults there, all at once. The value may also have
+  a :seed, which makes the random choices--bits, garbage, :random files--
+  repeatable. The completion's :damage is a map of nodes to the byte ranges
+  we changed."
+  []
+  (reify
+    n/Reflection
+    (fs [this] #{:corrupt-file})
+
+    n/Nemesis
+    (setup! [this test] this)
+
+    (invoke! [this test op]
+      (assert (= :corrupt-file (:f op)))
+      (let [plan (:value op)
+            seed (:seed plan (rand-int Integer/MAX_VALUE))
+            plan (dissoc plan :seed)]
+        (assoc op
+               :seed   seed
+               :damage (c/on-nodes test (keys plan)
+                                   (fn [_ node]
+                                     (corrupt! seed (get plan node)))))))
+
+    (teardown! [this test])))
@@ -0,0 +1,146 @@
+(ns jepsen.nemesis.iofault
+  "Disk faults for a DB process, without FUSE. We compile an LD_PRELOAD library
+  (resources/jepsen-iofault.c) which wraps read, write, pread, pwrite, fsync,
+  and fdatasync, and can fail, shorten, delay, or silently drop those calls on
+  regular files. Every process using the library maps a shared control page,
+  so faults switch on and off live, for all of them at once, with one small
+  command. While faults are off, the wrapped calls cost a single extra load.
+
+  To use it, start the DB with the environment from `env`, e.g.
+
+    (cu/start-daemon! {:env (iofault/env) ...} bin ...)
+
+  then use `nemesis`, or call `set-faults!` and `clear!` yourself. Faults are
+  maps of:
+
+    :read-eio       Probability (0-1) that a read fails with EIO
+    :write-eio      Probability that a write fails with EIO
+    :write-enospc   Probability that a write fails with ENOSPC
+    :short-write    Probability that a write writes only part of its buffer
+    :fsync-eio      Probability that an fsync fails with EIO
+    :fsync-drop     Probability that an fsync claims success without syncing
+    :read-delay     Delay before each read, in ms
+    :write-delay    Delay before each write, in ms
+    :fsync-delay    Delay before each fsync, in ms
+    :path           Only affect files under this path prefix
+
+  Faults not given are off."
+  (:require [clojure.string :as str]
+            [jepsen [control :as c]
+                    [nemesis :as n]
+                    [util :as util]]
+            [jepsen.control.util :as cu]
+            [jepsen.nemesis.time :as nt]))
+
+(def lib
+  "The preload library, in jepsen.nemesis.time/dir."
+  "libjepsen-iofault.so")
+
+(def ctl-bin
+  "The control command, in jepsen.nemesis.time/dir."
+  "jepsen-iofault-ctl")
+
+(def page
+  "The shared control page."
+  "/dev/shm/jepsen-iofault")
+
+(defn install!
+  "Compiles the library and control command on the current node."
+  []
+  (nt/install-resources!
+    [["jepsen-iofault.c" lib ["-shared" "-fPIC" "-ldl"]]
+     ["jepsen-iofault.c" ctl-bin ["-DJEPSEN_IOFAULT_CTL"]]]))
+
+(defn env
+  "Environment variables which load the library into a process."
+  []
+  {:LD_PRELOAD          (str nt/dir "/" lib)
+   :JEPSEN_IOFAULT_PAGE page})
+
+(def probability-keys
+  "Faults which happen with some probability."
+  [:read-eio :write-eio :write-enospc :short-write :fsync-eio :fsync-drop])
+
+(def delay-keys
+  "Faults which delay calls."
+  [:read-delay :write-delay :fsync-delay])
+
+(defn ctl-args
+  "Takes faults, and returns key=value arguments for the control command,
+  which set every fault and enable them."
+  [faults]
+  (let [field (fn [k] (str/replace (name k) "-" "_"))]
+    (concat
+      (for [k probability-keys]
+        (str (field k) "=" (Math/round (* 1e6 (double (get faults k 0))))))
+      (for [k delay-keys]
+        (str (field k) "=" (Math/round (* 1e6 (double (get faults k 0))))))
+      [(str "path=" (:path faults ""))
+       "enabled=1"])))
+
+(defn parse-ctl
+  "Parses the control command's output into a map of keywords to values."
+  [out]
+  (->> (str/split-lines out)
+       (keep (fn [line]
+               (let [[k v] (str/split line #" " 2)]
+                 (when k
+                   [(keyword (str/replace k "_" "-"))
+                    (if (= "path" k)
+                      (or v "")
+                      (util/parse-long v))]))))
+       (into {})))
+
+(defn ctl!
+  "Runs the control command on the current node with the given arguments, and
+  returns the page's contents."
+  [& args]
+  (c/su
+    (when-not (cu/exists? (str nt/dir "/" ctl-bin))
+      (install!))
+    (parse-ctl (apply c/exec (str nt/dir "/" ctl-bin) :-p page args))))
+
+(defn set-faults!
+  "Replaces the current node's faults, and turns them on. Returns the page,
+  whose :injected counts faults injected so far."
+  [faults]
+  (apply ctl! (ctl-args faults)))
+
+(defn clear!
+  "Turns faults off on the current node. Returns the page."
+  []
+  (ctl! "enabled=0"))
+
+(defn nemesis
+  "A nemesis which responds to
+
+    {:f :start-io-fault, :value {\"n1\" {:fsync-drop 1, :path \"/var/db\"}
+                                 ...}}
+
+  by setting each node's faults, and to {:f :stop-io-fault} by turning them
+  off everywhere. Completions carry each node's :injected count so far in
+  :injected. Install the library in your DB's setup with install!, so that
+  processes can load it."
+  []
+  (reify
+    n/Reflection
+    (fs [this] #{:start-io-fault :stop-io-fault})
+
+    n/Nemesis
+    (setup! [this test]
+      (c/with-test-nodes test (install!))
+      this)
+
+    (invoke! [this test op]
+      (let [res (case (:f op)
+                  :start-io-fault
+                  (let [plan (:value op)]
+                    (c/on-nodes test (keys plan)
+                                (fn [_ node] (set-faults! (get plan node)))))
+
+                  :stop-io-fault
+                  (c/on-nodes test (fn [_ _] (clear!))))]
+        (assoc op :injected (util/map-vals :injected res))))
+
+    (teardown! [this test]
+      (c/with-test-nodes test (clear!)))))
@@ -0,0 +1,184 @@
+(ns jepsen.nemesis.power
+  "Simulates power loss: every write since the last flush vanishes. This needs
+  no special hardware, just device-mapper and loop devices.
+
+  We keep the DB's data directory on a filesystem in an image file, mounted
+  through a loop device and dm-log-writes. dm-log-writes passes writes through
+  to the image, but also logs each one, along with every flush and FUA, to a
+  second loop device. We keep a copy of the image as it was when logging
+  began. On power loss, we kill the DB, mark the log, and tear the stack down;
+  then a native helper (resources/jepsen-replay-log.c) replays the log onto
+  the copy, up to the last flush before the mark, plus any FUA writes after
+  it, which were durable on their own. That copy becomes the new
+  image, and we mount it and restart the DB, which finds only what it had made
+  durable.
+
+  Call setup! from your DB's setup!, before you put anything in the data
+  directory, and teardown! from its teardown!. Options:
+
+    :mount      The directory to mount the filesystem on; the DB's data dir.
+                Required.
+    :dir        Where to keep images. Defaults to /opt/jepsen/power.
+    :size       The filesystem's size, in megabytes. Defaults to 256.
+    :log-size   The log's size, in megabytes. The log holds every write
+                between power losses. Defaults to 2048. Images are sparse.
+    :fs         The filesystem to make. Defaults to :ext4.
+    :owner      A user to chown the mount to, if any."
+  (:require [clojure.string :as str]
+            [clojure.tools.logging :refer [info]]
+            [jepsen [control :as c]
+                    [db :as db]
+                    [nemesis :as n]
+                    [util :as util]]
+            [jepsen.control.util :as cu]
+            [jepsen.nemesis.time :as nt]))
+
+(def bin
+  "The log replay helper, in jepsen.nemesis.time/dir."
+  "jepsen-replay-log")
+
+(def dm-name
+  "The name of our device-mapper device."
+  "jepsen-power")
+
+(def mark
+  "The log mark we make at power loss."
+  "jepsen-power-loss")
+
+(defn files
+  "Paths to the image files for the given options."
+  [opts]
+  (let [dir (:dir opts (str nt/dir "/power"))]
+    {:dir  dir
+     :data (str dir "/data.img")
+     :base (str dir "/base.img")
+     :log  (str dir "/log.img")}))
+
+(defn install!
+  "Compiles the replay helper, and makes sure we have device-mapper tools and
+  the dm-log-writes module, on the current node."
+  []
+  (nt/install-resources! [["jepsen-replay-log.c" bin]]
+                         {:debian [:dmsetup]
+                          :centos [:device-mapper]})
+  (c/su (c/exec :modprobe :dm-log-writes)))
+
+(defn loop-dev
+  "The loop device attached to a file on the current node, or nil."
+  [file]
+  (when (cu/exists? file)
+    (let [out (c/su (c/exec :losetup :-j file))]
+      (when-let [[_ dev] (re-find #"^(/dev/loop\d+):" out)]
+        dev))))
+
+(defn start-logging!
+  "Snapshots the data image as the replay base, and mounts it through
+  dm-log-writes."
+  [opts]
+  (let [{:keys [data base log]} (files opts)]
+    (c/su
+      (c/exec :cp :--sparse=always data base)
+      ; A fresh log: clear any old superblock
+      (c/exec :dd "if=/dev/zero" (str "of=" log) "bs=4096" "count=1"
+              "conv=notrunc")
+      (let [data-dev (c/exec :losetup :-f :--show data)
+            log-dev  (c/exec :losetup :-f :--show log)
+            sectors  (c/exec :blockdev :--getsz data-dev)]
+        (c/exec :dmsetup :create dm-name :--table
+                (str "0 " sectors " log-writes " data-dev " " log-dev)))
+      (c/exec :mkdir :-p (:mount opts))
+      (c/exec :mount (str "/dev/mapper/" dm-name) (:mount opts))
+      (when-let [owner (:owner opts)]
+        (c/exec :chown owner (:mount opts))))))
+
+(defn stop-logging!
+  "Unmounts the filesystem and tears down the device-mapper stack. With
+  {:on-error :ignore}, skips over anything which isn't there, as for setup and
+  teardown; otherwise, throws if any step fails, since a mount or device which
+  outlives us means the log is still being written."
+  ([opts]
+   (stop-logging! opts {}))
+  ([opts batch-opts]
+   (let [{:keys [data log]} (files opts)]
+     (c/su
+       (c/exec-batch batch-opts
+                     (concat [[:umount (:mount opts)]
+                              [:dmsetup :remove dm-name]]
+                             (for [file [data log]
+                                   :let [dev (loop-dev file)]
+                                   :when dev]
+                               [:losetup :-d dev])))))))
+
+(defn setup!
+  "Creates a fresh filesystem image on the current node, and mounts it at
+  (:mount opts) through dm-log-writes."
+  [opts]
+  (install!)
+  (stop-logging! opts {:on-error :ignore})
+  (let [{:keys [dir data log]} (files opts)]
+    (info "Creating power-loss filesystem at" (:mount opts))
+    (c/su
+      (c/exec :mkdir :-p dir)
+      (c/exec :rm :-f data log)
+      (c/exec :truncate :-s (str (:size opts 256) "M") data)
+      (c/exec :truncate :-s (str (:log-size opts 2048) "M") log)
+      (c/exec (str "mkfs." (name (:fs opts :ext4))) :-q data)))
+  (start-logging! opts))
+
+(defn teardown!
+  "Unmounts the filesystem and removes its images on the current node."
+  [opts]
+  (stop-logging! opts {:on-error :ignore})
+  (c/su (c/exec :rm :-rf (:dir (files opts)))))
+
+(defn parse-output
+  "Parses the replay helper's output."
+  [out]
+  (let [[replayed dropped bytes] (str/split (str/trim out) #"\s+")]
+    {:replayed      (util/parse-long replayed)
+     :dropped       (util/parse-long dropped)
+     :dropped-bytes (util/parse-long bytes)}))
+
+(defn power-loss!
+  "Loses every write since the last flush on the current node, and mounts the
+  result. Kill the DB first, and restart it afterwards. Throws, leaving the
+  images alone, if the filesystem won't unmount. Returns
+  {:replayed n, :dropped n, :dropped-bytes n}: the writes we kept and
+  dropped."
+  [opts]
+  (let [{:keys [data base log]} (files opts)]
+    ; Everything before this mark reached the device; anything the unmount
+    ; writes back comes after it, and is lost, as dirty pages would be.
+    (c/su (c/exec :dmsetup :message dm-name 0 :mark mark))
+    (stop-logging! opts)
+    (let [res (parse-output
+                (c/su (c/exec (str nt/dir "/" bin) log base mark)))]
+      (c/su (c/exec :mv base data))
+      (start-logging! opts)
+      res)))
+
+(defn nemesis
+  "A nemesis which responds to {:f :power-loss, :value nodes} by killing the
+  DB on those nodes (or, if nodes is nil, on one random node), losing every
+  write since the last flush, and restarting the DB. The DB must support
+  jepsen.db/Process, and call setup! with the same options. Values are maps
+  of nodes to what we replayed and dropped."
+  [db opts]
+  (reify
+    n/Reflection
+    (fs [this] #{:power-loss})
+
+    n/Nemesis
+    (setup! [this test] this)
+
+    (invoke! [this test op]
+      (let [nodes (or (:value op) [(rand-nth (:nodes test))])]
+        (assoc op :value
+               (c/on-nodes test nodes
+                           (fn [test node]
+                             (db/kill! db test node)
+                             (let [res (power-loss! opts)]
+                               (db/start! db test node)
+                               res))))))
+
+    (teardown! [this test])))
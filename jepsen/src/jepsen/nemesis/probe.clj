@@ -0,0 +1,209 @@
+(ns jepsen.nemesis.probe
+  "Measures when partitions actually take effect. We tend to assume that a
+  partition begins when drop-all! returns, and ends when heal! does, but
+  firewall changes can lag, and established flows can carry on for a while.
+
+  This namespace runs a small native heartbeat mesh (resources/jepsen-probe.c)
+  on every node: each node sends a UDP heartbeat to every other node every few
+  milliseconds, and logs, in wall-clock time, when heartbeats from a peer stop
+  arriving and when they resume. The probe nemesis wraps a partitioner, and
+  after each partition or heal, waits for the probes to observe the change on
+  every affected link. It records when each link actually lost or regained
+  traffic on the completion op:
+
+    :loss-onset   A map of [src dst] links to the time src -> dst traffic
+                  stopped, in relative nanoseconds, like :time
+    :recovery     A map of [src dst] links to the time traffic resumed
+
+  Links which don't change within the await timeout are missing from these
+  maps: a sign the partition wasn't effective. jepsen.checker.perf draws the
+  span from the first loss onset to the last recovery as the partition's true
+  outage window."
+  (:require [clojure.set :as set]
+            [clojure.string :as str]
+            [clojure.tools.logging :refer [info warn]]
+            [jepsen [control :as c]
+                    [nemesis :as n]
+                    [net :as net]
+                    [util :as util]]
+            [jepsen.control [net :as control.net]
+                            [util :as cu]]
+            [jepsen.nemesis.time :as nt]))
+
+(def bin
+  "The probe binary, in jepsen.nemesis.time/dir."
+  "jepsen-probe")
+
+(def logfile
+  "Where probes log link changes."
+  (str nt/dir "/probe.log"))
+
+(def pidfile
+  "Where the probe's pidfile lives."
+  (str nt/dir "/probe.pid"))
+
+(def default-opts
+  "Default probe options:
+
+    :port       The UDP port heartbeats use
+    :interval   How often to send heartbeats, in ms
+    :timeout    How long a link must be silent before we call it down, in ms
+    :await      How long to wait for probes to see a change, in ms
+    :skew       How far node clocks may lag the control node's, in ms. We
+                accept changes logged up to this long before an op began."
+  {:port     7945
+   :interval 10
+   :timeout  50
+   :await    5000
+   :skew     1000})
+
+(defn install!
+  "Compiles the probe on the current node."
+  []
+  (nt/install-resources! [["jepsen-probe.c" bin]]))
+
+(defn start!
+  "Starts the probe on the current node, sending heartbeats to the given peer
+  IPs."
+  [opts peer-ips]
+  (c/su
+    (c/exec :rm :-f logfile)
+    (apply cu/start-daemon!
+           {:logfile logfile
+            :pidfile pidfile
+            :chdir   nt/dir}
+           (str nt/dir "/" bin)
+           (:port opts) (:interval opts) (:timeout opts)
+           peer-ips)))
+
+(defn stop!
+  "Stops the probe on the current node."
+  []
+  (c/su (cu/stop-daemon! pidfile)))
+
+(defn parse-events
+  "Parses probe log output into a sequence of {:time wall-nanos, :ip ip,
+  :state :down/:up} maps, skipping lines which aren't events."
+  [s]
+  (keep (fn [line]
+          (when-let [[_ t ip state] (re-find #"^(\d+) (\S+) (down|up)$" line)]
+            {:time  (util/parse-long t)
+             :ip    ip
+             :state (keyword state)}))
+        (str/split-lines s)))
+
+(defn events
+  "The current node's probe events."
+  []
+  (parse-events (c/su (c/exec :cat logfile))))
+
+(defn wall-nanos
+  "The control node's wall clock, in nanoseconds."
+  []
+  (* 1000000 (System/currentTimeMillis)))
+
+(defn wall->relative
+  "Converts wall-clock nanoseconds to nanoseconds relative to the start of the
+  test, as in op :times."
+  [t]
+  (- t (- (wall-nanos) (util/relative-time-nanos))))
+
+(defn links
+  "Takes a plain or directed grudge, and returns the set of [src dst] links it
+  cuts."
+  [grudge]
+  (set (net/grudge->pairs grudge)))
+
+(defn await-links!
+  "Polls probes until every one of the given [src dst] links has most recently
+  logged `state` (:down or :up), at or after wall-clock time `since`, or until
+  timeout-ms pass. Takes a map of nodes to IPs. Returns a map of links to the
+  wall-clock time each reached that state."
+  [test ips links state since timeout-ms]
+  (let [deadline (+ (System/nanoTime) (* timeout-ms 1000000))
+        nodes    (set/map-invert ips)]
+    (loop [found {}]
+      (let [pending (remove found links)
+            found   (->> (c/on-nodes test (distinct (map second pending))
+                                     (fn [_ _] (events)))
+                         (mapcat (fn [[dst es]]
+                                   (for [[ip es] (group-by :ip es)
+                                         :let [e   (peek (vec es))
+                                               src (nodes ip)]
+                                         :when (and src
+                                                    (= state (:state e))
+                                                    (<= since (:time e)))]
+                                     [[src dst] (:time e)])))
+                         (into {})
+                         (#(select-keys % pending))
+                         (merge found))]
+        (if (or (every? found links)
+                (< deadline (System/nanoTime)))
+          found
+          (do (Thread/sleep 50)
+              (recur found)))))))
+
+(defn resolve-ips
+  "Returns a map of each node in the test to its IP address, as seen from the
+  first node."
+  [test]
+  (let [nodes (:nodes test)]
+    (-> (c/on-nodes test [(first nodes)]
+                    (fn [_ _]
+                      (zipmap nodes (map control.net/ip nodes))))
+        vals
+        first)))
+
+(defrecord Probe [nem opts ips cut] ; cut: atom of links currently cut
+  n/Reflection
+  (fs [this]
+    (n/fs nem))
+
+  n/Nemesis
+  (setup! [this test]
+    (let [ips (resolve-ips test)]
+      (c/with-test-nodes test
+        (install!)
+        (start! opts (vals (dissoc ips c/*host*))))
+      (assoc this
+             :nem (n/setup! nem test)
+             :ips ips)))
+
+  (invoke! [this test op]
+    (let [since (wall-nanos)
+          op'   (n/invoke! nem test op)
+          v     (:value op')
+          ; Which links should change, and how?
+          [k ls state] (cond (and (vector? v) (= :isolated (first v)))
+                             [:loss-onset (links (second v)) :down]
+
+                             (= :network-healed v)
+                             [:recovery @cut :up]
+
+                             true nil)]
+      (if (empty? ls)
+        op'
+        (let [since (- since (* 1000000 (:skew opts)))
+              times (await-links! test ips ls state since (:await opts))]
+          (when (< (count times) (count ls))
+            (warn "Probes saw" (count times) "of" (count ls)
+                  "links change to" state "within" (:await opts) "ms"))
+          (if (= :down state)
+            (swap! cut into ls)
+            (reset! cut #{}))
+          (assoc op' k (util/map-vals wall->relative times))))))
+
+  (teardown! [this test]
+    (n/teardown! nem test)
+    (c/with-test-nodes test (stop!))))
+
+(defn nemesis
+  "Wraps a partitioning nemesis (e.g. jepsen.nemesis/partitioner, or
+  jepsen.nemesis.combined/partition-nemesis) in heartbeat probes. Options
+  are merged into default-opts."
+  ([nem]
+   (nemesis nem {}))
+  ([nem opts]
+   (map->Probe {:nem  nem
+                :opts (merge default-opts opts)
+                :cut  (atom #{})})))
@@ -19,46 +19,70 @@
 
 (defn compile!
   "Takes a Reader to C source code and spits out a binary to /opt/jepsen/<bin>,
-  if it doesn't already exist."
-  [reader bin]
-  (c/su
-    (when-not (cu/exists? (str dir "/" bin))
-      (info "Compiling" bin)
-      (let [tmp-file (File/createTempFile "jepsen-upload" ".c")]
-        (try
-          (io/copy reader tmp-file)
-          ; Upload
-          (c/exec :mkdir :-p dir)
-          (c/exec :chmod "a+rwx" dir)
-          (c/upload (.getCanonicalPath tmp-file) (str dir "/" bin ".c"))
-          (c/cd dir
-                (c/exec :gcc (str bin ".c"))
-                (c/exec :mv "a.out" bin))
-          (finally
-            (.delete tmp-file)))))
-    bin))
+  if it doesn't already exist. Any gcc-args, like libraries to link, go at the
+  end of the gcc command line."
+  ([reader bin]
+   (compile! reader bin []))
+  ([reader bin gcc-args]
+   (c/su
+     (when-not (cu/exists? (str dir "/" bin))
+       (info "Compiling" bin)
+       (let [tmp-file (File/createTempFile "jepsen-upload" ".c")]
+         (try
+           (io/copy reader tmp-file)
+           ; Upload
+           (c/exec :mkdir :-p dir)
+           (c/exec :chmod "a+rwx" dir)
+           (c/upload (.getCanonicalPath tmp-file) (str dir "/" bin ".c"))
+           (c/cd dir
+                 (apply c/exec :gcc (str bin ".c") gcc-args)
+                 (c/exec :mv "a.out" bin))
+           (finally
+             (.delete tmp-file)))))
+     bin)))
 
 (defn compile-resource!
   "Given a resource name, spits out a binary to /opt/jepsen/<bin>."
-  [resource bin]
-  (with-open [r (io/reader (io/resource resource))]
-    (compile! r bin)))
+  ([resource bin]
+   (compile-resource! resource bin []))
+  ([resource bin gcc-args]
+   (with-open [r (io/reader (io/resource resource))]
+     (compile! r bin gcc-args))))
+
+(defn install-resources!
+  "Compiles C resources on the current node, given as a collection of
+  [resource bin] or [resource bin gcc-args] vectors. If that fails, installs a
+  compiler, plus any extra packages, and tries again. Options:
+
+    :debian   Extra Debian packages, e.g. [:libnftables-dev]
+    :centos   Extra CentOS packages"
+  ([resources]
+   (install-resources! resources {}))
+  ([resources {:keys [debian centos]}]
+   (let [compile-all! #(doseq [[resource bin gcc-args] resources]
+                         (compile-resource! resource bin (or gcc-args [])))]
+     (c/su
+       (try (compile-all!)
+            (catch RuntimeException e
+              (try (debian/install (into [:build-essential] debian))
+                   (catch RuntimeException e
+                     (centos/install (into [:gcc] centos))))
+              (compile-all!)))))))
+
+(def tools
+  "Our clock helpers, as [resource bin] pairs."
+  [["strobe-time.c" "strobe-time"]
+   ["bump-time.c" "bump-time"]])
 
 (defn compile-tools!
   []
-  (compile-resource! "strobe-time.c" "strobe-time")
-  (compile-resource! "bump-time.c" "bump-time"))
+  (doseq [[resource bin] tools]
+    (compile-resource! resource bin)))
 
 (defn install!
   "Uploads and compiles some C programs for messing with clocks."
   []
-  (c/su
-    (try (compile-tools!)
-         (catch RuntimeException e
-           (try (debian/install [:build-essential])
-                (catch RuntimeException e
-                  (centos/install [:gcc])))
-           (compile-tools!)))))
+  (install-resources! tools))
 
 (defn parse-time
   "Parses a decimal time in unix seconds since the epoch, provided as a string,
@@ -26,23 +26,82 @@
   (fast! [net test]          "Removes packet loss and delays."))
 
 ; Top-level API functions
+(defn directed-grudge
+  "Grudges come in two forms. A plain grudge is a map of nodes to collections
+  of nodes they should drop messages from. A directed grudge is a map of nodes
+  to maps of:
+
+    :input    Nodes this node should drop messages from
+    :output   Nodes this node should drop messages to
+
+  so that {\"n1\" {:output [\"n2\"]}} cuts n1 -> n2 at n1, leaving n2 -> n1
+  alone. Takes either, and returns a directed grudge."
+  [grudge]
+  (->> grudge
+       (map (fn [[node v]] [node (if (map? v) v {:input v})]))
+       (into {})))
+
+(defn grudge->pairs
+  "Takes a plain or directed grudge, and returns a sequence of [src dst] pairs
+  of nodes whose traffic the grudge drops."
+  [grudge]
+  (distinct
+    (for [[node {:keys [input output]}] (directed-grudge grudge)
+          pair (concat (map vector input (repeat node))
+                       (map vector (repeat node) output))]
+      pair)))
+
 (defn drop-all!
-  "Takes a test and a grudge: a map of nodes to collections of nodes they
-  should drop messages from, and makes those changes to the test's network."
+  "Takes a test and a grudge--plain or directed, see directed-grudge--and
+  makes those changes to the test's network."
   [test grudge]
   (let [net (:net test)]
     (if (satisfies? p/PartitionAll net)
       ; Fast path
       (p/drop-all! net test grudge)
 
-      ; Fallback
+      ; Fallback: drop each [src dst] pair separately. Nets which drop on
+      ; input can't drop at the source, so output entries become drops at
+      ; their destinations instead.
       (->> grudge
-           ; We'll expand {dst [src1 src2]} into ((src1 dst) (src2 dst) ...)
-           (mapcat (fn expand [[dst srcs]]
-                     (map list srcs (repeat dst))))
+           grudge->pairs
            (real-pmap (partial apply drop! net test))
            dorun))))
 
+(defn flap!
+  "Takes a test, a grudge, and flapping options, and flaps the test's
+  network: cutting it according to the grudge and healing it on a fast,
+  regular schedule. See jepsen.net.proto/Flap. Throws if the test's net
+  doesn't support flapping."
+  [test grudge opts]
+  (let [net (:net test)]
+    (if (satisfies? p/Flap net)
+      (p/flap! net test grudge opts)
+      (throw+ {:type    ::flap-unsupported
+               :net     net
+               :message "This net can't flap; try jepsen.net.nftables"}))))
+
+(defn commit-times
+  "Some nets (e.g. jepsen.net.nftables) return, from drop-all! and heal!, a
+  map of nodes to {:start, :commit} wall-clock timestamps, in nanoseconds,
+  for when each node's changes took effect. Takes the return value of drop-all!
+  or heal!, and if it has these timings, returns a map of:
+
+    :commits  A map of nodes to commit timestamps
+    :skew     Nanoseconds between the first and last nodes' commits
+
+  Otherwise, returns nil."
+  [result]
+  (when (and (map? result)
+             (seq result)
+             (every? (fn [[_ r]] (and (map? r) (:commit r))) result))
+    (let [commits (into (sorted-map)
+                        (map (fn [[node r]] [node (:commit r)]))
+                        result)
+          ts      (vals commits)]
+      {:commits commits
+       :skew    (- (reduce max ts) (reduce min ts))})))
+
 (def tc "/sbin/tc")
 
 (def noop
@@ -64,9 +123,8 @@
 
     (heal! [net test]
       (with-test-nodes test
-        (su
-          (exec :iptables :-F :-w)
-          (exec :iptables :-X :-w))))
+        (su (exec-batch [[:iptables :-F :-w]
+                         [:iptables :-X :-w]]))))
 
     (slow! [net test]
       (with-test-nodes test
@@ -100,15 +158,20 @@
 
     p/PartitionAll
     (drop-all! [net test grudge]
-      (on-nodes test
-                (keys grudge)
-                (fn snub [_ node]
-                  (when (seq (get grudge node))
-                    (su (exec :iptables :-A :INPUT :-s
-                              (->> (get grudge node)
-                                   (map control.net/ip)
-                                   (str/join ","))
-                              :-j :DROP :-w))))))))
+      (let [grudge (directed-grudge grudge)
+            ips    (fn [nodes] (str/join "," (map control.net/ip nodes)))]
+        (on-nodes test
+                  (keys grudge)
+                  (fn snub [_ node]
+                    (let [{:keys [input output]} (get grudge node)]
+                      (su (exec-batch
+                            (cond-> []
+                              (seq input)
+                              (conj [:iptables :-A :INPUT :-s (ips input)
+                                     :-j :DROP :-w])
+                              (seq output)
+                              (conj [:iptables :-A :OUTPUT :-d (ips output)
+                                     :-j :DROP :-w])))))))))))
 
 (def ipfilter
   "IPFilter rules"
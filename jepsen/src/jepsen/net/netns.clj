@@ -0,0 +1,268 @@
+(ns jepsen.net.netns
+  "Runs a whole cluster on the control machine, with no VMs or SSH: each node
+  is a Linux network namespace with its own eth0, joined to the others by a
+  veth pair and a bridge.
+
+    (let [topo (netns/topology {:nodes [\"n1\" \"n2\" \"n3\" \"n4\" \"n5\"]})]
+      (netns/create! topo)
+      (try (jepsen/run! (assoc test
+                               :nodes  (:nodes topo)
+                               :remote (nsenter/remote)
+                               :net    (netns/net topo)))
+           (finally (netns/destroy! topo))))
+
+  Nodes get addresses on a /24 subnet, with the bridge at .1, and we add their
+  names to /etc/hosts so that they resolve everywhere. Commands reach nodes
+  through jepsen.control.nsenter, which enters their namespaces directly.
+
+  The Net here partitions with iptables, and slows and flakes with netem, in
+  each node's namespace, running commands locally rather than through
+  sessions. jepsen.net.tc's per-link shaping works too, since every node has
+  an eth0.
+
+  Namespaces only separate networking; nodes share a filesystem and process
+  table. Creating them requires root."
+  (:require [clojure.java.shell :refer [sh]]
+            [clojure.string :as str]
+            [clojure.tools.logging :refer [info warn]]
+            [dom-top.core :refer [real-pmap]]
+            [jepsen.net :as net]
+            [jepsen.net.proto :as p]
+            [jepsen.control [core :as core]
+                            [nsenter :as nsenter]]
+            [slingshot.slingshot :refer [throw+]]))
+
+(def hosts-file
+  "Where we name nodes. Namespaces share the host's filesystem, so this is
+  every node's hosts file too."
+  "/etc/hosts")
+
+(defn topology
+  "Describes a cluster of network namespaces. Options:
+
+    :nodes    The names of nodes. Required.
+    :bridge   The name of the bridge device. At most 8 characters, since we
+              derive veth names from it. Defaults to \"jepsen0\".
+    :subnet   The first three octets of the /24 subnet nodes live on.
+              Defaults to \"10.77.0\".
+    :prefix   The prefix of namespace names, as for
+              jepsen.control.nsenter. Defaults to \"jepsen-\"."
+  [opts]
+  (let [nodes  (vec (:nodes opts))
+        bridge (:bridge opts "jepsen0")]
+    (assert (seq nodes) "A topology needs :nodes")
+    (assert (< (count nodes) 253) "A /24 can hold at most 252 nodes")
+    (assert (<= (count bridge) 8) "Bridge names are limited to 8 characters")
+    {:nodes  nodes
+     :bridge bridge
+     :subnet (:subnet opts "10.77.0")
+     :prefix (:prefix opts nsenter/default-prefix)}))
+
+(defn index
+  "A node's position in the topology."
+  [topo node]
+  (let [i (.indexOf ^java.util.List (:nodes topo) node)]
+    (assert (<= 0 i) (str "Unknown node " (pr-str node)))
+    i))
+
+(defn ip
+  "A node's IP address."
+  [topo node]
+  (str (:subnet topo) "." (+ 2 (index topo node))))
+
+(defn bridge-ip
+  "The bridge's IP address."
+  [topo]
+  (str (:subnet topo) ".1"))
+
+(defn netns
+  "A node's namespace name."
+  [topo node]
+  (nsenter/netns-name (:prefix topo) node))
+
+(defn veth
+  "The host end of a node's veth pair."
+  [topo node]
+  (str (:bridge topo) "v" (index topo node)))
+
+(defn create-commands
+  "The commands, as argument vectors, which build a topology."
+  [topo]
+  (let [{:keys [bridge]} topo]
+    (concat
+      [["ip" "link" "add" bridge "type" "bridge"]
+       ["ip" "addr" "add" (str (bridge-ip topo) "/24") "dev" bridge]
+       ["ip" "link" "set" bridge "up"]]
+      (mapcat (fn [node]
+                (let [ns (netns topo node)]
+                  [["ip" "netns" "add" ns]
+                   ["ip" "link" "add" (veth topo node) "type" "veth"
+                    "peer" "name" "eth0" "netns" ns]
+                   ["ip" "link" "set" (veth topo node) "master" bridge "up"]
+                   ["ip" "-n" ns "addr" "add" (str (ip topo node) "/24")
+                    "dev" "eth0"]
+                   ["ip" "-n" ns "link" "set" "eth0" "up"]
+                   ["ip" "-n" ns "link" "set" "lo" "up"]
+                   ["ip" "-n" ns "route" "add" "default" "via"
+                    (bridge-ip topo)]]))
+              (:nodes topo)))))
+
+(defn forward-rule
+  "iptables arguments which let bridged traffic through the host's FORWARD
+  chain, which some hosts (e.g. those running Docker) default to DROP."
+  [topo op]
+  ["iptables" op "FORWARD" "-i" (:bridge topo) "-o" (:bridge topo)
+   "-j" "ACCEPT" "-w"])
+
+(defn sh!
+  "Runs a local command, throwing if it fails. Returns stdout."
+  [& args]
+  (let [res (apply sh args)]
+    (when-not (zero? (:exit res))
+      (throw+ (assoc res
+                     :type ::command-failed
+                     :cmd  args)
+              nil
+              "Command %s failed: %s"
+              (pr-str args) (:err res)))
+    (:out res)))
+
+(defn hosts-markers
+  "The lines which delimit our block of /etc/hosts."
+  [topo]
+  [(str "# BEGIN jepsen netns " (:bridge topo))
+   (str "# END jepsen netns " (:bridge topo))])
+
+(defn strip-hosts
+  "Removes our block from the contents of a hosts file."
+  [topo hosts]
+  (let [[begin end] (hosts-markers topo)]
+    (->> (str/split-lines hosts)
+         (reduce (fn [[lines skip?] line]
+                   (cond (= begin line) [lines true]
+                         (= end line)   [lines false]
+                         skip?          [lines true]
+                         true           [(conj lines line) false]))
+                 [[] false])
+         first
+         (map #(str % "\n"))
+         str/join)))
+
+(defn add-hosts
+  "Adds a block naming each node to the contents of a hosts file, replacing
+  any block we added before."
+  [topo hosts]
+  (let [[begin end] (hosts-markers topo)]
+    (str (strip-hosts topo hosts)
+         begin "\n"
+         (->> (:nodes topo)
+              (map (fn [node] (str (ip topo node) " " node "\n")))
+              str/join)
+         end "\n")))
+
+(defn destroy!
+  "Tears down a topology, ignoring anything which doesn't exist."
+  [topo]
+  (doseq [node (:nodes topo)]
+    (sh "ip" "netns" "del" (netns topo node)))
+  (sh "ip" "link" "del" (:bridge topo))
+  (apply sh (forward-rule topo "-D"))
+  (spit hosts-file (strip-hosts topo (slurp hosts-file))))
+
+(defn create!
+  "Builds a topology, replacing any existing one with the same names. Returns
+  the topology."
+  [topo]
+  (info "Creating network namespaces for" (:nodes topo))
+  (destroy! topo)
+  (doseq [cmd (create-commands topo)]
+    (apply sh! cmd))
+  (let [res (apply sh (forward-rule topo "-I"))]
+    (when-not (zero? (:exit res))
+      (warn "Couldn't allow forwarding on" (:bridge topo) ":" (:err res))))
+  (spit hosts-file (add-hosts topo (slurp hosts-file)))
+  topo)
+
+(defn ns-exec!
+  "Runs commands, each a sequence of arguments which we escape, in a node's
+  namespace, as a single shell invocation. Stops at, and throws for, the
+  first command which fails. Returns stdout."
+  [topo node & cmds]
+  (let [cmd (->> cmds
+                 (map (fn [args] (str/join " " (map core/escape args))))
+                 (str/join " && "))
+        res (nsenter/exec! (netns topo node) cmd)]
+    (when-not (zero? (:exit res))
+      (throw+ (assoc res
+                     :type :jepsen.control/nonzero-exit
+                     :host node
+                     :cmd  cmd)
+              nil
+              "Command %s failed on %s: %s" cmd node (:err res)))
+    (:out res)))
+
+(defn on-all
+  "Calls (f node) on each node, in parallel, returning a map of nodes to
+  results."
+  [nodes f]
+  (->> nodes
+       (real-pmap (fn [node] [node (f node)]))
+       (into {})))
+
+(defn net
+  "A Net for a topology, which runs its commands locally in nodes'
+  namespaces."
+  [topo]
+  (let [ips (fn [nodes] (str/join "," (map (partial ip topo) nodes)))
+        netem! (fn [test args]
+                 (on-all (:nodes test)
+                         (fn [node]
+                           (ns-exec! topo node
+                                     (concat [net/tc :qdisc :replace :dev :eth0
+                                              :root :netem]
+                                             args)))))]
+    (reify net/Net
+      (drop! [_ test src dest]
+        (ns-exec! topo dest [:iptables :-A :INPUT :-s (ip topo src)
+                             :-j :DROP :-w]))
+
+      (heal! [_ test]
+        (on-all (:nodes test)
+                (fn [node]
+                  (ns-exec! topo node
+                            [:iptables :-F :-w]
+                            [:iptables :-X :-w]))))
+
+      (slow! [net test]
+        (net/slow! net test {}))
+
+      (slow! [_ test {:keys [mean variance distribution]
+                      :or   {mean         50
+                             variance     10
+                             distribution :normal}}]
+        (netem! test [:delay (str mean "ms") (str variance "ms")
+                      :distribution distribution]))
+
+      (flaky! [_ test]
+        (netem! test [:loss "20%" "75%"]))
+
+      (fast! [_ test]
+        (on-all (:nodes test)
+                (fn [node]
+                  (nsenter/exec! (netns topo node)
+                                 (str net/tc " qdisc del dev eth0 root")))))
+
+      p/PartitionAll
+      (drop-all! [_ test grudge]
+        (let [grudge (net/directed-grudge grudge)]
+          (on-all (keys grudge)
+                  (fn [node]
+                    (let [{:keys [input output]} (get grudge node)]
+                      (apply ns-exec! topo node
+                             (cond-> []
+                               (seq input)
+                               (conj [:iptables :-A :INPUT :-s (ips input)
+                                      :-j :DROP :-w])
+                               (seq output)
+                               (conj [:iptables :-A :OUTPUT :-d (ips output)
+                                      :-j :DROP :-w])))))))))))
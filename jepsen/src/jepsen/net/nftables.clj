@@ -0,0 +1,217 @@
+(ns jepsen.net.nftables
+  "A Net which applies partitions as atomic nftables rulesets.
+
+  jepsen.net/iptables adds rules one exec at a time, so each node picks up its
+  part of a partition whenever its command happens to land, and a grudge with
+  several rules per node passes through intermediate states. Here, we render
+  each node's whole grudge as an nftables ruleset and hand it to a small
+  native helper (resources/jepsen-nft.c), which commits it in a single netlink
+  transaction via libnftables. Each node switches from its old rules to its new
+  ones at once.
+
+  The helper reports when each commit began and when the kernel acknowledged
+  it, in wall-clock nanoseconds. drop-all! and heal! return these timings as
+  a map of nodes to {:start, :commit}; jepsen.nemesis/partitioner records them,
+  along with their skew across nodes, on its completion ops.
+
+  A second helper (resources/jepsen-flap.c) flaps the network: it alternates
+  between a node's grudge and a healed network on a millisecond schedule,
+  entirely on the node. See jepsen.net.proto/Flap.
+
+  Our rules live in their own table, `inet jepsen`, so healing leaves any
+  other firewall rules alone. Nodes need nftables and libnftables; we install
+  libnftables' headers and compile the helper the first time we need it."
+  (:require [clojure.string :as str]
+            [clojure.tools.logging :refer [info]]
+            [jepsen [control :as c]
+                    [net :as net]
+                    [util :as util]]
+            [jepsen.control.net :as control.net]
+            [jepsen.nemesis.time :as nt]
+            [jepsen.net.proto :as p]
+            [slingshot.slingshot :refer [try+]]))
+
+(def table
+  "The nftables table we keep our rules in."
+  "inet jepsen")
+
+(def bin
+  "The name of our helper binary, in jepsen.nemesis.time/dir."
+  "jepsen-nft")
+
+(def flap-bin
+  "The name of our flapping helper binary, in jepsen.nemesis.time/dir."
+  "jepsen-flap")
+
+(defn chain-spec
+  "How we declare a chain on the input or output hook. We hook in ahead of the
+  default filter priority, so our drops win over other tables' accepts."
+  [hook]
+  (str "type filter hook " (name hook) " priority -100; policy accept;"))
+
+(defn heal-ruleset
+  "A ruleset which removes our table, if it exists. Deleting a table which
+  doesn't exist is an error, so we add it first."
+  []
+  (str "add table " table "\n"
+       "delete table " table "\n"))
+
+(defn ruleset
+  "Takes collections of IP addresses to drop inbound traffic from, and
+  (optionally) to drop outbound traffic to, and returns a ruleset which
+  replaces our table with one dropping exactly those."
+  ([input-ips]
+   (ruleset input-ips nil))
+  ([input-ips output-ips]
+   (str (heal-ruleset)
+        "table " table " {\n"
+        "  chain input {\n"
+        "    " (chain-spec :input) "\n"
+        (when (seq input-ips)
+          (str "    ip saddr { " (str/join ", " (sort input-ips)) " } drop\n"))
+        "  }\n"
+        (when (seq output-ips)
+          (str "  chain output {\n"
+               "    " (chain-spec :output) "\n"
+               "    ip daddr { " (str/join ", " (sort output-ips)) " } drop\n"
+               "  }\n"))
+        "}\n")))
+
+(defn node-ruleset
+  "Renders the ruleset for one node of a plain or directed grudge. Must be
+  called with a session bound, to resolve IPs."
+  [grudge node]
+  (let [{:keys [input output]} (get (net/directed-grudge grudge) node)]
+    (ruleset (map control.net/ip input)
+             (map control.net/ip output))))
+
+(defn add-ruleset
+  "A ruleset which adds a single drop rule for an IP address, leaving existing
+  rules in place."
+  [ip]
+  (str "add table " table "\n"
+       "add chain " table " input { " (chain-spec :input) " }\n"
+       "add rule " table " input ip saddr " ip " drop\n"))
+
+(defn install!
+  "Compiles our helpers on the current node, installing a compiler and
+  libnftables headers if necessary."
+  []
+  (nt/install-resources! [["jepsen-nft.c" bin ["-lnftables"]]
+                          ["jepsen-flap.c" flap-bin ["-lnftables"]]]
+                         {:debian [:libnftables-dev]
+                          :centos [:nftables-devel]}))
+
+(defn run-helper!
+  "Runs a helper command string on the current node as root, with the given
+  string on stdin, and returns stdout. If the helper is missing, installs our
+  helpers and tries again."
+  [cmd in]
+  (let [run #(c/su (c/exec-in* in cmd))]
+    (try+ (run)
+          (catch [:type :jepsen.control/nonzero-exit, :exit 127] _
+            (info "Installing nftables helpers")
+            (install!)
+            (run)))))
+
+(defn parse-output
+  "Parses the helper's output into {:start nanos, :commit nanos}."
+  [out]
+  (let [[start commit] (str/split (str/trim out) #"\s+")]
+    {:start  (util/parse-long start)
+     :commit (util/parse-long commit)}))
+
+(defn apply!
+  "Commits a ruleset string on the current node in one transaction. If `at` is
+  given, waits until that wall-clock time, in nanoseconds since the epoch,
+  before committing. Returns {:start nanos, :commit nanos}."
+  ([rules]
+   (apply! rules nil))
+  ([rules at]
+   (-> (str/join " " (cond-> [(str nt/dir "/" bin)]
+                       at (conj "-a" at)))
+       (run-helper! rules)
+       parse-output)))
+
+(defn flap!
+  "Flaps the current node's network: every period ms, replaces our table with
+  the given ruleset, and after duty * period ms, removes it again, for
+  duration seconds. Schedules the first cut at wall-clock time `at`, in
+  nanoseconds, if given. Blocks until done, leaving the network healed.
+  Returns a map of:
+
+    :count      How many times we cut the network
+    :max-late   The latest any change took effect relative to its schedule,
+                in microseconds"
+  [rules {:keys [period duty duration]} at]
+  (let [[n late] (-> (str/join " " (concat [(str nt/dir "/" flap-bin)]
+                                           (when at ["-a" at])
+                                           ; Ratios like 1/2 would reach the
+                                           ; helper's atof as 1
+                                           (map double
+                                                [period duty duration])))
+                     (run-helper! (str rules "%%\n" (heal-ruleset)))
+                     str/trim
+                     (str/split #"\s+"))]
+    {:count    (util/parse-long n)
+     :max-late (util/parse-long late)}))
+
+(defn deadline
+  "Given an alignment in milliseconds (or nil), returns the wall-clock time,
+  in nanoseconds since the epoch, at which nodes should commit, or nil to
+  commit as soon as possible."
+  [align-ms]
+  (when align-ms
+    (* 1000000 (+ (System/currentTimeMillis) align-ms))))
+
+(defn nftables
+  "Constructs an nftables Net. Options:
+
+    :align-ms   If set, drop-all! and heal! schedule every node's commit for
+                this many milliseconds after we begin, rather than committing
+                whenever each node's command arrives. This cancels out SSH
+                latency, bringing the skew between nodes down to roughly that
+                of their clocks--don't use it alongside clock faults. Should
+                be comfortably longer than a round trip to every node.
+
+  Slowing and flaking the network work as in jepsen.net/iptables."
+  ([]
+   (nftables {}))
+  ([opts]
+   (let [align-ms (:align-ms opts)]
+     (reify net/Net
+       (drop! [net test src dest]
+         (c/on-nodes test [dest]
+                     (fn [_ _]
+                       (apply! (add-ruleset (control.net/ip src))))))
+
+       (heal! [net test]
+         (let [at (deadline align-ms)]
+           (c/with-test-nodes test
+             (apply! (heal-ruleset) at))))
+
+       (slow! [net test]
+         (net/slow! net/iptables test))
+
+       (slow! [net test opts]
+         (net/slow! net/iptables test opts))
+
+       (flaky! [net test]
+         (net/flaky! net/iptables test))
+
+       (fast! [net test]
+         (net/fast! net/iptables test))
+
+       p/PartitionAll
+       (drop-all! [net test grudge]
+         (let [at (deadline align-ms)]
+           (c/on-nodes test (keys grudge)
+                       (fn [_ node]
+                         (apply! (node-ruleset grudge node) at)))))
+
+       p/Flap
+       (flap! [net test grudge opts]
+         (let [at (deadline align-ms)]
+           (c/on-nodes test (keys grudge)
+                       (fn [_ node]
+                         (flap! (node-ruleset grudge node) opts at)))))))))
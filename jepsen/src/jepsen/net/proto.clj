@@ -10,3 +10,17 @@
              "Takes a grudge: a map of nodes to collections of nodes they
              should drop messages from, and makes the appropriate changes to
              the network."))
+
+(defprotocol Flap
+  "This optional protocol provides support for flapping the network: cutting
+  and restoring links on a fast, regular schedule, without a round trip from
+  the control node for each change."
+  (flap! [net test grudge opts]
+         "Takes a grudge, as for drop-all!, and flaps it for a while, leaving
+         the network healed afterwards. Options:
+
+           :period    How often to cut the network, in ms
+           :duty      The fraction of each period the network spends cut
+           :duration  How long to flap for, in seconds
+
+         Returns a map of nodes to implementation-defined results."))
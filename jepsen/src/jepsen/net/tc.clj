@@ -0,0 +1,312 @@
+(ns jepsen.net.tc
+  "A Net which shapes each link between nodes separately.
+
+  jepsen.net/iptables' slow! and flaky! attach a single netem qdisc to eth0,
+  so every peer sees the same delay and loss. Here, each node gets a tree of
+  queueing disciplines instead: an htb root, one htb class per peer--selected
+  by a u32 filter on the peer's IP--and under each class, a netem qdisc for
+  that link. Traffic to anyone else (clients, the control node) goes to a
+  default class, and is left alone.
+
+  The shape of the network is a matrix: a map of source nodes to maps of
+  destination nodes to links, where a link is a map of:
+
+    :delay          Mean delay, in ms
+    :jitter         Delay variation, in ms
+    :correlation    Correlation between successive delays, in percent
+    :distribution   Delay distribution, e.g. :normal or :pareto
+    :loss           Packet loss, in percent
+    :loss-correlation  Correlation between successive losses, in percent
+    :reorder        Percent of packets to send immediately, ahead of delayed
+                    ones. netem can only reorder delayed packets, so a link
+                    with :reorder but no :delay gets reorder-delay.
+    :reorder-correlation  In percent
+    :gap            Reorder every gap-th packet, rather than at random
+    :duplicate      Percent of packets to send twice
+    :duplicate-correlation  In percent
+    :corrupt        Percent of packets in which to flip a random bit
+    :corrupt-correlation  In percent
+    :rate           A tc rate for the link, e.g. \"10mbit\", or a number of
+                    kbit/s
+    :limit          How many packets the link can queue before it drops
+                    them--netem's limit. Small limits and low rates mimic
+                    a saturated link.
+
+  Links apply to traffic leaving the source for the destination, so {n1 {n2
+  {:delay 100}}} slows n1 -> n2, but not n2 -> n1. A missing link, or an
+  empty map, is fast.
+
+  We build a node's tree the first time we change one of its links. After
+  that, changing a link touches only that link's class and netem qdisc, so
+  traffic on other links carries on undisturbed. set-matrix! and
+  update-links! make only the changes needed to get from the current matrix
+  to the requested one, in a single round trip per node.
+
+  Partitions work as in jepsen.net/iptables."
+  (:require [jepsen [control :as c]
+                    [net :as net]
+                    [util :as util]]
+            [jepsen.control.net :as control.net]
+            [jepsen.net.proto :as p]))
+
+(def max-rate
+  "The rate we give links which have no :rate of their own. htb needs some
+  rate; we pick one no test network will reach."
+  "10gbit")
+
+(def first-minor
+  "The htb class minor number of the first peer. Minor 1 is the default
+  class."
+  16)
+
+(defn minor
+  "The class minor number for traffic to a destination node. Each node gets a
+  fixed minor, based on its position in the test's nodes, so that every node's
+  tree uses the same numbering."
+  [test dest]
+  (let [i (.indexOf ^java.util.List (vec (:nodes test)) dest)]
+    (assert (<= 0 i) (str "Unknown node " (pr-str dest)))
+    (+ first-minor i)))
+
+(defn classid
+  "The htb class ID for a minor number."
+  [minor]
+  (format "1:%x" minor))
+
+(defn handle
+  "The handle of the netem qdisc under a minor number's class."
+  [minor]
+  (format "%x:" minor))
+
+(def reorder-delay
+  "The delay, in ms, we add to links which reorder packets but have no delay of
+  their own."
+  10)
+
+(defn rate
+  "Formats a link's :rate for tc. Numbers are kbit/s."
+  [r]
+  (if (number? r)
+    (str (long r) "kbit")
+    r))
+
+(defn netem-args
+  "Takes a link, and returns the netem arguments which implement it. An empty
+  link yields no arguments: a netem which passes packets straight through."
+  [{:keys [delay jitter correlation distribution loss loss-correlation
+           limit reorder reorder-correlation gap duplicate
+           duplicate-correlation corrupt corrupt-correlation]}]
+  (let [delay (or delay (when reorder reorder-delay))]
+    (cond-> []
+      limit                     (into [:limit limit])
+      delay                     (into [:delay (str delay "ms")])
+      (and delay jitter)        (conj (str jitter "ms"))
+      (and delay jitter correlation) (conj (str correlation "%"))
+      (and delay jitter distribution) (into [:distribution distribution])
+      loss                      (into [:loss (str loss "%")])
+      (and loss loss-correlation) (conj (str loss-correlation "%"))
+      reorder                   (into [:reorder (str reorder "%")])
+      (and reorder reorder-correlation) (conj (str reorder-correlation "%"))
+      (and reorder gap)         (into [:gap gap])
+      duplicate                 (into [:duplicate (str duplicate "%")])
+      (and duplicate duplicate-correlation)
+      (conj (str duplicate-correlation "%"))
+      corrupt                   (into [:corrupt (str corrupt "%")])
+      (and corrupt corrupt-correlation) (conj (str corrupt-correlation "%")))))
+
+(defn tree-commands
+  "Commands to replace a device's root qdisc with an htb tree. Takes a
+  collection of [minor ip] pairs, one for each peer."
+  [dev peers]
+  (concat
+    [{:cmd [net/tc :qdisc :del :dev dev :root], :on-error :ignore}
+     [net/tc :qdisc :add :dev dev :root :handle "1:" :htb :default 1]
+     [net/tc :class :add :dev dev :parent "1:" :classid "1:1"
+      :htb :rate max-rate]]
+    (mapcat (fn [[minor ip]]
+              [[net/tc :class :add :dev dev :parent "1:" :classid (classid minor)
+                :htb :rate max-rate]
+               [net/tc :qdisc :add :dev dev :parent (classid minor)
+                :handle (handle minor) :netem]
+               [net/tc :filter :add :dev dev :parent "1:" :protocol :ip
+                :prio 1 :u32 :match :ip :dst (str ip "/32")
+                :flowid (classid minor)]])
+            peers)))
+
+(defn link-commands
+  "Commands to change a single link, given its class minor number."
+  [dev minor link]
+  (let [rate (rate (:rate link max-rate))]
+    [[net/tc :class :change :dev dev :parent "1:" :classid (classid minor)
+      :htb :rate rate :ceil rate]
+     (into [net/tc :qdisc :replace :dev dev :parent (classid minor)
+            :handle (handle minor) :netem]
+           (netem-args link))]))
+
+(defn changes
+  "Takes an old and a new matrix, and returns a matrix of just those links
+  which differ. Links in the old matrix but not the new become empty."
+  [old new]
+  (->> (concat (for [[src dsts] old, [dst _] dsts] [src dst])
+               (for [[src dsts] new, [dst _] dsts] [src dst]))
+       distinct
+       (keep (fn [[src dst]]
+               (let [link (get-in new [src dst] {})]
+                 (when (not= (get-in old [src dst] {}) link)
+                   [src dst link]))))
+       (reduce (fn [m [src dst link]] (assoc-in m [src dst] link)) {})))
+
+(defn uniform
+  "A matrix in which every link between distinct nodes is the same."
+  [nodes link]
+  (->> (for [src nodes]
+         [src (->> (for [dst nodes :when (not= src dst)]
+                     [dst link])
+                   (into {}))])
+       (into {})))
+
+(declare set-matrix!)
+
+(defrecord TcNet [dev    ; The network device to shape
+                  state] ; Atom: {:built #{nodes}, :matrix matrix}
+  net/Net
+  (drop! [net test src dest]
+    (net/drop! net/iptables test src dest))
+
+  (heal! [net test]
+    (net/heal! net/iptables test))
+
+  (slow! [net test]
+    (net/slow! net test {}))
+
+  (slow! [net test {:keys [mean variance distribution]
+                    :or   {mean         50
+                           variance     10
+                           distribution :normal}}]
+    (set-matrix! net test (uniform (:nodes test)
+                                   {:delay        mean
+                                    :jitter       variance
+                                    :distribution distribution})))
+
+  (flaky! [net test]
+    (set-matrix! net test (uniform (:nodes test)
+                                   {:loss 20, :loss-correlation 75})))
+
+  (fast! [net test]
+    (c/with-test-nodes test
+      (c/su (c/exec-batch {:on-error :ignore}
+                          [[net/tc :qdisc :del :dev dev :root]])))
+    (reset! state {:built #{}, :matrix {}}))
+
+  p/PartitionAll
+  (drop-all! [net test grudge]
+    (p/drop-all! net/iptables test grudge)))
+
+(defn tc-net?
+  "Is this a per-link tc Net?"
+  [net]
+  (instance? TcNet net))
+
+(defn peers
+  "The [minor ip] pairs for every node in the test other than the given node.
+  Must be called with a session bound, to resolve IPs."
+  [test node]
+  (->> (:nodes test)
+       (remove #{node})
+       (map (fn [peer] [(minor test peer) (control.net/ip peer)]))))
+
+(defn apply-changes!
+  "Applies a matrix of changed links, building trees on nodes which don't have
+  them yet. Runs in parallel across source nodes, with one round trip per
+  node."
+  [^TcNet net test changed]
+  (let [{:keys [dev state]} net
+        built (:built @state)]
+    (when (seq changed)
+      (c/on-nodes test (keys changed)
+                  (fn [test src]
+                    (->> (get changed src)
+                         (mapcat (fn [[dst link]]
+                                   (link-commands dev (minor test dst) link)))
+                         (concat (when-not (built src)
+                                   (tree-commands dev (peers test src))))
+                         c/exec-batch
+                         c/su)))
+      (swap! state update :built into (keys changed)))))
+
+(defn set-matrix!
+  "Shapes the network to match the given matrix, changing only links which
+  differ from the current matrix. Links not in the matrix become fast."
+  [^TcNet net test matrix]
+  (let [state (:state net)]
+    (apply-changes! net test (changes (:matrix @state) matrix))
+    (swap! state assoc :matrix matrix)
+    matrix))
+
+(defn update-links!
+  "Like set-matrix!, but merges the given links into the current matrix,
+  leaving other links as they are. (update-links! net test {\"n1\" {\"n2\"
+  {:delay 200}}}) slows just n1 -> n2."
+  [^TcNet net test matrix]
+  (set-matrix! net test
+               (merge-with merge (:matrix @(:state net)) matrix)))
+
+(defn links->matrix
+  "Takes a collection of [src dst] links and a function of a link to its
+  options, and builds a matrix."
+  [links f]
+  (reduce (fn [m [src dst :as link]] (assoc-in m [src dst] (f link)))
+          {}
+          links))
+
+(defn merge-links!
+  "Merges options into each of the given [src dst] links, leaving their other
+  options alone. (merge-links! net test [[\"n1\" \"n2\"]] {:rate 1000})
+  limits n1 -> n2 to 1 mbit/s, but keeps any delay on it."
+  [^TcNet net test links opts]
+  (let [m (:matrix @(:state net))]
+    (update-links! net test
+                   (links->matrix links #(merge (get-in m %) opts)))))
+
+(defn dissoc-links!
+  "Removes the given option keys from every link in the matrix. Use this to
+  undo one kind of fault without disturbing others: (dissoc-links! net test
+  [:rate :limit])."
+  [^TcNet net test ks]
+  (set-matrix! net test
+               (->> (:matrix @(:state net))
+                    (util/map-vals (partial util/map-vals
+                                            #(apply dissoc % ks))))))
+
+(defn ramp-rates
+  "A geometric sequence of steps rates, in kbit/s, going from `from` (exclusive)
+  to `to` (inclusive). Bandwidth is felt multiplicatively, so a geometric ramp
+  degrades a link at an even pace."
+  [from to steps]
+  (let [ratio (/ (double to) from)]
+    (for [i (range 1 (inc steps))]
+      (Math/round (* from (Math/pow ratio (/ i (double steps))))))))
+
+(defn ramp!
+  "Ramps the rate of the given [src dst] links, in kbit/s, from `from` to `to`
+  over `duration` seconds, in `steps` equal steps. Each step changes only the
+  links' htb classes. Other link options are merged in at every step, e.g. a
+  queue :limit. Blocks until the ramp is complete. Returns the rates used."
+  [^TcNet net test links {:keys [from to duration steps] :as opts
+                          :or {steps 10}}]
+  (let [rates  (ramp-rates from to steps)
+        step   (long (/ (* 1000 duration) steps))
+        extra  (dissoc opts :from :to :duration :steps)]
+    (doseq [r rates]
+      (merge-links! net test links (assoc extra :rate r))
+      (Thread/sleep step))
+    (vec rates)))
+
+(defn net
+  "Constructs a per-link tc Net. Options:
+
+    :dev    The network device to shape. Defaults to eth0."
+  ([]
+   (net {}))
+  ([opts]
+   (TcNet. (:dev opts "eth0") (atom {:built #{}, :matrix {}}))))
@@ -13,8 +13,9 @@
 (defn setup-hostfile!
   "Makes sure the hostfile has a loopback entry for the local hostname"
   []
-  (let [name    (c/exec :hostname)
-        hosts   (c/exec :cat "/etc/hosts")
+  (let [[name hosts] (->> (c/exec-batch [[:hostname]
+                                         [:cat "/etc/hosts"]])
+                          (map :out))
         hosts'  (->> hosts
                      str/split-lines
                      (map (fn [line]
@@ -28,8 +29,12 @@
 (defn time-since-last-update
   "When did we last run an apt-get update, in seconds ago"
   []
-  (- (Long/parseLong (c/exec :date "+%s"))
-     (Long/parseLong (c/exec :stat :-c "%Y" "/var/cache/apt/pkgcache.bin" "||" :echo 0))))
+  (let [[now updated] (->> (c/exec-batch
+                            [[:date "+%s"]
+                             [:stat :-c "%Y" "/var/cache/apt/pkgcache.bin"
+                              "||" :echo 0]])
+                          (map (comp #(Long/parseLong %) :out)))]
+    (- now updated)))
 
 (defn update!
   "Apt-get update."
@@ -0,0 +1,50 @@
+(ns jepsen.control.cas-test
+  (:require [clojure [test :refer :all]]
+            [clojure.java.io :as io]
+            [jepsen.control.cas :as cas])
+  (:import (java.io File)
+           (java.nio.file Files)
+           (java.nio.file.attribute FileAttribute
+                                    PosixFilePermissions)))
+
+(defn chmod!
+  "Sets a local file's permissions, e.g. \"rwxr-xr-x\"."
+  [^File f perms]
+  (Files/setPosixFilePermissions (.toPath f)
+                                 (PosixFilePermissions/fromString perms)))
+
+(deftest entries-test
+  (let [root (.toFile (Files/createTempDirectory
+                        "jepsen-cas" (make-array FileAttribute 0)))
+        a    (io/file root "a")
+        b    (io/file root "sub/b")]
+    (try
+      (io/make-parents b)
+      (spit a "hello")
+      (spit b "hello")
+      (chmod! root "rwxr-xr-x")
+      (chmod! (io/file root "sub") "rwx------")
+      (chmod! a "rw-r--r--")
+      (chmod! b "rwxr-x---")
+      (let [h "2cf24dba5fb0a30e26e83b2ac5b9e29e1b161e5c1fa7425e73043362938b9824"]
+        (is (= h (cas/sha256 a)))
+        (is (= [[:dir "" "755"]
+                [:file "a" h a "644"]
+                [:dir "sub" "700"]
+                [:file "sub/b" h b "750"]]
+               (sort-by second (cas/entries root))))
+        (testing "single file"
+          (is (= [[:file "" h a "644"]] (cas/entries a))))
+        (testing "executable"
+          (is (= "750" (cas/mode b)))
+          (chmod! a "rwxr-xr-x")
+          (is (= [[:file "" h a "755"]] (cas/entries a)))))
+      (finally
+        (doseq [^File f (reverse (file-seq root))]
+          (.delete f))))))
+
+(deftest chains-test
+  (is (= [[1 2 3] [4 5 6] [7]] (cas/chains 3 (range 1 8))))
+  (is (= [[1 2 3]] (cas/chains 1 [1 2 3])))
+  (is (= [[1] [2]] (cas/chains 5 [1 2])))
+  (is (nil? (cas/chains 2 []))))
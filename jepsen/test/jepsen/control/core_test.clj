@@ -0,0 +1,72 @@
+(ns jepsen.control.core-test
+  (:require [clojure [test :refer :all]]
+            [clojure.java.shell :refer [sh]]
+            [jepsen.control.core :as core]))
+
+(defn run-batch
+  "Runs a batch script locally, returning its parsed results."
+  [cmds policies]
+  (-> (sh "bash" "-c" (core/batch-script cmds policies))
+      :out
+      core/parse-batch-output))
+
+(deftest batch-test
+  (testing "simple"
+    (let [rs (run-batch ["echo hi" "printf 'a\\nb'; echo e >&2"]
+                        [:stop :stop])]
+      (is (= [{:index 0, :exit 0, :out "hi\n", :err ""}
+              {:index 1, :exit 0, :out "a\nb", :err "e\n"}]
+             (map #(dissoc % :time) rs)))
+      (is (every? (comp integer? :time) rs))
+      (is (every? (comp not neg? :time) rs))))
+
+  (testing "unicode and comments"
+    (is (= ["ünïcødé\n" "x\n"]
+           (map :out (run-batch ["echo ünïcødé # a comment" "echo x"]
+                                [:stop :stop])))))
+
+  (testing "invalid utf-8 doesn't disturb framing"
+    (is (= ["\uFFFD\n" "after\n"]
+           (map :out (run-batch ["printf '\\377\\n'" "echo after"]
+                                [:stop :stop])))))
+
+  (testing "partial frames"
+    (is (= [{:index 0, :exit 0, :time 5, :out "hi", :err ""}]
+           (core/parse-batch-output "0 0 5\naGk=\n\n1 0 3\n"))))
+
+  (testing "stop"
+    (is (= [[0 0] [1 3]]
+           (map (juxt :index :exit)
+                (run-batch ["true" "exit 3" "echo never"]
+                           [:stop :stop :stop])))))
+
+  (testing "continue and ignore"
+    (is (= [[0 1] [1 2] [2 0]]
+           (map (juxt :index :exit)
+                (run-batch ["exit 1" "exit 2" "true"]
+                           [:continue :ignore :stop])))))
+
+  (testing "stdin is empty"
+    (is (= [""] (map :out (run-batch ["cat"] [:stop]))))))
+
+(deftest download-plan-test
+  (let [find (fn [args]
+               (case (last args)
+                 :d "/data\n/data/empty\n"
+                 :f "/data/a\n/data/sub/b\n"))
+        plan (fn [src]
+               (let [{:keys [dirs files]}
+                     (core/download-plan find src "/nonexistent/out")]
+                 {:dirs  (map str dirs)
+                  :files (map (fn [[f file]] [f (str file)]) files)}))]
+    (is (= {:dirs  ["/nonexistent/out" "/nonexistent/out/empty"]
+            :files [["/data/a" "/nonexistent/out/a"]
+                    ["/data/sub/b" "/nonexistent/out/sub/b"]]}
+           (plan "/data")))
+    (testing "trailing slash"
+      (is (= (plan "/data") (plan "/data/"))))
+    (testing "follows symlinks"
+      (is (= [:find :-L "/data" :-type :f]
+             (let [args (atom nil)]
+               (core/download-plan (fn [a] (reset! args a) "") "/data/" "/x")
+               @args))))))
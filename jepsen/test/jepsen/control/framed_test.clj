@@ -0,0 +1,98 @@
+(ns jepsen.control.framed-test
+  (:require [clojure [string :as str]
+                     [test :refer :all]]
+            [jepsen.control.framed :as framed]
+            [slingshot.slingshot :refer [try+ throw+]]))
+
+(defn local-channel
+  "Runs the framed shell loop as a local process, with bash by default."
+  ([]
+   (local-channel "bash"))
+  ([shell]
+   (let [{:keys [stdin stdout close]}
+         (framed/process-stream! [shell "-c" (framed/shell-script shell)])]
+     (framed/channel stdout stdin close))))
+
+(deftest encode-test
+  (is (= "" (framed/encode nil)))
+  (is (= "aGk=" (framed/encode "hi")))
+  (is (= "AP8=" (framed/encode (byte-array [0 -1]))))
+  (is (= "aGk=" (framed/encode (java.io.ByteArrayInputStream.
+                                  (.getBytes "hi" "UTF-8")))))
+  (is (thrown? IllegalArgumentException (framed/encode 5))))
+
+(deftest framed-test
+  (let [ch (local-channel)]
+    (try
+      (testing "simple exec"
+        (is (= {:cmd "echo hi", :exit 0, :out "hi\n", :err ""}
+               (framed/execute! ch {:cmd "echo hi"}))))
+
+      (testing "stdin"
+        (is (= "some\ninput"
+               (:out (framed/execute! ch {:cmd "cat", :in "some\ninput"})))))
+
+      (testing "binary stdin"
+        (is (= "00 ff 02"
+               (str/trim (:out (framed/execute!
+                                 ch {:cmd "od -An -tx1"
+                                     :in  (byte-array [0 -1 2])}))))))
+
+      (testing "exit status and stderr"
+        (let [res (framed/execute! ch {:cmd "printf 'a\\nb'; echo e >&2; exit 3"})]
+          (is (= 3 (:exit res)))
+          (is (= "a\nb" (:out res)))
+          (is (= "e\n" (:err res)))))
+
+      (testing "pipelining"
+        (is (= (map str (range 100))
+               (->> (range 100)
+                    (map (fn [i] {:cmd (str "echo -n " i)}))
+                    (framed/execute-all! ch)
+                    (map :out)))))
+
+      (testing "concurrent"
+        (is (= (map str (range 20))
+               (->> (range 20)
+                    (mapv (fn [i]
+                            (future (:out (framed/execute!
+                                            ch {:cmd (str "echo -n " i)})))))
+                    (map deref)))))
+
+      (testing "broken channel"
+        (framed/close! ch)
+        (is (not (framed/open? ch)))
+        (is (= :failed
+               (try+ (framed/execute! ch {:cmd "true"})
+                     (catch [:type :jepsen.control/ssh-failed] e
+                       :failed)))))
+      (finally
+        (framed/close! ch)))))
+
+(deftest sh-test
+  (let [ch (local-channel "sh")]
+    (try
+      (is (= {:cmd "echo hi; echo e >&2; exit 2", :exit 2, :out "hi\n",
+              :err "e\n"}
+             (framed/execute! ch {:cmd "echo hi; echo e >&2; exit 2"})))
+      (is (= "xyz" (:out (framed/execute! ch {:cmd "cat", :in "xyz"}))))
+      (finally
+        (framed/close! ch)))))
+
+(deftest pool-test
+  (let [pool   (java.util.concurrent.ConcurrentLinkedQueue.)
+        opened (atom 0)
+        open   (fn [] (swap! opened inc) (local-channel))]
+    (try
+      (is (= (map str (range 10))
+             (->> (range 10)
+                  (mapv (fn [i]
+                          (future
+                            (:out (framed/execute-pooled!
+                                    pool open {:cmd (str "echo -n " i)})))))
+                  (map deref))))
+      (is (<= 1 @opened 10))
+      (is (= @opened (count pool)))
+      (finally
+        (framed/close-pool! pool)))
+    (is (zero? (count pool)))))
@@ -0,0 +1,45 @@
+(ns jepsen.control.profile-test
+  (:require [clojure [test :refer :all]]
+            [jepsen.control.profile :as p])
+  (:import (jepsen.control.profile Event)))
+
+(deftest summary-test
+  (let [e (fn [host cmd ms]
+            (Event. :exec host cmd 0 nil (* ms 1000000) 10))
+        s (p/summary 2 [(e "n1" "apt-get install" 100)
+                        (e "n2" "apt-get install" 300)
+                        (e "n1" "echo" 1)
+                        (e "n1" "echo" 1)
+                        (e "n2" "hostname" 2)])]
+    (is (= 5 (:count s)))
+    (is (= 404.0 (:time s)))
+    (is (= [{:kind :exec, :cmd "apt-get install", :count 2, :time 400.0,
+             :max 300.0}
+            {:kind :exec, :cmd "hostname", :count 1, :time 2.0, :max 2.0}]
+           (:top-commands s)))
+    (is (= {"n1" {:count 3, :time 102.0, :queue 0.0, :bytes 30}
+            "n2" {:count 2, :time 302.0, :queue 0.0, :bytes 20}}
+           (:nodes s)))
+    (is (= 102.0 (:min (:skew s))))
+    (is (= 302.0 (:max (:skew s))))))
+
+(deftest ring-test
+  (p/reset!)
+  (dotimes [i (+ 5 p/capacity)]
+    (p/record! :exec "n1" i (System/nanoTime) nil 0))
+  (let [es (p/events)]
+    (is (= p/capacity (count es)))
+    (is (= "5" (:cmd (first es))))
+    (is (= (str (+ 4 p/capacity)) (:cmd (peek es)))))
+  (p/reset!)
+  (is (= [] (p/events))))
+
+(deftest sessions-test
+  (let [e (fn [kind host ms] (Event. kind host (name kind) 0 nil (* ms 1000000)
+                                     nil))]
+    (is (= {"n1" {:connect 30.0, :auth 20.0}
+            "n2" {:connect 5.0}}
+           (:sessions (p/summary [(e :connect "n1" 30)
+                                  (e :auth "n1" 20)
+                                  (e :connect "n2" 5)
+                                  (e :exec "n2" 100)]))))))
@@ -0,0 +1,34 @@
+(ns jepsen.control.relay-test
+  (:require [clojure [test :refer :all]]
+            [clojure.java.shell :refer [sh]]
+            [jepsen.control.relay :as relay]))
+
+(deftest parents-test
+  (let [ps (relay/parents 2 ["n1" "n2" "n3" "n4" "n5" "n6" "n7"])]
+    (is (= {"n1" nil, "n2" nil
+            "n3" "n1", "n4" "n1"
+            "n5" "n2", "n6" "n2"
+            "n7" "n3"}
+           ps))
+    (is (= [] (relay/path ps "n1")))
+    (is (= ["n2"] (relay/path ps "n6")))
+    (is (= ["n1" "n3"] (relay/path ps "n7")))
+    (is (= [] (relay/path ps "elsewhere"))))
+
+  (testing "wide fanout"
+    (is (every? nil? (vals (relay/parents 8 (range 8)))))))
+
+(deftest quote-arg-test
+  (doseq [s ["echo hi" "it's" "a'b'\"c\" $x `y` \\ | ; & *" ""]]
+    (is (= s (:out (sh "bash" "-c" (str "printf '%s' " (relay/quote-arg s))))))))
+
+(deftest hop-test
+  (let [h (relay/hop {:port 2222, :username "admin"} "n3" "echo hi")]
+    (is (re-find #"StrictHostKeyChecking=yes" h))
+    (is (not (re-find #" -i " h)))
+    (is (re-find #"-p 2222 -l 'admin' 'n3' 'echo hi'$" h)))
+  (let [h (relay/hop {:strict-host-key-checking :no
+                      :private-key-path         "/root/.ssh/id_rsa"}
+                     "n3" "true")]
+    (is (re-find #"StrictHostKeyChecking=no" h))
+    (is (re-find #" -i '/root/.ssh/id_rsa' " h))))
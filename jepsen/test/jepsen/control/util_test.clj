@@ -89,3 +89,25 @@
       (assert-file-cached url)
       (util/cached-wget! (str url) {:force? true :user? "anonymous" :pw? "anonymous"})
       (assert-file-cached url))))
+
+(deftest ^:integration stream-download-test
+  (let [dir   (str "/tmp/jepsen/stream-download-test")
+        local (io/file "/tmp/jepsen/stream-download-test-local")]
+    (try
+      (c/exec :mkdir :-p (str dir "/sub"))
+      (c/exec :echo "hello" :> (str dir "/a.log"))
+      (c/exec :seq 1 10000 :> (str dir "/sub/b.log"))
+      (testing "full"
+        (let [res (util/stream-download! dir local {:strip-components 2})]
+          (is (pos? (:bytes res)))
+          (is (= "hello\n" (slurp (io/file local "stream-download-test/a.log"))))
+          (is (= 10000 (count (str/split-lines
+                                (slurp (io/file local "stream-download-test/sub/b.log"))))))))
+      (testing "tail"
+        (util/stream-download! dir local {:strip-components 2
+                                          :max-file-bytes   6})
+        (is (= "10000\n" (slurp (io/file local "stream-download-test/sub/b.log")))))
+      (finally
+        (c/exec :rm :-rf dir)
+        (doseq [f (reverse (file-seq local))]
+          (.delete ^java.io.File f))))))
@@ -6,7 +6,8 @@
             [jepsen [control :as c]
                     [common-test :refer [quiet-logging]]
                     [util :refer [contains-many? real-pmap]]]
-            [jepsen.control [sshj    :as sshj]
+            [jepsen.control [agent   :as agent]
+                            [sshj    :as sshj]
                             [clj-ssh :as clj-ssh]
                             [util    :as cu]]
             [slingshot.slingshot :refer [try+ throw+]])
@@ -161,3 +162,9 @@
 (deftest ^:integration sshj-remote-test
   ;(info :sshj)
   (test-remote (sshj/remote)))
+
+(deftest ^:integration sshj-persistent-shell-remote-test
+  (test-remote (sshj/remote {:persistent-shell? true})))
+
+(deftest ^:integration agent-remote-test
+  (test-remote (agent/remote)))
@@ -0,0 +1,55 @@
+(ns jepsen.nemesis.cgroup-test
+  (:require [clojure [test :refer :all]]
+            [jepsen.nemesis.cgroup :as cgroup]))
+
+(deftest process-tree-test
+  (let [ps (str "    1     0 systemd\n"
+                "  100     1 java\n"
+                "  101   100 sh\n"
+                "  102   101 sleep\n"
+                "  200     1 sshd\n"
+                "  300     1 java\n")]
+    (is (= [100 300 101 102] (cgroup/process-tree ps "java")))
+    (is (= [] (cgroup/process-tree ps "postgres")))))
+
+(deftest parse-freeze-test
+  (is (= {:requested 1600000000000000000, :observed 1600000000000021039}
+         (cgroup/parse-freeze "1600000000000000000 1600000000000021039\n"))))
+
+(deftest parse-strobe-test
+  (is (= {:count 500, :max-late-us 87}
+         (cgroup/parse-strobe "500 87\n"))))
+
+(deftest limit-files-test
+  (is (= [["cpu.max"     "50000 100000"]
+          ["memory.high" "1048576"]
+          ["io.max"      "8:0 rbps=1024 wbps=max riops=max wiops=10"]
+          ["io.max"      "8:16 rbps=1024 wbps=max riops=max wiops=10"]]
+         (cgroup/limit-files {:cpu    0.5
+                              :memory 1048576
+                              :io     {:rbps 1024, :wiops 10}}
+                             ["8:0" "8:16"])))
+  (is (= [["cpu.max" "max 100000"] ["memory.high" "max"]]
+         (cgroup/limit-files {:cpu nil, :memory nil} nil))))
+
+(deftest lift-files-test
+  (is (= [] (cgroup/lift-files {})))
+  (is (= [] (cgroup/lift-files {"cpu.max"     "max 100000\n"
+                                "memory.high" "max\n"
+                                "io.max"      ""})))
+  (is (= [["cpu.max" "max 100000"]
+          ["io.max"  "8:0 rbps=max wbps=max riops=max wiops=max"]]
+         (cgroup/lift-files
+           {"cpu.max"     "50000 100000\n"
+            "memory.high" "max\n"
+            "io.max"      "8:0 rbps=1024 wbps=max riops=max wiops=max\n"}))))
+
+(deftest controllers-test
+  (is (= ["cpu"] (cgroup/controllers {:cpu 0.5})))
+  (is (= ["memory" "io"] (cgroup/controllers {:io {}, :memory 1}))))
+
+(deftest ramp-limits-test
+  (is (= [{:cpu 0.5, :memory 10} {:cpu 0.25, :memory 10}]
+         (cgroup/ramp-limits {:cpu 1} {:cpu 0.25, :memory 10} 2)))
+  (is (= [{:io {:rbps 100.0}}]
+         (cgroup/ramp-limits {:io {:rbps 1000}} {:io {:rbps 100}} 1))))
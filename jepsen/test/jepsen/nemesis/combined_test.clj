@@ -55,3 +55,87 @@
 
     (testing "primaries"
       (check-db (first-primary-db) true))))
+
+(deftest partition-package-flap-test
+  ; Flaps heal the network when they finish, so they must only ever take the
+  ; place of a start, never land during a partition.
+  (let [pkg  (partition-package {:faults    #{:partition}
+                                 :interval  1/100
+                                 :db        db/noop
+                                 :partition {:flap true}})
+        test (assoc it/base-test
+                    :client    (it/ok-client)
+                    :nemesis   (it/info-nemesis)
+                    :generator (gen/nemesis (gen/limit 20 (:generator pkg))))
+        ; Invocations and completions alternate; take the invocations
+        fs   (->> (util/with-relative-time (interpreter/run! test))
+                  (take-nth 2)
+                  (map :f))]
+    (is (= 20 (count fs)))
+    (is (every? #{:start-partition :flap-partition} (take-nth 2 fs)))
+    (is (every? #{:stop-partition} (take-nth 2 (rest fs))))))
+
+(deftest flap-op-test
+  (let [r   (rng {:seed 1} :partition)
+        ops (repeatedly 20 #(flap-op r [:one :majority] true))]
+    (is (every? (comp #{:flap-partition} :f) ops))
+    (is (every? (comp #{:one :majority} :target :value) ops))
+    (is (every? #(<= 0.1 (:duty (:value %)) 0.9) ops))
+    (is (every? #(<= 1 (:period (:value %)) 1024) ops)))
+
+  (testing "fixed options"
+    (is (= {:period 5, :duty 1/2, :duration 3}
+           (-> (flap-op (rng {} :partition) [:one]
+                        {:period 5, :duty 1/2, :duration 3})
+               :value
+               (dissoc :target))))))
+
+(deftest throttle-links-test
+  (let [test {:nodes ["n1" "n2" "n3"]}]
+    (is (= 1 (count (throttle-links test db/noop :link))))
+    (is (= #{["n1" "n2"] ["n1" "n3"] ["n2" "n1"] ["n3" "n1"]}
+           (set (throttle-links test db/noop ["n1"]))))
+    (is (= 6 (count (throttle-links test db/noop :all))))))
+
+(defn emit
+  "The op a generator emits first, in the interpreter's base test."
+  [gen]
+  (first (gen/op gen it/base-test (gen/context it/base-test))))
+
+(deftest packet-gen-test
+  (let [ops (fn [seed]
+              (let [g (packet-gen (rng {:seed seed} :packet) db/noop
+                                  [:reorder :corrupt] [:one :link] [1 10])]
+                (mapv emit (take 20 g))))]
+    (is (every? (comp #{:start-packet} :f) (ops 1)))
+    (is (every? (comp #{:one :link} :target :value) (ops 1)))
+    (is (every? #(or (:reorder (:value %)) (:corrupt (:value %))) (ops 1)))
+    (testing "links"
+      (is (every? (comp seq :links :value) (ops 1)))
+      (is (every? (fn [{:keys [value]}]
+                    (case (:target value)
+                      :link (= 1 (count (:links value)))
+                      :one  (= 8 (count (:links value)))))
+                  (ops 1))))
+    (testing "seeded"
+      (is (= (ops 5) (ops 5)))
+      (is (not= (map (comp :links :value) (ops 5))
+                (map (comp :links :value) (ops 6)))))))
+
+(deftest seeded-package-test
+  ; The interpreter may ask for an op several times before taking one; asking
+  ; mustn't consume randomness, or the seed wouldn't fix the run.
+  (let [gen (:generator (throttle-package {:faults #{:throttle}
+                                           :db     db/noop
+                                           :seed   7}))
+        ctx (gen/context it/base-test)
+        [a _]    (gen/op gen it/base-test ctx)
+        [b _]    (gen/op gen it/base-test ctx)
+        [c _]    (gen/op (:generator (throttle-package {:faults #{:throttle}
+                                                        :db     db/noop
+                                                        :seed   7}))
+                         it/base-test ctx)]
+    (is (= (dissoc a :time) (dissoc b :time) (dissoc c :time)))
+    (is (#{:start-throttle :ramp-throttle} (:f a)))
+    ; Links come from the seed too
+    (is (seq (:links (:value a))))))
@@ -0,0 +1,14 @@
+(ns jepsen.nemesis.conntrack-test
+  (:require [clojure [test :refer :all]]
+            [jepsen.nemesis.conntrack :as ct]))
+
+(deftest peers-test
+  (is (= {"n1" #{"n2" "n3"}, "n2" #{"n1"}, "n3" #{"n1"}}
+         (ct/peers {"n1" ["n2" "n3"]})))
+  (testing "directed"
+    (is (= {"n1" #{"n2"}, "n2" #{"n1"}}
+           (ct/peers {"n1" {:output ["n2"]}}))))
+  (is (= {} (ct/peers {}))))
+
+(deftest parse-output-test
+  (is (= {:flushed 4, :reset 2} (ct/parse-output "4 2\n"))))
@@ -0,0 +1,20 @@
+(ns jepsen.nemesis.file-test
+  (:require [clojure [test :refer :all]]
+            [jepsen.nemesis.file :as file]))
+
+(deftest fault-line-test
+  (is (= "bitflip newest:/var/db/*.log -4096 16\n"
+         (file/fault-line {:kind   :bitflip
+                           :file   "/var/db/*.log"
+                           :select :newest
+                           :offset -4096
+                           :length 16})))
+  (is (= "truncate all:/var/db/x 0 1\n"
+         (file/fault-line {:kind :truncate, :file "/var/db/x"}))))
+
+(deftest parse-output-test
+  (is (= [{:kind :bitflip, :file "/var/db/3.log", :start 10, :end 12
+           :bits [81 90]}
+          {:kind :zero, :file "/var/db/1.log", :start 80, :end 100}]
+         (file/parse-output (str "bitflip /var/db/3.log 10 12 81,90\n"
+                                 "zero /var/db/1.log 80 100 -\n")))))
@@ -0,0 +1,21 @@
+(ns jepsen.nemesis.iofault-test
+  (:require [clojure [test :refer :all]]
+            [jepsen.nemesis.iofault :as iofault]))
+
+(deftest ctl-args-test
+  (is (= ["read_eio=0" "write_eio=10000" "write_enospc=0" "short_write=0"
+          "fsync_eio=0" "fsync_drop=1000000"
+          "read_delay=0" "write_delay=2500000" "fsync_delay=0"
+          "path=/var/db" "enabled=1"]
+         (iofault/ctl-args {:write-eio   0.01
+                            :fsync-drop  1
+                            :write-delay 2.5
+                            :path        "/var/db"}))))
+
+(deftest parse-ctl-test
+  (is (= {:enabled 1, :fsync-drop 1000000, :injected 42, :path "/var/db"}
+         (iofault/parse-ctl (str "enabled 1\n"
+                                 "fsync_drop 1000000\n"
+                                 "injected 42\n"
+                                 "path /var/db\n"))))
+  (is (= {:path ""} (iofault/parse-ctl "path \n"))))
@@ -0,0 +1,16 @@
+(ns jepsen.nemesis.power-test
+  (:require [clojure [test :refer :all]]
+            [jepsen.nemesis.power :as power]))
+
+(deftest files-test
+  (is (= {:dir  "/tmp/p"
+          :data "/tmp/p/data.img"
+          :base "/tmp/p/base.img"
+          :log  "/tmp/p/log.img"}
+         (power/files {:dir "/tmp/p"})))
+  (is (= "/opt/jepsen/power/log.img"
+         (:log (power/files {})))))
+
+(deftest parse-output-test
+  (is (= {:replayed 2, :dropped 1, :dropped-bytes 512}
+         (power/parse-output "2 1 512\n"))))
@@ -0,0 +1,29 @@
+(ns jepsen.nemesis.probe-test
+  (:require [clojure [test :refer :all]]
+            [jepsen.checker.perf :as perf]
+            [jepsen.nemesis.probe :as probe]))
+
+(deftest parse-events-test
+  (is (= [{:time 1600000000000000000, :ip "10.0.0.2", :state :down}
+          {:time 1600000000500000000, :ip "10.0.0.2", :state :up}]
+         (probe/parse-events
+           (str "2020-09-13 12:26:40 Jepsen starting /opt/jepsen/jepsen-probe\n"
+                "1600000000000000000 10.0.0.2 down\n"
+                "1600000000500000000 10.0.0.2 up\n")))))
+
+(deftest links-test
+  (is (= #{["n2" "n1"] ["n3" "n1"] ["n1" "n2"] ["n1" "n3"]}
+         (probe/links {"n1" ["n2" "n3"]
+                       "n2" ["n1"]
+                       "n3" ["n1"]}))))
+
+(deftest interval->outage-test
+  (is (nil? (perf/interval->outage [{:time 1} {:time 2}])))
+  (is (= [2.0 nil]
+         (perf/interval->outage [{:loss-onset {["n1" "n2"] 3e9
+                                               ["n2" "n1"] 2e9}}
+                                 nil])))
+  (is (= [2.0 5.0]
+         (perf/interval->outage [{:loss-onset {["n1" "n2"] 2e9}}
+                                 {:recovery {["n1" "n2"] 4e9
+                                             ["n2" "n1"] 5e9}}]))))
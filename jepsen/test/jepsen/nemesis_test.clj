@@ -4,6 +4,7 @@
             [jepsen.nemesis :refer :all]
             [jepsen.control :as c]
             [jepsen.control.net :as net]
+            [jepsen.net]
             [jepsen.util :refer [meh]]
             [jepsen.tests :refer [noop-test]]
             [clojure.set :as set]))
@@ -28,6 +29,21 @@
           4 #{1 2}
           5 #{1 2}})))
 
+(deftest one-way-grudge-test
+  (is (= {3 {:input #{1 2}}
+          4 {:input #{1 2}}}
+         (one-way-grudge [1 2] [3 4])))
+  (is (= {1 {:output #{3}}
+          2 {:output #{3}}}
+         (one-way-grudge :output [1 2] [3])))
+  (testing "pairs"
+    (is (= #{[1 3] [2 3]}
+           (set (jepsen.net/grudge->pairs (one-way-grudge [1 2] [3])))
+           (set (jepsen.net/grudge->pairs
+                  (one-way-grudge :output [1 2] [3])))))
+    (is (= #{[2 1] [3 1] [1 2]}
+           (set (jepsen.net/grudge->pairs {1 #{2 3}, 2 [1]}))))))
+
 (deftest bridge-test
   (is (= (bridge [1 2 3 4 5])
          {1 #{4 5}
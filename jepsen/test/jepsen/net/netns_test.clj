@@ -0,0 +1,35 @@
+(ns jepsen.net.netns-test
+  (:require [clojure [test :refer :all]]
+            [jepsen.net.netns :as netns]))
+
+(def topo
+  (netns/topology {:nodes ["n1" "n2" "n3"]}))
+
+(deftest addressing-test
+  (is (= "10.77.0.1" (netns/bridge-ip topo)))
+  (is (= "10.77.0.2" (netns/ip topo "n1")))
+  (is (= "10.77.0.4" (netns/ip topo "n3")))
+  (is (= "jepsen-n2" (netns/netns topo "n2")))
+  (is (= "jepsen0v1" (netns/veth topo "n2"))))
+
+(deftest create-commands-test
+  (let [cmds (netns/create-commands topo)]
+    (is (= ["ip" "link" "add" "jepsen0" "type" "bridge"] (first cmds)))
+    (is (= (+ 3 (* 3 7)) (count cmds)))
+    (is (some #{["ip" "-n" "jepsen-n3" "addr" "add" "10.77.0.4/24"
+                 "dev" "eth0"]}
+              cmds))))
+
+(deftest hosts-test
+  (let [hosts "127.0.0.1 localhost\n"
+        added (netns/add-hosts topo hosts)]
+    (is (= (str hosts
+                "# BEGIN jepsen netns jepsen0\n"
+                "10.77.0.2 n1\n"
+                "10.77.0.3 n2\n"
+                "10.77.0.4 n3\n"
+                "# END jepsen netns jepsen0\n")
+           added))
+    (testing "idempotent"
+      (is (= added (netns/add-hosts topo added))))
+    (is (= hosts (netns/strip-hosts topo added)))))
@@ -0,0 +1,35 @@
+(ns jepsen.net.nftables-test
+  (:require [clojure [test :refer :all]]
+            [jepsen [net :as net]]
+            [jepsen.net.nftables :as nft]))
+
+(deftest ruleset-test
+  (is (= (str "add table inet jepsen\n"
+              "delete table inet jepsen\n"
+              "table inet jepsen {\n"
+              "  chain input {\n"
+              "    type filter hook input priority -100; policy accept;\n"
+              "    ip saddr { 10.0.0.1, 10.0.0.2 } drop\n"
+              "  }\n"
+              "}\n")
+         (nft/ruleset ["10.0.0.2" "10.0.0.1"])))
+
+  (testing "output"
+    (is (re-find #"chain output \{\n.*\n    ip daddr \{ 10\.0\.0\.3 \} drop"
+                 (nft/ruleset [] ["10.0.0.3"]))))
+
+  (testing "no sources"
+    (is (not (re-find #"saddr" (nft/ruleset []))))))
+
+(deftest parse-output-test
+  (is (= {:start 1600000000000000000, :commit 1600000000000012345}
+         (nft/parse-output "1600000000000000000 1600000000000012345\n"))))
+
+(deftest commit-times-test
+  (is (= {:commits {"n1" 100, "n2" 130}
+          :skew    30}
+         (net/commit-times {"n2" {:start 90, :commit 130}
+                            "n1" {:start 95, :commit 100}})))
+  (is (nil? (net/commit-times nil)))
+  (is (nil? (net/commit-times {})))
+  (is (nil? (net/commit-times {"n1" "" "n2" nil}))))
@@ -0,0 +1,61 @@
+(ns jepsen.net.tc-test
+  (:require [clojure [test :refer :all]]
+            [jepsen.net.tc :as tc]))
+
+(deftest netem-args-test
+  (is (= [] (tc/netem-args {})))
+  (is (= [:delay "100ms"] (tc/netem-args {:delay 100})))
+  (is (= [:delay "100ms" "10ms" "25%" :distribution :normal
+          :loss "5%" "50%"]
+         (tc/netem-args {:delay            100
+                         :jitter           10
+                         :correlation      25
+                         :distribution     :normal
+                         :loss             5
+                         :loss-correlation 50})))
+  (testing "jitter without delay"
+    (is (= [] (tc/netem-args {:jitter 10})))))
+
+(deftest minor-test
+  (let [test {:nodes ["n1" "n2" "n3"]}]
+    (is (= "1:10" (tc/classid (tc/minor test "n1"))))
+    (is (= "12:"  (tc/handle (tc/minor test "n3"))))))
+
+(deftest changes-test
+  (let [old {"n1" {"n2" {:delay 10}, "n3" {:loss 5}}
+             "n2" {"n1" {:delay 10}}}
+        new {"n1" {"n2" {:delay 10}, "n3" {:loss 10}}
+             "n3" {"n1" {:rate "1mbit"}}}]
+    (is (= {"n1" {"n3" {:loss 10}}
+            "n2" {"n1" {}}
+            "n3" {"n1" {:rate "1mbit"}}}
+           (tc/changes old new)))
+    (is (= {} (tc/changes new new)))))
+
+(deftest uniform-test
+  (is (= {"n1" {"n2" {:delay 1}}
+          "n2" {"n1" {:delay 1}}}
+         (tc/uniform ["n1" "n2"] {:delay 1}))))
+
+(deftest link-commands-test
+  (is (= [["/sbin/tc" :class :change :dev "eth0" :parent "1:" :classid "1:11"
+           :htb :rate "1mbit" :ceil "1mbit"]
+          ["/sbin/tc" :qdisc :replace :dev "eth0" :parent "1:11" :handle "11:"
+           :netem :delay "5ms"]]
+         (tc/link-commands "eth0" 17 {:delay 5, :rate "1mbit"}))))
+
+(deftest throttle-test
+  (is (= [:limit 10] (tc/netem-args {:limit 10, :rate 100})))
+  (is (= "100kbit" (tc/rate 100)))
+  (is (= "1mbit" (tc/rate "1mbit")))
+  (is (= [1000 100 10] (tc/ramp-rates 10000 10 3)))
+  (is (= {"n1" {"n2" {:rate 1}, "n3" {:rate 1}}}
+         (tc/links->matrix [["n1" "n2"] ["n1" "n3"]] (constantly {:rate 1})))))
+
+(deftest packet-test
+  (is (= [:delay "10ms" :reorder "25%" "50%" :gap 5]
+         (tc/netem-args {:reorder 25, :reorder-correlation 50, :gap 5})))
+  (is (= [:delay "30ms" :reorder "25%"]
+         (tc/netem-args {:delay 30, :reorder 25})))
+  (is (= [:duplicate "1%" :corrupt "2%" "10%"]
+         (tc/netem-args {:duplicate 1, :corrupt 2, :corrupt-correlation 10}))))